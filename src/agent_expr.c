@@ -0,0 +1,546 @@
+#include "agent_expr.h"
+#include "cpu.h"
+#include "macros.h"
+#include "memory.h"
+#include "stdinc.h"
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static constexpr size_t STACK_CAPACITY = 64;
+static constexpr u32 MAX_STEPS = 10'000;
+
+/**
+ * \brief Opcodes of GDB agent expressions. Those missing are not supported.
+ */
+typedef enum AgentOp : u8 {
+    AgentOp_Add = 0x02,
+    AgentOp_Sub = 0x03,
+    AgentOp_Mul = 0x04,
+    AgentOp_DivSigned = 0x05,
+    AgentOp_DivUnsigned = 0x06,
+    AgentOp_RemSigned = 0x07,
+    AgentOp_RemUnsigned = 0x08,
+    AgentOp_Lsh = 0x09,
+    AgentOp_RshSigned = 0x0A,
+    AgentOp_RshUnsigned = 0x0B,
+    AgentOp_Trace = 0x0C,
+    AgentOp_TraceQuick = 0x0D,
+    AgentOp_LogNot = 0x0E,
+    AgentOp_BitAnd = 0x0F,
+    AgentOp_BitOr = 0x10,
+    AgentOp_BitXor = 0x11,
+    AgentOp_BitNot = 0x12,
+    AgentOp_Equal = 0x13,
+    AgentOp_LessSigned = 0x14,
+    AgentOp_LessUnsigned = 0x15,
+    AgentOp_Ext = 0x16,
+    AgentOp_Ref8 = 0x17,
+    AgentOp_Ref16 = 0x18,
+    AgentOp_Ref32 = 0x19,
+    AgentOp_Ref64 = 0x1A,
+    AgentOp_IfGoto = 0x20,
+    AgentOp_Goto = 0x21,
+    AgentOp_Const8 = 0x22,
+    AgentOp_Const16 = 0x23,
+    AgentOp_Const32 = 0x24,
+    AgentOp_Const64 = 0x25,
+    AgentOp_Reg = 0x26,
+    AgentOp_End = 0x27,
+    AgentOp_Dup = 0x28,
+    AgentOp_Pop = 0x29,
+    AgentOp_ZeroExt = 0x2A,
+    AgentOp_Swap = 0x2B,
+    AgentOp_Tracev = 0x2E,
+    AgentOp_Tracenz = 0x2F,
+    AgentOp_Trace16 = 0x30,
+    AgentOp_Pick = 0x32,
+    AgentOp_Rot = 0x33,
+} AgentOp;
+
+typedef struct Machine {
+    const AgentExpr *expr;
+    size_t pc;
+    u64 stack[STACK_CAPACITY];
+    size_t sp;
+} Machine;
+
+/**
+ * \brief Reads a big-endian operand of size bytes following the current opcode.
+ */
+[[nodiscard]] static bool read_operand(Machine *const m, const size_t size, u64 *const out)
+{
+    if (m->expr->size - m->pc < size)
+        return false;
+
+    u64 value = 0;
+
+    for (size_t i = 0; i < size; ++i)
+        value = (value << 8) | m->expr->code[m->pc + i];
+
+    m->pc += size;
+    *out = value;
+    return true;
+}
+
+[[nodiscard]] static u64 sign_extend(const u64 value, const u64 bits)
+{
+    if (bits == 0 || bits >= 64)
+        return value;
+
+    const u64 sign = 1ULL << (bits - 1);
+    const u64 masked = value & ((1ULL << bits) - 1);
+
+    return (masked ^ sign) - sign;
+}
+
+/**
+ * \brief Applies a binary operator to the two values on top of the stack, a being the deeper one.
+ */
+[[nodiscard]] static AgentExprResult binary_op(const AgentOp op, const u64 a, const u64 b,
+                                               u64 *const out)
+{
+    const bool divides = op == AgentOp_DivSigned || op == AgentOp_DivUnsigned ||
+                         op == AgentOp_RemSigned || op == AgentOp_RemUnsigned;
+
+    if (divides && b == 0)
+        return AgentExprResult_DivideByZero;
+
+    // INT64_MIN / -1 overflows, it wraps around instead
+    const bool overflows = (i64)a == INT64_MIN && (i64)b == -1;
+
+    switch (op) {
+    case AgentOp_Add:
+        *out = a + b;
+        break;
+
+    case AgentOp_Sub:
+        *out = a - b;
+        break;
+
+    case AgentOp_Mul:
+        *out = a * b;
+        break;
+
+    case AgentOp_DivSigned:
+        *out = overflows ? a : (u64)((i64)a / (i64)b);
+        break;
+
+    case AgentOp_DivUnsigned:
+        *out = a / b;
+        break;
+
+    case AgentOp_RemSigned:
+        *out = overflows ? 0 : (u64)((i64)a % (i64)b);
+        break;
+
+    case AgentOp_RemUnsigned:
+        *out = a % b;
+        break;
+
+    case AgentOp_Lsh:
+        *out = b >= 64 ? 0 : a << b;
+        break;
+
+    case AgentOp_RshSigned:
+        *out = (u64)((i64)a >> (b >= 64 ? 63 : b));
+        break;
+
+    case AgentOp_RshUnsigned:
+        *out = b >= 64 ? 0 : a >> b;
+        break;
+
+    case AgentOp_BitAnd:
+        *out = a & b;
+        break;
+
+    case AgentOp_BitOr:
+        *out = a | b;
+        break;
+
+    case AgentOp_BitXor:
+        *out = a ^ b;
+        break;
+
+    case AgentOp_Equal:
+        *out = a == b;
+        break;
+
+    case AgentOp_LessSigned:
+        *out = (i64)a < (i64)b;
+        break;
+
+    case AgentOp_LessUnsigned:
+        *out = a < b;
+        break;
+
+    default:
+        return AgentExprResult_UnsupportedOpcode;
+    }
+
+    return AgentExprResult_Ok;
+}
+
+/**
+ * \brief Replaces the address on top of the stack with the little-endian value it points to.
+ */
+[[nodiscard]] static AgentExprResult ref(Machine *const m, const Memory *const mem,
+                                         const u32 size)
+{
+    const u8 *data = nullptr;
+
+    if (Memory_read_span(mem, (u32)m->stack[m->sp - 1], size, &data) != MemoryResult_Ok)
+        return AgentExprResult_MemoryFault;
+
+    u64 value = 0;
+
+    for (u32 i = 0; i < size; ++i)
+        value |= (u64)data[i] << (8 * i);
+
+    m->stack[m->sp - 1] = value;
+    return AgentExprResult_Ok;
+}
+
+/**
+ * \brief Returns the number of values an opcode needs on the stack.
+ */
+[[nodiscard]] static size_t operands_needed(const AgentOp op)
+{
+    switch (op) {
+    case AgentOp_Add:
+    case AgentOp_Sub:
+    case AgentOp_Mul:
+    case AgentOp_DivSigned:
+    case AgentOp_DivUnsigned:
+    case AgentOp_RemSigned:
+    case AgentOp_RemUnsigned:
+    case AgentOp_Lsh:
+    case AgentOp_RshSigned:
+    case AgentOp_RshUnsigned:
+    case AgentOp_BitAnd:
+    case AgentOp_BitOr:
+    case AgentOp_BitXor:
+    case AgentOp_Equal:
+    case AgentOp_LessSigned:
+    case AgentOp_LessUnsigned:
+    case AgentOp_Trace:
+    case AgentOp_Tracenz:
+    case AgentOp_Swap:
+        return 2;
+
+    case AgentOp_Rot:
+        return 3;
+
+    case AgentOp_LogNot:
+    case AgentOp_BitNot:
+    case AgentOp_Ext:
+    case AgentOp_ZeroExt:
+    case AgentOp_Ref8:
+    case AgentOp_Ref16:
+    case AgentOp_Ref32:
+    case AgentOp_Ref64:
+    case AgentOp_IfGoto:
+    case AgentOp_End:
+    case AgentOp_Dup:
+    case AgentOp_Pop:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+/**
+ * \brief Executes a single opcode.
+ *
+ * \param done Will be set to true when the expression has ended.
+ */
+[[nodiscard]] static AgentExprResult step(Machine *const m, const Cpu *const cpu,
+                                          const Memory *const mem, bool *const done)
+{
+    const AgentOp op = m->expr->code[m->pc++];
+    u64 operand = 0;
+
+    if (m->sp < operands_needed(op))
+        return AgentExprResult_StackUnderflow;
+
+    u64 *const top = m->sp == 0 ? nullptr : &m->stack[m->sp - 1];
+
+    switch (op) {
+    case AgentOp_LogNot:
+        *top = *top == 0;
+        return AgentExprResult_Ok;
+
+    case AgentOp_BitNot:
+        *top = ~*top;
+        return AgentExprResult_Ok;
+
+    case AgentOp_Ext:
+    case AgentOp_ZeroExt:
+        if (!read_operand(m, 1, &operand))
+            return AgentExprResult_BadOperand;
+
+        if (op == AgentOp_Ext)
+            *top = sign_extend(*top, operand);
+        else if (operand < 64)
+            *top &= (1ULL << operand) - 1;
+
+        return AgentExprResult_Ok;
+
+    case AgentOp_Ref8:
+        return ref(m, mem, 1);
+
+    case AgentOp_Ref16:
+        return ref(m, mem, 2);
+
+    case AgentOp_Ref32:
+        return ref(m, mem, 4);
+
+    case AgentOp_Ref64:
+        return ref(m, mem, 8);
+
+    case AgentOp_IfGoto:
+    case AgentOp_Goto: {
+        if (!read_operand(m, 2, &operand) || operand >= m->expr->size)
+            return AgentExprResult_BadOperand;
+
+        bool taken = true;
+
+        if (op == AgentOp_IfGoto)
+            taken = m->stack[--m->sp] != 0;
+
+        if (taken)
+            m->pc = operand;
+
+        return AgentExprResult_Ok;
+    }
+
+    case AgentOp_Const8:
+    case AgentOp_Const16:
+    case AgentOp_Const32:
+    case AgentOp_Const64:
+    case AgentOp_Reg:
+        if (m->sp == STACK_CAPACITY)
+            return AgentExprResult_StackOverflow;
+
+        if (!read_operand(m, op == AgentOp_Reg ? 2 : 1U << (op - AgentOp_Const8), &operand))
+            return AgentExprResult_BadOperand;
+
+        if (op == AgentOp_Reg) {
+            if (operand >= CPU_GDB_REGS_SIZE)
+                return AgentExprResult_BadOperand;
+
+            operand = Cpu_read_gdb_register(cpu, operand);
+        }
+
+        m->stack[m->sp++] = operand;
+        return AgentExprResult_Ok;
+
+    case AgentOp_End:
+        *done = true;
+        return AgentExprResult_Ok;
+
+    case AgentOp_Dup:
+        if (m->sp == STACK_CAPACITY)
+            return AgentExprResult_StackOverflow;
+
+        m->stack[m->sp] = *top;
+        ++m->sp;
+        return AgentExprResult_Ok;
+
+    case AgentOp_Pop:
+        --m->sp;
+        return AgentExprResult_Ok;
+
+    case AgentOp_Swap: {
+        const u64 b = m->stack[m->sp - 1];
+        m->stack[m->sp - 1] = m->stack[m->sp - 2];
+        m->stack[m->sp - 2] = b;
+        return AgentExprResult_Ok;
+    }
+
+    case AgentOp_Pick:
+        if (!read_operand(m, 1, &operand))
+            return AgentExprResult_BadOperand;
+
+        if (operand >= m->sp)
+            return AgentExprResult_StackUnderflow;
+
+        if (m->sp == STACK_CAPACITY)
+            return AgentExprResult_StackOverflow;
+
+        m->stack[m->sp] = m->stack[m->sp - 1 - operand];
+        ++m->sp;
+        return AgentExprResult_Ok;
+
+    case AgentOp_Rot: {
+        // a b c => c a b
+        const u64 c = m->stack[m->sp - 1];
+        m->stack[m->sp - 1] = m->stack[m->sp - 2];
+        m->stack[m->sp - 2] = m->stack[m->sp - 3];
+        m->stack[m->sp - 3] = c;
+        return AgentExprResult_Ok;
+    }
+
+    // Nothing is ever traced, the operands are only consumed
+    case AgentOp_Trace:
+    case AgentOp_Tracenz:
+        m->sp -= 2;
+        return AgentExprResult_Ok;
+
+    case AgentOp_TraceQuick:
+        return read_operand(m, 1, &operand) ? AgentExprResult_Ok : AgentExprResult_BadOperand;
+
+    case AgentOp_Tracev:
+    case AgentOp_Trace16:
+        return read_operand(m, 2, &operand) ? AgentExprResult_Ok : AgentExprResult_BadOperand;
+
+    default: {
+        if (operands_needed(op) != 2)
+            return AgentExprResult_UnsupportedOpcode;
+
+        const AgentExprResult result =
+            binary_op(op, m->stack[m->sp - 2], m->stack[m->sp - 1], &m->stack[m->sp - 2]);
+        --m->sp;
+        return result;
+    }
+    }
+}
+
+const char *AgentExprResult_display(const AgentExprResult result)
+{
+    switch (result) {
+    case AgentExprResult_Ok:
+        return "Ok.";
+    case AgentExprResult_UnsupportedOpcode:
+        return "Unsupported opcode.";
+    case AgentExprResult_BadOperand:
+        return "Bad operand.";
+    case AgentExprResult_StackOverflow:
+        return "Stack overflow.";
+    case AgentExprResult_StackUnderflow:
+        return "Stack underflow.";
+    case AgentExprResult_MemoryFault:
+        return "Memory fault.";
+    case AgentExprResult_DivideByZero:
+        return "Division by zero.";
+    case AgentExprResult_TooLong:
+        return "Too many steps.";
+    default:
+        return "Unknown error.";
+    }
+}
+
+AgentExprResult AgentExpr_eval(const AgentExpr *const expr, const Cpu *const cpu,
+                               const Memory *const mem, i64 *const value)
+{
+    // The stack is left uninitialised, since it is evaluated on every hit of a breakpoint
+    Machine m;
+    m.expr = expr;
+    m.pc = 0;
+    m.sp = 0;
+
+    bool done = false;
+
+    for (u32 steps = 0; steps < MAX_STEPS; ++steps) {
+        if (m.pc >= expr->size)
+            return AgentExprResult_BadOperand;
+
+        const AgentExprResult result = step(&m, cpu, mem, &done);
+
+        if (result != AgentExprResult_Ok)
+            return result;
+
+        if (done) {
+            *value = (i64)m.stack[m.sp - 1];
+            return AgentExprResult_Ok;
+        }
+    }
+
+    return AgentExprResult_TooLong;
+}
+
+/**
+ * \brief Parses one "X<size>,<bytecode in hex>" condition and appends it to a list.
+ *
+ * \return The end of the condition, or nullptr if it is malformed.
+ */
+[[nodiscard]] static const char *parse_condition(const char *const pos, AgentExpr **const exprs,
+                                                 size_t *const exprs_size)
+{
+    char *split = nullptr;
+    const size_t size = strtoul(&pos[1], &split, 16);
+
+    if (*split != ',' || size == 0 || size > strlen(split + 1) / 2)
+        return nullptr;
+
+    const char *const hex = split + 1;
+
+    for (size_t i = 0; i < 2 * size; ++i) {
+        if (isxdigit((unsigned char)hex[i]) == 0)
+            return nullptr;
+    }
+
+    AgentExpr *const new_exprs = realloc(*exprs, (*exprs_size + 1) * sizeof(**exprs));
+    u8 *const code = malloc(size);
+
+    if (new_exprs == nullptr || code == nullptr)
+        BAIL("Could not allocate breakpoint condition");
+
+    for (size_t i = 0; i < size; ++i) {
+        char buf[3] = {};
+        memcpy(buf, hex + (2 * i), 2);
+
+        code[i] = (u8)strtoul(buf, nullptr, 16);
+    }
+
+    *exprs = new_exprs;
+    (*exprs)[*exprs_size] = (AgentExpr){
+        .code = code,
+        .size = size,
+    };
+    ++*exprs_size;
+
+    return hex + (2 * size);
+}
+
+bool AgentExpr_parse_conditions(const char *const params, AgentExpr **const exprs,
+                                size_t *const exprs_size)
+{
+    *exprs = nullptr;
+    *exprs_size = 0;
+
+    // Options follow the breakpoint kind, each starting with a ';'
+    for (const char *pos = strchr(params, ';'); pos != nullptr; pos = strchr(pos, ';')) {
+        ++pos;
+
+        // Anything else, like breakpoint commands, is never asked for
+        if (*pos != 'X')
+            continue;
+
+        while (pos != nullptr && *pos == 'X')
+            pos = parse_condition(pos, exprs, exprs_size);
+
+        if (pos == nullptr || (*pos != ';' && *pos != '\0')) {
+            for (size_t i = 0; i < *exprs_size; ++i)
+                AgentExpr_destroy(&(*exprs)[i]);
+
+            free(*exprs);
+            *exprs = nullptr;
+            *exprs_size = 0;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void AgentExpr_destroy(AgentExpr *const expr)
+{
+    free(expr->code);
+
+    expr->code = nullptr;
+    expr->size = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef RV32_EMU_AGENT_EXPR_H
+#define RV32_EMU_AGENT_EXPR_H
+
+#include "cpu.h"
+#include "memory.h"
+#include "stdinc.h"
+#include <stddef.h>
+
+typedef enum AgentExprResult : u8 {
+    AgentExprResult_Ok,
+    AgentExprResult_UnsupportedOpcode,
+    AgentExprResult_BadOperand, // Truncated operand, jump out of the bytecode or unknown register
+    AgentExprResult_StackOverflow,
+    AgentExprResult_StackUnderflow,
+    AgentExprResult_MemoryFault,
+    AgentExprResult_DivideByZero,
+    AgentExprResult_TooLong, // Ran for too many steps, most likely looping forever
+} AgentExprResult;
+
+[[nodiscard]] const char *AgentExprResult_display(AgentExprResult result);
+
+/**
+ * \brief Bytecode of a GDB agent expression, as sent along with a breakpoint condition.
+ */
+typedef struct AgentExpr {
+    u8 *code;
+    size_t size;
+} AgentExpr;
+
+/**
+ * \brief Evaluates an agent expression against the current state of the target.
+ *
+ * All integer opcodes are supported. Floating point, tracing state variables and printf are not,
+ * and trace opcodes do nothing. Registers are numbered as in the target description.
+ *
+ * \param expr The expression to evaluate.
+ * \param cpu The CPU to read registers from.
+ * \param mem The memory to read from, without triggering watchpoints.
+ * \param value Will be set to the value on top of the stack when the expression ends.
+ *
+ * \return AgentExprResult_Ok on success, an error otherwise.
+ */
+[[nodiscard]] AgentExprResult AgentExpr_eval(const AgentExpr *expr, const Cpu *cpu,
+                                             const Memory *mem, i64 *value);
+
+/**
+ * \brief Parses the conditions of a Z0 or Z1 packet.
+ *
+ * Each condition is sent as "X<size>,<bytecode in hex>". Conditions may each come in their own
+ * option or follow each other in one, as in ";X3,aabbccX2,ddee". Other options, like breakpoint
+ * commands sent as ";cmds:...", are skipped.
+ *
+ * \param params The rest of the packet after the breakpoint address.
+ * \param exprs Will be set to the parsed conditions, to be freed by the caller.
+ * \param exprs_size Will be set to the number of conditions.
+ *
+ * \return true on success, false if a condition is malformed.
+ */
+[[nodiscard]] bool AgentExpr_parse_conditions(const char *params, AgentExpr **exprs,
+                                              size_t *exprs_size);
+
+void AgentExpr_destroy(AgentExpr *expr);
+
+#endif
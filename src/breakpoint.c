@@ -0,0 +1,164 @@
+#include "breakpoint.h"
+#include "agent_expr.h"
+#include "macros.h"
+#include "memory.h"
+#include "stdinc.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+static constexpr size_t PAGE_BITMAP_SIZE = MEMORY_PAGE_COUNT / 64;
+
+BreakpointSet BreakpointSet_new(void)
+{
+    u64 *const pages = calloc(PAGE_BITMAP_SIZE, sizeof(*pages));
+
+    if (pages == nullptr)
+        BAIL("Could not allocate breakpoint bitmap");
+
+    return (BreakpointSet){
+        .pages = pages,
+        .breakpoints = nullptr,
+        .size = 0,
+        .capacity = 0,
+    };
+}
+
+/**
+ * \brief Returns the index of the first breakpoint at or above addr.
+ */
+[[nodiscard]] static size_t lower_bound(const BreakpointSet *const set, const u32 addr)
+{
+    size_t lo = 0;
+    size_t hi = set->size;
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (set->breakpoints[mid].addr < addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+[[nodiscard]] static Breakpoint *find(const BreakpointSet *const set, const u32 addr)
+{
+    const u32 page = addr / MEMORY_PAGE_SIZE;
+
+    if ((set->pages[page / 64] & (1ULL << (page % 64))) == 0)
+        return nullptr;
+
+    const size_t index = lower_bound(set, addr);
+
+    if (index == set->size || set->breakpoints[index].addr != addr)
+        return nullptr;
+
+    return &set->breakpoints[index];
+}
+
+static void Breakpoint_destroy(Breakpoint *const bp)
+{
+    for (size_t i = 0; i < bp->conditions_size; ++i)
+        AgentExpr_destroy(&bp->conditions[i]);
+
+    free(bp->conditions);
+
+    bp->conditions = nullptr;
+    bp->conditions_size = 0;
+}
+
+void BreakpointSet_insert(BreakpointSet *const set, const u32 addr)
+{
+    BreakpointSet_insert_conditional(set, addr, nullptr, 0);
+}
+
+void BreakpointSet_insert_conditional(BreakpointSet *const set, const u32 addr,
+                                      AgentExpr *const conditions, const size_t conditions_size)
+{
+    Breakpoint *const existing = find(set, addr);
+
+    if (existing != nullptr) {
+        Breakpoint_destroy(existing);
+        existing->conditions = conditions;
+        existing->conditions_size = conditions_size;
+        return;
+    }
+
+    if (set->size == set->capacity) {
+        const size_t new_capacity = set->capacity == 0 ? 16 : 2 * set->capacity;
+        Breakpoint *const new_breakpoints =
+            realloc(set->breakpoints, new_capacity * sizeof(*new_breakpoints));
+
+        if (new_breakpoints == nullptr)
+            BAIL("Could not reallocate breakpoints");
+
+        set->breakpoints = new_breakpoints;
+        set->capacity = new_capacity;
+    }
+
+    const size_t index = lower_bound(set, addr);
+
+    memmove(&set->breakpoints[index + 1], &set->breakpoints[index],
+            (set->size - index) * sizeof(*set->breakpoints));
+
+    set->breakpoints[index] = (Breakpoint){
+        .addr = addr,
+        .conditions = conditions,
+        .conditions_size = conditions_size,
+    };
+    ++set->size;
+
+    const u32 page = addr / MEMORY_PAGE_SIZE;
+    set->pages[page / 64] |= 1ULL << (page % 64);
+}
+
+bool BreakpointSet_remove(BreakpointSet *const set, const u32 addr)
+{
+    const u32 page = addr / MEMORY_PAGE_SIZE;
+    const size_t index = lower_bound(set, addr);
+
+    if (index == set->size || set->breakpoints[index].addr != addr)
+        return false;
+
+    Breakpoint_destroy(&set->breakpoints[index]);
+    memmove(&set->breakpoints[index], &set->breakpoints[index + 1],
+            (set->size - index - 1) * sizeof(*set->breakpoints));
+    --set->size;
+
+    // Other breakpoints on the same page can only be direct neighbours in the sorted array
+    const bool page_used =
+        (index > 0 && set->breakpoints[index - 1].addr / MEMORY_PAGE_SIZE == page) ||
+        (index < set->size && set->breakpoints[index].addr / MEMORY_PAGE_SIZE == page);
+
+    if (!page_used)
+        set->pages[page / 64] &= ~(1ULL << (page % 64));
+
+    return true;
+}
+
+const Breakpoint *BreakpointSet_find(const BreakpointSet *const set, const u32 addr)
+{
+    return find(set, addr);
+}
+
+bool BreakpointSet_contains(const BreakpointSet *const set, const u32 addr)
+{
+    return find(set, addr) != nullptr;
+}
+
+void BreakpointSet_destroy(BreakpointSet *const set)
+{
+    for (size_t i = 0; i < set->size; ++i)
+        Breakpoint_destroy(&set->breakpoints[i]);
+
+    free(set->pages);
+    free(set->breakpoints);
+
+    set->pages = nullptr;
+    set->breakpoints = nullptr;
+    set->size = 0;
+    set->capacity = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef RV32_EMU_BREAKPOINT_H
+#define RV32_EMU_BREAKPOINT_H
+
+#include "agent_expr.h"
+#include "stdinc.h"
+#include <stddef.h>
+
+/**
+ * \brief A code breakpoint, which only stops the target when one of its conditions holds.
+ */
+typedef struct Breakpoint {
+    u32 addr;
+    AgentExpr *conditions; // Checked in order, the breakpoint is unconditional if there are none
+    size_t conditions_size;
+} Breakpoint;
+
+/**
+ * \brief A set of code breakpoints.
+ *
+ * Pages holding at least one breakpoint are flagged in a bitmap, so checking an address on any
+ * other page takes a single bit test no matter how many breakpoints are set. Breakpoints are kept
+ * sorted by address, so addresses on a flagged page are found with a binary search.
+ */
+typedef struct BreakpointSet {
+    u64 *pages;
+    Breakpoint *breakpoints;
+    size_t size;
+    size_t capacity;
+} BreakpointSet;
+
+[[nodiscard]] BreakpointSet BreakpointSet_new(void);
+
+/**
+ * \brief Adds an unconditional breakpoint, or drops the conditions of an existing one.
+ *
+ * \param set The BreakpointSet to add to.
+ * \param addr Address of the breakpoint.
+ */
+void BreakpointSet_insert(BreakpointSet *set, u32 addr);
+
+/**
+ * \brief Adds a conditional breakpoint, or replaces the conditions of an existing one.
+ *
+ * \param set The BreakpointSet to add to.
+ * \param addr Address of the breakpoint.
+ * \param conditions The conditions of the breakpoint, which the set takes ownership of.
+ * \param conditions_size Number of conditions.
+ */
+void BreakpointSet_insert_conditional(BreakpointSet *set, u32 addr, AgentExpr *conditions,
+                                      size_t conditions_size);
+
+/**
+ * \brief Removes a breakpoint.
+ *
+ * \param set The BreakpointSet to remove from.
+ * \param addr Address of the breakpoint.
+ *
+ * \return true if the breakpoint was set, false otherwise.
+ */
+bool BreakpointSet_remove(BreakpointSet *set, u32 addr);
+
+/**
+ * \brief Returns the breakpoint at addr, or nullptr if there is none.
+ */
+[[nodiscard]] const Breakpoint *BreakpointSet_find(const BreakpointSet *set, u32 addr);
+
+/**
+ * \brief Returns whether there is a breakpoint at addr.
+ */
+[[nodiscard]] bool BreakpointSet_contains(const BreakpointSet *set, u32 addr);
+
+void BreakpointSet_destroy(BreakpointSet *set);
+
+#endif
@@ -0,0 +1,261 @@
+#include "checkpoint.h"
+#include "cpu.h"
+#include "log.h"
+#include "macros.h"
+#include "memory.h"
+#include "numeric.h"
+#include "stdinc.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+static constexpr size_t PAGE_BITMAP_SIZE = MEMORY_PAGE_COUNT / 64;
+
+/**
+ * \brief Copies every page marked in a bitmap into a new checkpoint.
+ */
+[[nodiscard]] static Checkpoint Checkpoint_from_bitmap(const Cpu *const cpu,
+                                                       const SegmentedMemory *const mem,
+                                                       const u64 *const bitmap)
+{
+    size_t pages_size = 0;
+
+    for (size_t i = 0; i < PAGE_BITMAP_SIZE; ++i)
+        pages_size += (size_t)__builtin_popcountll(bitmap[i]);
+
+    Checkpoint checkpoint = {
+        .cpu = *cpu,
+        .heap = mem->heap,
+        .pages = malloc(sz_max(pages_size, 1) * sizeof(*checkpoint.pages)),
+        .page_data = malloc(sz_max(pages_size, 1) * MEMORY_PAGE_SIZE),
+        .pages_size = pages_size,
+    };
+
+    if (checkpoint.pages == nullptr || checkpoint.page_data == nullptr)
+        BAIL("Could not allocate checkpoint");
+
+    size_t n = 0;
+
+    for (size_t i = 0; i < PAGE_BITMAP_SIZE; ++i) {
+        u64 word = bitmap[i];
+
+        while (word != 0) {
+            const u32 page = (u32)((i * 64) + (size_t)__builtin_ctzll(word));
+            word &= word - 1;
+
+            checkpoint.pages[n] = page;
+            memcpy(&checkpoint.page_data[n * MEMORY_PAGE_SIZE],
+                   &mem->data[(size_t)page * MEMORY_PAGE_SIZE], MEMORY_PAGE_SIZE);
+            ++n;
+        }
+    }
+
+    return checkpoint;
+}
+
+/**
+ * \brief Finds the saved data of a page within a checkpoint.
+ *
+ * \return Pointer to the page data, or nullptr if the checkpoint does not hold the page.
+ */
+[[nodiscard]] static const u8 *Checkpoint_find_page(const Checkpoint *const checkpoint,
+                                                    const u32 page)
+{
+    size_t lo = 0;
+    size_t hi = checkpoint->pages_size;
+
+    while (lo < hi) {
+        const size_t mid = lo + ((hi - lo) / 2);
+
+        if (checkpoint->pages[mid] < page)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < checkpoint->pages_size && checkpoint->pages[lo] == page)
+        return &checkpoint->page_data[lo * MEMORY_PAGE_SIZE];
+
+    return nullptr;
+}
+
+static void Checkpoint_destroy(Checkpoint *const checkpoint)
+{
+    free(checkpoint->pages);
+    free(checkpoint->page_data);
+
+    checkpoint->pages = nullptr;
+    checkpoint->page_data = nullptr;
+    checkpoint->pages_size = 0;
+}
+
+CheckpointLog CheckpointLog_new(void)
+{
+    return (CheckpointLog){
+        .checkpoints = nullptr,
+        .checkpoints_size = 0,
+    };
+}
+
+size_t CheckpointLog_take(CheckpointLog *const log, const Cpu *const cpu,
+                          SegmentedMemory *const mem)
+{
+    Checkpoint checkpoint = {};
+
+    if (log->checkpoints_size == 0) {
+        u64 *const bitmap = calloc(PAGE_BITMAP_SIZE, sizeof(*bitmap));
+
+        if (bitmap == nullptr)
+            BAIL("Could not allocate page bitmap");
+
+        for (size_t i = 0; i < PAGE_BITMAP_SIZE; ++i)
+            bitmap[i] = mem->dirty_pages[i] | mem->touched_pages[i];
+
+        for (size_t i = 0; i < mem->segments_size; ++i) {
+            const Segment *const seg = &mem->segments[i];
+
+            if (seg->size == 0 || seg->device != nullptr)
+                continue;
+
+            const size_t first = seg->addr / MEMORY_PAGE_SIZE;
+            const size_t last = ((size_t)seg->addr + seg->size - 1) / MEMORY_PAGE_SIZE;
+
+            for (size_t page = first; page <= last; ++page)
+                bitmap[page / 64] |= 1ULL << (page % 64);
+        }
+
+        checkpoint = Checkpoint_from_bitmap(cpu, mem, bitmap);
+        free(bitmap);
+    } else {
+        checkpoint = Checkpoint_from_bitmap(cpu, mem, mem->dirty_pages);
+    }
+
+    SegmentedMemory_clear_dirty(mem);
+
+    const size_t new_size = log->checkpoints_size + 1;
+    Checkpoint *const new_checkpoints =
+        realloc(log->checkpoints, new_size * sizeof(*new_checkpoints));
+
+    if (new_checkpoints == nullptr)
+        BAIL("Could not reallocate memory for checkpoints");
+
+    log->checkpoints = new_checkpoints;
+    log->checkpoints[log->checkpoints_size] = checkpoint;
+    log->checkpoints_size = new_size;
+
+    ver_printf("checkpoint %zu: %zu pages\n", new_size - 1, checkpoint.pages_size);
+
+    return new_size - 1;
+}
+
+void CheckpointLog_restore(CheckpointLog *const log, const size_t index, Cpu *const cpu,
+                           SegmentedMemory *const mem)
+{
+    if (index >= log->checkpoints_size)
+        BAIL("Invalid checkpoint index (%zu)", index);
+
+    // Every page that may differ from the restored state is either dirty right now or was saved
+    // by a later delta. Gather them all in the dirty bitmap, which gets cleared afterwards anyway.
+    for (size_t i = index + 1; i < log->checkpoints_size; ++i) {
+        const Checkpoint *const checkpoint = &log->checkpoints[i];
+
+        for (size_t j = 0; j < checkpoint->pages_size; ++j) {
+            const u32 page = checkpoint->pages[j];
+            mem->dirty_pages[page / 64] |= 1ULL << (page % 64);
+        }
+    }
+
+    for (size_t i = 0; i < PAGE_BITMAP_SIZE; ++i) {
+        u64 word = mem->dirty_pages[i];
+
+        while (word != 0) {
+            const u32 page = (u32)((i * 64) + (size_t)__builtin_ctzll(word));
+            word &= word - 1;
+
+            const u8 *saved = nullptr;
+
+            for (size_t j = index + 1; j-- > 0 && saved == nullptr;)
+                saved = Checkpoint_find_page(&log->checkpoints[j], page);
+
+            u8 *const dest = &mem->data[(size_t)page * MEMORY_PAGE_SIZE];
+
+            // Pages missing from the base image were still zero-filled back then
+            if (saved != nullptr)
+                memcpy(dest, saved, MEMORY_PAGE_SIZE);
+            else
+                memset(dest, 0, MEMORY_PAGE_SIZE);
+        }
+    }
+
+    SegmentedMemory_clear_dirty(mem);
+    SegmentedMemory_set_heap(mem, log->checkpoints[index].heap);
+    *cpu = log->checkpoints[index].cpu;
+
+    for (size_t i = index + 1; i < log->checkpoints_size; ++i)
+        Checkpoint_destroy(&log->checkpoints[i]);
+
+    log->checkpoints_size = index + 1;
+}
+
+void CheckpointLog_drop_oldest(CheckpointLog *const log)
+{
+    if (log->checkpoints_size < 2)
+        BAIL("Cannot drop the only checkpoint of a log");
+
+    const Checkpoint *const base = &log->checkpoints[0];
+    const Checkpoint *const next = &log->checkpoints[1];
+    const size_t capacity = base->pages_size + next->pages_size;
+
+    Checkpoint merged = {
+        .cpu = next->cpu,
+        .heap = next->heap,
+        .pages = malloc(sz_max(capacity, 1) * sizeof(*merged.pages)),
+        .page_data = malloc(sz_max(capacity, 1) * MEMORY_PAGE_SIZE),
+        .pages_size = 0,
+    };
+
+    if (merged.pages == nullptr || merged.page_data == nullptr)
+        BAIL("Could not allocate checkpoint");
+
+    // Both page lists are sorted, so they merge in one pass, the newer copy winning on a tie
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < base->pages_size || j < next->pages_size) {
+        const bool take_next = j < next->pages_size &&
+                               (i == base->pages_size || next->pages[j] <= base->pages[i]);
+        const Checkpoint *const from = take_next ? next : base;
+        const size_t index = take_next ? j : i;
+
+        if (take_next && i < base->pages_size && base->pages[i] == next->pages[j])
+            ++i;
+
+        if (take_next)
+            ++j;
+        else
+            ++i;
+
+        merged.pages[merged.pages_size] = from->pages[index];
+        memcpy(&merged.page_data[merged.pages_size * MEMORY_PAGE_SIZE],
+               &from->page_data[index * MEMORY_PAGE_SIZE], MEMORY_PAGE_SIZE);
+        ++merged.pages_size;
+    }
+
+    Checkpoint_destroy(&log->checkpoints[0]);
+    Checkpoint_destroy(&log->checkpoints[1]);
+
+    log->checkpoints[1] = merged;
+    memmove(&log->checkpoints[0], &log->checkpoints[1],
+            (log->checkpoints_size - 1) * sizeof(*log->checkpoints));
+    --log->checkpoints_size;
+}
+
+void CheckpointLog_destroy(CheckpointLog *const log)
+{
+    for (size_t i = 0; i < log->checkpoints_size; ++i)
+        Checkpoint_destroy(&log->checkpoints[i]);
+
+    free(log->checkpoints);
+    log->checkpoints = nullptr;
+    log->checkpoints_size = 0;
+}
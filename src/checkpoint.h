@@ -0,0 +1,76 @@
+#ifndef RV32_EMU_CHECKPOINT_H
+#define RV32_EMU_CHECKPOINT_H
+
+#include "cpu.h"
+#include "memory.h"
+#include "stdinc.h"
+#include <stddef.h>
+
+/**
+ * \brief The CPU and heap state plus a set of memory pages at a point in time.
+ *
+ * Page indices are kept in ascending order, and the data for pages[i] lives at
+ * page_data[i * MEMORY_PAGE_SIZE].
+ */
+typedef struct Checkpoint {
+    Cpu cpu;
+    Heap heap;
+    u32 *pages;
+    u8 *page_data;
+    size_t pages_size;
+} Checkpoint;
+
+/**
+ * \brief A base memory image followed by incremental deltas.
+ *
+ * checkpoints[0] holds every page that may be non-zero at the time it was taken, and every
+ * following checkpoint only holds the pages dirtied since the one before it.
+ */
+typedef struct CheckpointLog {
+    Checkpoint *checkpoints;
+    size_t checkpoints_size;
+} CheckpointLog;
+
+[[nodiscard]] CheckpointLog CheckpointLog_new(void);
+
+/**
+ * \brief Takes a new checkpoint and appends it to the log.
+ *
+ * The first checkpoint of a log is a full base image. Every other one only copies the pages
+ * dirtied since the previous checkpoint, so its cost scales with what the guest has written.
+ * Clears the dirty bits of mem.
+ *
+ * \param log The log to append to.
+ * \param cpu The CPU state to save.
+ * \param mem The memory to save.
+ *
+ * \return Index of the new checkpoint within the log.
+ */
+size_t CheckpointLog_take(CheckpointLog *log, const Cpu *cpu, SegmentedMemory *mem);
+
+/**
+ * \brief Restores the machine state saved by a checkpoint.
+ *
+ * Only the pages written since the checkpoint was taken are rewritten, by replaying the base
+ * image and deltas up to it. Every checkpoint after the restored one is discarded.
+ *
+ * \param log The log to restore from.
+ * \param index Index of the checkpoint to restore. Must be less than log->checkpoints_size.
+ * \param cpu Will be set to the saved CPU state.
+ * \param mem The memory to restore.
+ */
+void CheckpointLog_restore(CheckpointLog *log, size_t index, Cpu *cpu, SegmentedMemory *mem);
+
+/**
+ * \brief Folds the second checkpoint into the base image, dropping the oldest point in the log.
+ *
+ * Pages saved by the second checkpoint replace those of the base image, which keeps every other
+ * page, so the cost scales with the size of the base image.
+ *
+ * \param log The log to shorten. Must hold at least two checkpoints.
+ */
+void CheckpointLog_drop_oldest(CheckpointLog *log);
+
+void CheckpointLog_destroy(CheckpointLog *log);
+
+#endif
@@ -0,0 +1,316 @@
+#include "console.h"
+#include "macros.h"
+#include "stdinc.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static constexpr size_t STDIO_BUF_SIZE = 1 << 16;
+static constexpr size_t RING_CAPACITY = 1 << 20;
+static constexpr long FLUSH_INTERVAL_MS = 50;
+
+static ConsoleBuffering console_buffering = ConsoleBuffering_None;
+static bool console_threaded = false;
+static bool console_muted = false;
+static struct sigaction old_sigint_action;
+
+// Flushes stdio output FLUSH_INTERVAL_MS after it was written, when not using the writer thread.
+// The timer is only armed while some output is pending.
+static timer_t flush_timer;
+static bool flush_timer_created = false;
+static atomic_bool flush_timer_armed = false;
+static atomic_int writes_in_progress = 0;
+
+// Single-producer single-consumer ring. The emulator thread only advances ring_head, and the
+// writer thread only advances ring_tail.
+static char *ring = nullptr;
+static atomic_size_t ring_head = 0;
+static atomic_size_t ring_tail = 0;
+static atomic_bool writer_stopping = false;
+static sem_t writer_wakeup;
+static pthread_t writer_thread;
+
+static void flush_timer_expired([[maybe_unused]] const union sigval value)
+{
+    // Disarm first, so output written during the flush arms the timer again
+    atomic_store(&flush_timer_armed, false);
+    fflush(stdout);
+}
+
+static void arm_flush_timer(void)
+{
+    static constexpr struct itimerspec DELAY = {
+        .it_interval = {},
+        .it_value = {.tv_sec = 0, .tv_nsec = FLUSH_INTERVAL_MS * 1'000'000L},
+    };
+
+    if (!atomic_exchange(&flush_timer_armed, true))
+        timer_settime(flush_timer, 0, &DELAY, nullptr);
+}
+
+/**
+ * \brief Flushes pending output before letting SIGINT terminate the emulator.
+ *
+ * stdio is not async-signal-safe, so nothing is flushed if a write was interrupted. The ring only
+ * needs the writer thread, which never handles SIGINT.
+ */
+static void sigint_handler(const int sig_no)
+{
+    if (console_threaded || atomic_load(&writes_in_progress) == 0)
+        console_flush();
+
+    sigaction(SIGINT, &old_sigint_action, nullptr);
+    raise(sig_no);
+}
+
+static void write_stdout(const char *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t written = write(STDOUT_FILENO, data, size);
+
+        if (written < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+
+            return;
+        }
+
+        data += written;
+        size -= (size_t)written;
+    }
+}
+
+static void ring_drain(void)
+{
+    const size_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+
+    while (tail != head) {
+        const size_t start = tail % RING_CAPACITY;
+        const size_t chunk = (head - tail < RING_CAPACITY - start) ? head - tail
+                                                                   : RING_CAPACITY - start;
+
+        write_stdout(&ring[start], chunk);
+        tail += chunk;
+        atomic_store_explicit(&ring_tail, tail, memory_order_release);
+    }
+}
+
+static void *writer_main([[maybe_unused]] void *const arg)
+{
+    while (!atomic_load(&writer_stopping)) {
+        struct timespec deadline = {};
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        deadline.tv_nsec += FLUSH_INTERVAL_MS * 1'000'000L;
+        if (deadline.tv_nsec >= 1'000'000'000L) {
+            deadline.tv_nsec -= 1'000'000'000L;
+            ++deadline.tv_sec;
+        }
+
+        sem_timedwait(&writer_wakeup, &deadline);
+        ring_drain();
+    }
+
+    ring_drain();
+    return nullptr;
+}
+
+static void ring_write(const char *data, size_t size)
+{
+    bool wake = console_buffering == ConsoleBuffering_None ||
+                (console_buffering == ConsoleBuffering_Line && memchr(data, '\n', size) != nullptr);
+
+    size_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+
+    while (size > 0) {
+        const size_t tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+        const size_t free_size = RING_CAPACITY - (head - tail);
+
+        if (free_size == 0) {
+            // Full ring, let the writer catch up
+            if (!wake)
+                sem_post(&writer_wakeup);
+
+            wake = false;
+            sched_yield();
+            continue;
+        }
+
+        const size_t start = head % RING_CAPACITY;
+        size_t chunk = RING_CAPACITY - start;
+
+        if (chunk > free_size)
+            chunk = free_size;
+
+        if (chunk > size)
+            chunk = size;
+
+        memcpy(&ring[start], data, chunk);
+        head += chunk;
+        data += chunk;
+        size -= chunk;
+
+        atomic_store_explicit(&ring_head, head, memory_order_release);
+    }
+
+    if (head - atomic_load_explicit(&ring_tail, memory_order_relaxed) > RING_CAPACITY / 2)
+        wake = true;
+
+    if (wake)
+        sem_post(&writer_wakeup);
+}
+
+static void console_shutdown(void)
+{
+    if (!console_threaded) {
+        if (flush_timer_created) {
+            timer_delete(flush_timer);
+            flush_timer_created = false;
+        }
+
+        fflush(stdout);
+        return;
+    }
+
+    atomic_store(&writer_stopping, true);
+    sem_post(&writer_wakeup);
+    pthread_join(writer_thread, nullptr);
+
+    console_threaded = false;
+    free(ring);
+    ring = nullptr;
+}
+
+bool ConsoleBuffering_parse(const char *const name, ConsoleBuffering *const out)
+{
+    if (strcmp(name, "none") == 0)
+        *out = ConsoleBuffering_None;
+    else if (strcmp(name, "line") == 0)
+        *out = ConsoleBuffering_Line;
+    else if (strcmp(name, "full") == 0)
+        *out = ConsoleBuffering_Full;
+    else
+        return false;
+
+    return true;
+}
+
+ConsoleBuffering ConsoleBuffering_default(void)
+{
+    return isatty(STDIN_FILENO) ? ConsoleBuffering_None : ConsoleBuffering_Full;
+}
+
+void console_init(const ConsoleBuffering buffering, const bool threaded)
+{
+    console_buffering = buffering;
+
+    if (threaded) {
+        ring = malloc(RING_CAPACITY);
+
+        if (ring == nullptr)
+            BAIL("Could not allocate console ring buffer");
+
+        sem_init(&writer_wakeup, 0, 0);
+
+        // The writer inherits this mask, so SIGINT always lands on a thread it can wait for
+        sigset_t sigint_set = {};
+        sigset_t old_set = {};
+        sigemptyset(&sigint_set);
+        sigaddset(&sigint_set, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &sigint_set, &old_set);
+
+        if (pthread_create(&writer_thread, nullptr, writer_main, nullptr) != 0)
+            BAIL("Could not start console writer thread");
+
+        pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+        console_threaded = true;
+    } else if (buffering != ConsoleBuffering_None) {
+        setvbuf(stdout, nullptr, buffering == ConsoleBuffering_Line ? _IOLBF : _IOFBF,
+                STDIO_BUF_SIZE);
+
+        struct sigevent event = {};
+        event.sigev_notify = SIGEV_THREAD;
+        event.sigev_notify_function = flush_timer_expired;
+
+        if (timer_create(CLOCK_MONOTONIC, &event, &flush_timer) != 0)
+            BAIL("Could not create console flush timer");
+
+        flush_timer_created = true;
+    }
+
+    if (threaded || buffering != ConsoleBuffering_None) {
+        const struct sigaction action = {.sa_handler = &sigint_handler};
+        sigaction(SIGINT, &action, &old_sigint_action);
+    }
+
+    atexit(console_shutdown);
+}
+
+void console_write(const char *const data, const size_t size)
+{
+    if (console_muted)
+        return;
+
+    if (console_threaded) {
+        ring_write(data, size);
+        return;
+    }
+
+    atomic_fetch_add(&writes_in_progress, 1);
+    fwrite(data, 1, size, stdout);
+
+    if (console_buffering == ConsoleBuffering_None)
+        fflush(stdout);
+    else
+        arm_flush_timer();
+
+    atomic_fetch_sub(&writes_in_progress, 1);
+}
+
+void console_putc(const char ch)
+{
+    console_write(&ch, 1);
+}
+
+void console_printf(const char *const fmt, ...)
+{
+    char buf[128] = {};
+
+    va_list args;
+    va_start(args, fmt);
+    const int size = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    if (size > 0)
+        console_write(buf, (size_t)size < sizeof(buf) ? (size_t)size : sizeof(buf) - 1);
+}
+
+void console_set_muted(const bool muted)
+{
+    console_muted = muted;
+}
+
+void console_flush(void)
+{
+    if (!console_threaded) {
+        fflush(stdout);
+        return;
+    }
+
+    sem_post(&writer_wakeup);
+
+    while (atomic_load_explicit(&ring_tail, memory_order_acquire) !=
+           atomic_load_explicit(&ring_head, memory_order_relaxed))
+        sched_yield();
+}
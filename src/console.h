@@ -0,0 +1,66 @@
+#ifndef RV32_EMU_CONSOLE_H
+#define RV32_EMU_CONSOLE_H
+
+#include "stdinc.h"
+#include <stddef.h>
+
+typedef enum ConsoleBuffering : u8 {
+    ConsoleBuffering_None,
+    ConsoleBuffering_Line,
+    ConsoleBuffering_Full,
+} ConsoleBuffering;
+
+/**
+ * \brief Parses a buffering policy name ("none", "line" or "full").
+ *
+ * \param name The name to parse.
+ * \param out Will be set to the parsed policy.
+ *
+ * \return true if name is a valid policy, false otherwise.
+ */
+[[nodiscard]] bool ConsoleBuffering_parse(const char *name, ConsoleBuffering *out);
+
+/**
+ * \brief Returns the buffering policy used when none is given explicitly.
+ *
+ * Output is left unbuffered when stdin is a terminal, so that interactive programs behave as if
+ * every print went straight to the screen.
+ */
+[[nodiscard]] ConsoleBuffering ConsoleBuffering_default(void);
+
+/**
+ * \brief Sets up guest console output.
+ *
+ * Buffered output is flushed on exit, on SIGINT, before reading from the console and at most 50 ms
+ * after it was written, even if the guest never prints again. When threaded is set, output goes
+ * through a lock-free ring drained by a background writer thread, so the guest never waits on
+ * write(2). Otherwise a timer does the periodic flush.
+ *
+ * \param buffering The buffering policy to use.
+ * \param threaded Whether to use a background writer thread.
+ */
+void console_init(ConsoleBuffering buffering, bool threaded);
+
+/**
+ * \brief Writes guest output to the console.
+ *
+ * \param data The bytes to write.
+ * \param size Number of bytes to write.
+ */
+void console_write(const char *data, size_t size);
+
+void console_putc(char ch);
+
+void console_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * \brief Drops guest output while muted, e.g. while re-executing code that already printed it.
+ */
+void console_set_muted(bool muted);
+
+/**
+ * \brief Blocks until all pending guest output has been written.
+ */
+void console_flush(void);
+
+#endif
@@ -1,19 +1,48 @@
 #include "cpu.h"
-#include "macros.h"
 #include "memory.h"
+#include "semihost.h"
 #include "stdinc.h"
-#include "unistd.h"
+#include "syscall.h"
 #include <math.h>
 #include <stddef.h>
-#include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
+#include <unistd.h>
 
-Cpu Cpu_new(void)
+HostState HostState_new(void)
+{
+    return (HostState){
+        .fds = {STDIN_FILENO + 1, STDOUT_FILENO + 1, STDERR_FILENO + 1},
+        .handles = {STDIN_FILENO + 1, STDOUT_FILENO + 1, STDERR_FILENO + 1},
+        .last_errno = 0,
+        .clock_started = false,
+        .clock_start_us = 0,
+        .stdin_eof = false,
+    };
+}
+
+void HostState_destroy(HostState *const host)
+{
+    for (size_t i = 0; i < CPU_FD_TABLE_SIZE; ++i) {
+        if (host->fds[i] - 1 > STDERR_FILENO)
+            close(host->fds[i] - 1);
+
+        if (host->handles[i] - 1 > STDERR_FILENO)
+            close(host->handles[i] - 1);
+
+        host->fds[i] = 0;
+        host->handles[i] = 0;
+    }
+}
+
+Cpu Cpu_new(HostState *const host)
 {
     return (Cpu){
         .pc = 0x0,
         .regs = {},
+        .exit_code = 0,
+        .instret = 0,
+        .clock = {},
+        .host = host,
     };
 }
 
@@ -317,123 +346,18 @@ CpuStepResult Cpu_step(Cpu *const cpu, Memory *const mem)
             return CpuStepResult_IllegalInstruction;
 
         if (imm_i == 0) { // ecall
-            const u32 a7 = cpu->regs[17];
-            const u32 a0 = cpu->regs[10];
-            const u32 a1 = cpu->regs[11];
-
-            const float fa0 = cpu->float_regs[10];
-
-            switch (a7) {
-            case Syscall_PrintInteger:
-                printf("%i", (i32)a0);
-                fflush(stdout);
-                break;
-
-            case Syscall_PrintFloat:
-                printf("%f", fa0);
-                fflush(stdout);
-                break;
-
-            case Syscall_PrintString:
-                u32 addr = a0;
-
-                while (true) {
-                    const char ch = (char)Memory_read(mem, addr);
-
-                    if (ch == '\0')
-                        break;
-
-                    fputc(ch, stdout);
-                    ++addr;
-                }
-
-                fflush(stdout);
-                break;
-
-            case Syscall_ReadInteger:
-                int n = 0;
-
-                if (scanf("%d", &n) == 1)
-                    cpu->regs[10] = n;
-
-                break;
-
-            case Syscall_ReadFloat:
-                float f = 0;
-
-                if (scanf("%f", &f) == 1)
-                    cpu->float_regs[10] = f;
+            const CpuStepResult result = handle_ecall(cpu, mem);
 
-                break;
-
-            case Syscall_ReadString: {
-                char *buf = malloc(a1);
-
-                if (fgets(buf, (int)a1, stdin) != nullptr) {
-                    const size_t len = strlen(buf);
-
-                    if (len != 0 && buf[len - 1] == '\n')
-                        buf[len - 1] = '\0';
-
-                    for (size_t i = 0; buf[i] != '\0'; ++i)
-                        Memory_write(mem, a0 + i, buf[i]);
-                }
-
-                free(buf);
-                buf = nullptr;
-                break;
-            }
-
-            case Syscall_Exit:
-                return CpuStepResult_Exit;
-
-            case Syscall_PrintChar:
-                fputc((char)a0, stdout);
-                fflush(stdout);
-                break;
-
-            case Syscall_ReadChar:
-                char ch = '\0';
-
-                if (scanf(" %c", &ch) == 1)
-                    cpu->regs[10] = (u32)ch;
-
-                break;
-
-            case Syscall_Time:
-                struct timeval time = {};
-                gettimeofday(&time, nullptr);
-
-                const u64 ms = (time.tv_sec * 1000ULL) + (time.tv_usec / 1000ULL);
-
-                cpu->regs[10] = ms & 0xFFFF'FFFF;
-                cpu->regs[11] = (ms >> 32) & 0xFFFF'FFFF;
-                break;
-
-            case Syscall_Sleep:
-                usleep(1000ULL * a0);
-                break;
-
-            case Syscall_PrintHex:
-                printf("%08X", a0);
-                fflush(stdout);
-                break;
-
-            case Syscall_PrintBinary:
-                printf("%032B", a0);
-                fflush(stdout);
-                break;
+            if (result != CpuStepResult_None)
+                return result;
+        } else if (imm_i == 1) { // ebreak
+            if (!semihost_is_call(mem, cpu->pc))
+                return CpuStepResult_Break;
 
-            case Syscall_PrintUnsigned:
-                printf("%u", a0);
-                fflush(stdout);
-                break;
+            const CpuStepResult result = handle_semihost(cpu, mem);
 
-            default:
-                BAIL("Illegal ecall number (%u)", a7);
-            }
-        } else if (imm_i == 1) { // ebreak
-            return CpuStepResult_Break;
+            if (result != CpuStepResult_None)
+                return result;
         } else {
             return CpuStepResult_IllegalInstruction;
         }
@@ -444,6 +368,20 @@ CpuStepResult Cpu_step(Cpu *const cpu, Memory *const mem)
 
     cpu->pc = new_pc;
     cpu->regs[0] = 0;
+    ++cpu->instret;
 
     return CpuStepResult_None;
 }
+
+u32 Cpu_read_gdb_register(const Cpu *const cpu, const size_t regno)
+{
+    if (regno < CPU_REGS_SIZE)
+        return cpu->regs[regno];
+
+    if (regno == CPU_GDB_REG_PC)
+        return cpu->pc;
+
+    u32 bits = 0;
+    memcpy(&bits, &cpu->float_regs[regno - CPU_GDB_REG_F0], sizeof(bits));
+    return bits;
+}
@@ -9,11 +9,48 @@
 static constexpr size_t CPU_ADDRESS_SPACE = 0x1'0000'0000;
 static constexpr size_t CPU_REGS_SIZE = 32;
 
+// Register numbers used by GDB: x0-x31, then pc, then f0-f31
+static constexpr size_t CPU_GDB_REG_PC = CPU_REGS_SIZE;
+static constexpr size_t CPU_GDB_REG_F0 = CPU_REGS_SIZE + 1;
+static constexpr size_t CPU_GDB_REGS_SIZE = CPU_GDB_REG_F0 + CPU_REGS_SIZE;
+
+static constexpr size_t CPU_FD_TABLE_SIZE = 64;
+
+/**
+ * \brief Guest clock state used when time is derived from retired instructions.
+ *
+ * Time skipped over by sleeps and detected polling loops accumulates in skipped_us.
+ */
+typedef struct VirtualClock {
+    u64 skipped_us;
+    u64 last_query;
+    u32 poll_streak;
+} VirtualClock;
+
+/**
+ * \brief Host resources behind the syscalls and semihosting calls of one target.
+ *
+ * Descriptor tables hold the host file descriptor plus one for every open guest descriptor, so
+ * that zero means free. The standard streams are shared with the host and never closed.
+ */
+typedef struct HostState {
+    int fds[CPU_FD_TABLE_SIZE];     // Linux ABI file descriptors
+    int handles[CPU_FD_TABLE_SIZE]; // Semihosting handles
+    i32 last_errno;                 // Semihosting errno, as returned by SYS_ERRNO
+    bool clock_started;
+    u64 clock_start_us; // Guest time of the first semihosting clock query
+    bool stdin_eof;     // Reads from stdin see end of file instead of waiting on the host
+} HostState;
+
 typedef struct Cpu {
     u32 pc;
     u32 regs[CPU_REGS_SIZE];
     float float_regs[CPU_REGS_SIZE];
     double double_regs[CPU_REGS_SIZE];
+    i32 exit_code;
+    u64 instret;
+    VirtualClock clock;
+    HostState *host; // Not owned, and shared by copies such as checkpoints
 } Cpu;
 
 typedef enum CpuStepResult : u8 {
@@ -23,27 +60,23 @@ typedef enum CpuStepResult : u8 {
     CpuStepResult_Exit,
 } CpuStepResult;
 
-typedef enum Syscall : u32 {
-    Syscall_PrintInteger = 1,
-    Syscall_PrintFloat = 2,
-    Syscall_PrintString = 4,
-    Syscall_ReadInteger = 5,
-    Syscall_ReadFloat = 6,
-    Syscall_ReadString = 8,
-    Syscall_Sbrk = 9,
-    Syscall_Exit = 10,
-    Syscall_PrintChar = 11,
-    Syscall_ReadChar = 12,
-    Syscall_Exit2 = 17,
-    Syscall_Time = 30,
-    Syscall_Sleep = 32,
-    Syscall_PrintHex = 34,
-    Syscall_PrintBinary = 35,
-    Syscall_PrintUnsigned = 36,
-} Syscall;
-
-[[nodiscard]] Cpu Cpu_new(void);
+[[nodiscard]] HostState HostState_new(void);
+
+/**
+ * \brief Closes every file the guest left open, except the standard streams.
+ */
+void HostState_destroy(HostState *host);
+
+[[nodiscard]] Cpu Cpu_new(HostState *host);
 
 [[nodiscard]] CpuStepResult Cpu_step(Cpu *cpu, Memory *mem);
 
+/**
+ * \brief Returns the value of a register by its GDB number, floats as their bit pattern.
+ *
+ * \param cpu The CPU to read from.
+ * \param regno The register number, less than CPU_GDB_REGS_SIZE.
+ */
+[[nodiscard]] u32 Cpu_read_gdb_register(const Cpu *cpu, size_t regno);
+
 #endif
@@ -9,6 +9,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
 
 const char *ElfResult_display(const ElfResult result)
 {
@@ -42,6 +44,8 @@ const char *ElfResult_display(const ElfResult result)
         return "Virtual address range exceeds target memory bounds.";
     case ElfResult_InvalidMemSize:
         return "p_memsz is smaller than p_filesz";
+    case ElfResult_SectionDataFileOutOfBounds:
+        return "Section data exceeds ELF file size.";
     default:
         BAIL("Invalid ElfResult.");
     }
@@ -106,9 +110,39 @@ ElfResult parse_elf(const u8 *const elf_data, const size_t elf_data_size,
     return ElfResult_Ok;
 }
 
+/**
+ * \brief Maps the pages fully covered by a file range into dest.
+ *
+ * \return Offset of the first byte of [0, size) that was mapped, and sets *mapped_size. Nothing
+ * is mapped if *mapped_size is 0.
+ */
+[[nodiscard]] static size_t map_file_pages(const int fd, const size_t offset, u8 *const dest,
+                                           const size_t size, size_t *const mapped_size)
+{
+    *mapped_size = 0;
+
+    const uintptr_t page_mask = ~(uintptr_t)(MEMORY_PAGE_SIZE - 1);
+    const uintptr_t start = (uintptr_t)dest;
+    const uintptr_t map_start = (start + MEMORY_PAGE_SIZE - 1) & page_mask;
+    const uintptr_t map_end = (start + size) & page_mask;
+
+    if (map_end <= map_start)
+        return 0;
+
+    const size_t head = map_start - start;
+    void *const mapped = mmap((void *)map_start, map_end - map_start, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_FIXED, fd, (off_t)(offset + head));
+
+    if (mapped == MAP_FAILED)
+        return 0;
+
+    *mapped_size = map_end - map_start;
+    return head;
+}
+
 ElfResult Segment_from_phdr(const Elf32_Phdr *const phdr, const size_t phdr_n,
-                            const u8 *const elf_data, const size_t elf_data_size, u8 *const dest,
-                            Segment *const out_seg)
+                            const u8 *const elf_data, const size_t elf_data_size, const int elf_fd,
+                            u8 *const dest, Segment *const out_seg)
 {
     ver_printf("Loading phdr[%zu] into memory.\n", phdr_n);
 
@@ -128,7 +162,7 @@ ElfResult Segment_from_phdr(const Elf32_Phdr *const phdr, const size_t phdr_n,
     if (phdr->p_memsz < phdr->p_filesz)
         return ElfResult_InvalidMemSize;
 
-    if (phdr->p_offset + phdr->p_filesz > elf_data_size)
+    if ((size_t)phdr->p_offset + phdr->p_filesz > elf_data_size)
         return ElfResult_ProgramDataFileOutOfBounds;
 
     if ((size_t)phdr->p_vaddr + phdr->p_memsz > CPU_ADDRESS_SPACE)
@@ -149,13 +183,30 @@ ElfResult Segment_from_phdr(const Elf32_Phdr *const phdr, const size_t phdr_n,
         .addr = phdr->p_vaddr,
         .size = phdr->p_memsz,
         .perms = perms,
+        .device = nullptr,
     };
 
-    memcpy(&dest[phdr->p_vaddr], &elf_data[phdr->p_offset], phdr->p_filesz);
+    u8 *const seg_dest = &dest[phdr->p_vaddr];
+    const u8 *const seg_data = &elf_data[phdr->p_offset];
+    size_t mapped_size = 0;
+    size_t mapped_start = 0;
+
+    if (elf_fd >= 0 && (phdr->p_vaddr % MEMORY_PAGE_SIZE) == (phdr->p_offset % MEMORY_PAGE_SIZE)) {
+        mapped_start =
+            map_file_pages(elf_fd, phdr->p_offset, seg_dest, phdr->p_filesz, &mapped_size);
+    }
+
+    if (mapped_size == 0) {
+        memcpy(seg_dest, seg_data, phdr->p_filesz);
+    } else {
+        const size_t mapped_end = mapped_start + mapped_size;
+
+        memcpy(seg_dest, seg_data, mapped_start);
+        memcpy(&seg_dest[mapped_end], &seg_data[mapped_end], phdr->p_filesz - mapped_end);
 
-    // Zero-out BSS
-    if (phdr->p_memsz > phdr->p_filesz)
-        memset(&dest[phdr->p_vaddr + phdr->p_filesz], 0, phdr->p_memsz - phdr->p_filesz);
+        ver_printf("Mapped %zu bytes of phdr[%zu] from file.\n", mapped_size, phdr_n);
+    }
 
+    // BSS is left to the zero pages of dest
     return ElfResult_Ok;
 }
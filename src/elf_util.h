@@ -22,6 +22,7 @@ typedef enum ElfResult {
     ElfResult_ProgramDataFileOutOfBounds,
     ElfResult_ProgramDataVAddrOutOfBounds,
     ElfResult_InvalidMemSize,
+    ElfResult_SectionDataFileOutOfBounds,
 } ElfResult;
 
 /**
@@ -61,10 +62,17 @@ typedef enum ElfResult {
 /**
  * \brief Loads an ELF header and constructs its Segment data.
  *
+ * When elf_fd is a valid descriptor and p_vaddr and p_offset share the same offset within a
+ * page, every page fully covered by the file data is mapped copy-on-write straight from the file.
+ * Only partial pages at either end are copied.
+ *
+ * dest must be zero-filled, since BSS is not cleared.
+ *
  * \param phdr The program header whose data is to be loaded.
  * \param phdr_n Index of phdr in the phdrs list.
  * \param elf_data Full binary data of the phdr's ELF file.
  * \param elf_data_size Size of elf_data
+ * \param elf_fd File descriptor of the ELF file, or -1 to always copy the data.
  * \param dest Address space where to place the segment's data.
  * \param out_seg The constructed Segment.
  *
@@ -73,6 +81,7 @@ typedef enum ElfResult {
  * \sa Segment, SegmentedMemory
  */
 [[nodiscard]] ElfResult Segment_from_phdr(const Elf32_Phdr *phdr, size_t phdr_n, const u8 *elf_data,
-                                          size_t elf_data_size, u8 *dest, Segment *out_seg);
+                                          size_t elf_data_size, int elf_fd, u8 *dest,
+                                          Segment *out_seg);
 
 #endif
@@ -0,0 +1,288 @@
+#include "framebuffer.h"
+#include "log.h"
+#include "macros.h"
+#include "memory.h"
+#include "stdinc.h"
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static constexpr char FB_SHM_MAGIC[8] = "RV32FB\0";
+static constexpr u32 FB_SHM_VERSION = 1;
+static constexpr u32 FB_REGS_SIZE = 0x18;
+
+typedef struct Framebuffer {
+    Device device;
+    SegmentedMemory *mem;
+    u32 pixels_addr;
+    u32 width;
+    u32 height;
+    u32 stride;
+    FbFormat format;
+    u64 frame;
+    FbShmHeader *shm;
+    const char *dump_prefix;
+    u32 dump_every;
+} Framebuffer;
+
+static Framebuffer fb = {};
+
+bool FbFormat_parse(const char *const name, FbFormat *const out)
+{
+    if (strcmp(name, "xrgb8888") == 0)
+        *out = FbFormat_Xrgb8888;
+    else if (strcmp(name, "rgb565") == 0)
+        *out = FbFormat_Rgb565;
+    else if (strcmp(name, "gray8") == 0)
+        *out = FbFormat_Gray8;
+    else
+        return false;
+
+    return true;
+}
+
+[[nodiscard]] static u32 bytes_per_pixel(const FbFormat format)
+{
+    switch (format) {
+    case FbFormat_Xrgb8888:
+        return 4;
+
+    case FbFormat_Rgb565:
+        return 2;
+
+    case FbFormat_Gray8:
+    default:
+        return 1;
+    }
+}
+
+/**
+ * \brief Converts a row of pixels to 8-bit RGB.
+ */
+static void row_to_rgb(const u8 *const src, u8 *dest, const u32 width, const FbFormat format)
+{
+    for (u32 x = 0; x < width; ++x) {
+        switch (format) {
+        case FbFormat_Xrgb8888:
+            *dest++ = src[(4 * x) + 2];
+            *dest++ = src[(4 * x) + 1];
+            *dest++ = src[4 * x];
+            break;
+
+        case FbFormat_Rgb565: {
+            const u16 pixel = (u16)(src[2 * x] | (src[(2 * x) + 1] << 8));
+            *dest++ = (u8)(((pixel >> 11) & 0x1F) * 255 / 31);
+            *dest++ = (u8)(((pixel >> 5) & 0x3F) * 255 / 63);
+            *dest++ = (u8)((pixel & 0x1F) * 255 / 31);
+            break;
+        }
+
+        case FbFormat_Gray8:
+        default:
+            *dest++ = src[x];
+            *dest++ = src[x];
+            *dest++ = src[x];
+        }
+    }
+}
+
+static void dump_frame(const Framebuffer *const self)
+{
+    char filename[4096] = {};
+    snprintf(filename, sizeof(filename), "%s%06" PRIu64 ".ppm", self->dump_prefix, self->frame);
+
+    FILE *const file = fopen(filename, "wb");
+
+    if (file == nullptr) {
+        perror("Could not write frame dump");
+        return;
+    }
+
+    u8 *const row = malloc((size_t)self->width * 3);
+
+    if (row == nullptr)
+        BAIL("Could not allocate frame dump row");
+
+    fprintf(file, "P6\n%u %u\n255\n", self->width, self->height);
+
+    for (u32 y = 0; y < self->height; ++y) {
+        const u8 *const src = &self->mem->data[self->pixels_addr + (y * self->stride)];
+
+        row_to_rgb(src, row, self->width, self->format);
+        fwrite(row, 3, self->width, file);
+    }
+
+    free(row);
+    fclose(file);
+}
+
+static void present(Framebuffer *const self)
+{
+    ++self->frame;
+
+    if (self->shm != nullptr)
+        atomic_store_explicit((_Atomic u64 *)&self->shm->frame, self->frame, memory_order_release);
+
+    if (self->dump_prefix != nullptr && self->frame % self->dump_every == 0)
+        dump_frame(self);
+}
+
+[[nodiscard]] static u8 Framebuffer_read(Device *const dev, const u32 offset)
+{
+    const Framebuffer *const self = CONTAINER_OF(dev, Framebuffer, device);
+    u32 value = 0;
+
+    switch ((FbReg)(offset & ~3U)) {
+    case FbReg_Width:
+        value = self->width;
+        break;
+
+    case FbReg_Height:
+        value = self->height;
+        break;
+
+    case FbReg_Stride:
+        value = self->stride;
+        break;
+
+    case FbReg_Format:
+        value = self->format;
+        break;
+
+    case FbReg_Frame:
+        value = (u32)self->frame;
+        break;
+
+    case FbReg_Vsync:
+    default:
+    }
+
+    return (u8)(value >> (8 * (offset % 4)));
+}
+
+static void Framebuffer_write(Device *const dev, const u32 offset, [[maybe_unused]] const u8 value)
+{
+    Framebuffer *const self = CONTAINER_OF(dev, Framebuffer, device);
+
+    // Word writes reach the device one byte at a time, only the first one counts
+    if (offset == FbReg_Vsync)
+        present(self);
+}
+
+/**
+ * \brief Creates the shared-memory file and maps the pixels from it.
+ */
+[[nodiscard]] static bool map_shm(Framebuffer *const self, const char *const path,
+                                  const u32 pixels_size)
+{
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+        return false;
+
+    const size_t file_size = MEMORY_PAGE_SIZE + (size_t)pixels_size;
+
+    if (ftruncate(fd, (off_t)file_size) != 0) {
+        close(fd);
+        return false;
+    }
+
+    void *const header = mmap(nullptr, MEMORY_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (header == MAP_FAILED ||
+        !SegmentedMemory_map_shared(self->mem, self->pixels_addr, pixels_size, fd,
+                                    MEMORY_PAGE_SIZE)) {
+        close(fd);
+        return false;
+    }
+
+    // The mappings keep the file alive
+    close(fd);
+
+    self->shm = header;
+    *self->shm = (FbShmHeader){
+        .magic = {},
+        .version = FB_SHM_VERSION,
+        .width = self->width,
+        .height = self->height,
+        .stride = self->stride,
+        .format = self->format,
+        .reserved = 0,
+        .frame = 0,
+    };
+
+    memcpy(self->shm->magic, FB_SHM_MAGIC, sizeof(FB_SHM_MAGIC));
+    return true;
+}
+
+bool framebuffer_attach(SegmentedMemory *const mem, const FbConfig *const config)
+{
+    const u32 stride = config->width * bytes_per_pixel(config->format);
+    const u32 pixels_addr = config->base + MEMORY_PAGE_SIZE;
+    const u32 pixels_size =
+        (stride * config->height + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE * MEMORY_PAGE_SIZE;
+
+    if (config->base % MEMORY_PAGE_SIZE != 0 ||
+        !SegmentedMemory_range_is_free(mem, config->base, MEMORY_PAGE_SIZE))
+        return false;
+
+    // A restored snapshot already holds the pixels, which are then kept
+    bool restored = false;
+
+    for (size_t i = 0; i < mem->segments_size; ++i) {
+        const Segment *const seg = &mem->segments[i];
+
+        if (seg->addr == pixels_addr && seg->size == pixels_size && seg->device == nullptr)
+            restored = true;
+    }
+
+    if (!restored && !SegmentedMemory_range_is_free(mem, pixels_addr, pixels_size))
+        return false;
+
+    fb = (Framebuffer){
+        .device =
+            {
+                .read = Framebuffer_read,
+                .write = Framebuffer_write,
+            },
+        .mem = mem,
+        .pixels_addr = pixels_addr,
+        .width = config->width,
+        .height = config->height,
+        .stride = stride,
+        .format = config->format,
+        .frame = 0,
+        .shm = nullptr,
+        .dump_prefix = config->dump_prefix,
+        .dump_every = config->dump_every == 0 ? 1 : config->dump_every,
+    };
+
+    if (config->shm_path != nullptr && !map_shm(&fb, config->shm_path, pixels_size))
+        return false;
+
+    SegmentedMemory_add_segment(mem, (Segment){
+                                         .addr = config->base,
+                                         .size = FB_REGS_SIZE,
+                                         .perms = SegPerms_Read | SegPerms_Write,
+                                         .device = &fb.device,
+                                     });
+
+    if (!restored) {
+        SegmentedMemory_add_segment(mem, (Segment){
+                                             .addr = pixels_addr,
+                                             .size = pixels_size,
+                                             .perms = SegPerms_Read | SegPerms_Write |
+                                                      SegPerms_Device,
+                                             .device = nullptr,
+                                         });
+    }
+
+    ver_printf("framebuffer: %ux%u at 0x%08X\n", config->width, config->height, pixels_addr);
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef RV32_EMU_FRAMEBUFFER_H
+#define RV32_EMU_FRAMEBUFFER_H
+
+#include "memory.h"
+#include "stdinc.h"
+
+typedef enum FbFormat : u8 {
+    FbFormat_Xrgb8888,
+    FbFormat_Rgb565,
+    FbFormat_Gray8,
+} FbFormat;
+
+/**
+ * \brief Parses a pixel format name ("xrgb8888", "rgb565" or "gray8").
+ *
+ * \param name The name to parse.
+ * \param out Will be set to the parsed format.
+ *
+ * \return true if name is a valid format, false otherwise.
+ */
+[[nodiscard]] bool FbFormat_parse(const char *name, FbFormat *out);
+
+/**
+ * \brief Offsets of the framebuffer control registers, all of them 32 bits wide.
+ *
+ * Pixels start one page after the control registers, rows are stride bytes apart.
+ */
+typedef enum FbReg : u8 {
+    FbReg_Width = 0x00,
+    FbReg_Height = 0x04,
+    FbReg_Stride = 0x08,
+    FbReg_Format = 0x0C,
+    FbReg_Frame = 0x10, // Number of frames presented so far
+    FbReg_Vsync = 0x14, // Any write presents the current frame
+} FbReg;
+
+static constexpr u32 FB_DEFAULT_BASE = 0x4000'0000;
+static constexpr u32 FB_MAX_SIZE = 4096;
+
+/**
+ * \brief Header at the start of the shared-memory file, followed by the pixels one page later.
+ *
+ * Viewers map the file and wait for frame to change. It is only ever increased, with release
+ * semantics, after the guest has finished drawing the frame.
+ */
+typedef struct FbShmHeader {
+    char magic[8];
+    u32 version;
+    u32 width;
+    u32 height;
+    u32 stride;
+    u32 format;
+    u32 reserved;
+    u64 frame;
+} FbShmHeader;
+
+typedef struct FbConfig {
+    u32 base;
+    u32 width;
+    u32 height;
+    FbFormat format;
+    const char *shm_path;
+    const char *dump_prefix;
+    u32 dump_every;
+} FbConfig;
+
+/**
+ * \brief Maps a framebuffer and its control registers.
+ *
+ * Pixels are plain guest memory, so drawing runs at full speed. When a shared-memory file is
+ * given, the pixels are mapped straight from it and host viewers see them without any copies.
+ * When a dump prefix is given, every dump_every-th presented frame is also written to
+ * <prefix><frame>.ppm.
+ *
+ * \param mem The memory to map the framebuffer into.
+ * \param config The framebuffer geometry and outputs.
+ *
+ * \return true on success, false if the framebuffer would overlap an existing segment or the heap,
+ * or if the shared-memory file could not be set up.
+ */
+[[nodiscard]] bool framebuffer_attach(SegmentedMemory *mem, const FbConfig *config);
+
+#endif
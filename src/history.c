@@ -0,0 +1,102 @@
+#include "history.h"
+#include "checkpoint.h"
+#include "console.h"
+#include "cpu.h"
+#include "log.h"
+#include "macros.h"
+#include "memory.h"
+#include "replay.h"
+#include "stdinc.h"
+#include <stddef.h>
+
+static void update_due(History *const history)
+{
+    history->due = history->next_checkpoint;
+
+    if (history->reexecuting && history->frontier < history->due)
+        history->due = history->frontier;
+}
+
+History History_new(const u64 interval, const size_t limit, const Cpu *const cpu,
+                    SegmentedMemory *const mem)
+{
+    History history = {
+        .log = CheckpointLog_new(),
+        .interval = interval,
+        .limit = limit,
+        .next_checkpoint = cpu->instret + interval,
+        .frontier = cpu->instret,
+        .reexecuting = false,
+        .due = 0,
+    };
+
+    (void)CheckpointLog_take(&history.log, cpu, mem);
+    update_due(&history);
+
+    return history;
+}
+
+void History_update(History *const history, const Cpu *const cpu, SegmentedMemory *const mem)
+{
+    if (history->reexecuting && cpu->instret >= history->frontier) {
+        history->reexecuting = false;
+        console_set_muted(false);
+    }
+
+    if (cpu->instret >= history->next_checkpoint) {
+        (void)CheckpointLog_take(&history->log, cpu, mem);
+        history->next_checkpoint = cpu->instret + history->interval;
+
+        if (history->log.checkpoints_size > history->limit)
+            CheckpointLog_drop_oldest(&history->log);
+    }
+
+    update_due(history);
+}
+
+u64 History_start(const History *const history)
+{
+    return history->log.checkpoints[0].cpu.instret;
+}
+
+void History_seek(History *const history, const u64 instret, Cpu *const cpu,
+                  SegmentedMemory *const mem)
+{
+    if (instret < History_start(history))
+        BAIL("Cannot go back before the start of history (%llu)", (unsigned long long)instret);
+
+    if (!history->reexecuting)
+        history->frontier = cpu->instret;
+
+    size_t index = history->log.checkpoints_size - 1;
+
+    while (history->log.checkpoints[index].cpu.instret > instret)
+        --index;
+
+    // Later checkpoints are discarded, and taken again while re-executing
+    CheckpointLog_restore(&history->log, index, cpu, mem);
+    replay_rewind(cpu->instret);
+
+    history->next_checkpoint = cpu->instret + history->interval;
+    history->reexecuting = cpu->instret < history->frontier;
+    console_set_muted(history->reexecuting);
+    update_due(history);
+
+    ver_printf("history: back to %llu from checkpoint %zu\n", (unsigned long long)instret, index);
+}
+
+void History_forget_future(History *const history, const Cpu *const cpu)
+{
+    if (!history->reexecuting)
+        return;
+
+    history->frontier = cpu->instret;
+    history->reexecuting = false;
+    console_set_muted(false);
+    update_due(history);
+}
+
+void History_destroy(History *const history)
+{
+    CheckpointLog_destroy(&history->log);
+}
@@ -0,0 +1,81 @@
+#ifndef RV32_EMU_HISTORY_H
+#define RV32_EMU_HISTORY_H
+
+#include "checkpoint.h"
+#include "cpu.h"
+#include "memory.h"
+#include "stdinc.h"
+
+static constexpr u64 HISTORY_DEFAULT_INTERVAL = 1'000'000;
+static constexpr size_t HISTORY_DEFAULT_LIMIT = 1024;
+
+/**
+ * \brief Checkpoints taken as the target runs, to go back to any earlier instruction.
+ *
+ * Going back restores the nearest checkpoint at or before the target instruction, from which the
+ * caller re-executes. Inputs are replayed from the in-memory replay history, and console output
+ * stays muted until the target catches up with the furthest instruction it had executed. Once the
+ * number of checkpoints reaches a limit, the oldest one is merged into the next, so history only
+ * reaches back so far.
+ */
+typedef struct History {
+    CheckpointLog log;
+    u64 interval;        // Instructions between checkpoints
+    size_t limit;        // Most checkpoints kept
+    u64 next_checkpoint; // Instructions retired when the next checkpoint is due
+    u64 frontier;        // Furthest point executed so far, only meaningful while re-executing
+    bool reexecuting;
+    u64 due; // Instructions retired when History_update() has something to do
+} History;
+
+/**
+ * \brief Starts recording history, with a first checkpoint of the current state.
+ *
+ * Expects the replay history to have been started already.
+ *
+ * \param interval Instructions between checkpoints. Bounds both the time spent taking checkpoints
+ * while running forward and the time spent re-executing when going back.
+ * \param limit Most checkpoints kept, at least 2. Bounds the memory used by history.
+ * \param cpu The CPU state to start from.
+ * \param mem The memory to start from.
+ */
+[[nodiscard]] History History_new(u64 interval, size_t limit, const Cpu *cpu,
+                                  SegmentedMemory *mem);
+
+/**
+ * \brief Takes a checkpoint or notices the end of re-execution when due.
+ *
+ * Meant to be called after every instruction, once cpu->instret reaches history->due.
+ */
+void History_update(History *history, const Cpu *cpu, SegmentedMemory *mem);
+
+/**
+ * \brief Returns the number of instructions retired at the earliest point that can be gone back
+ * to.
+ */
+[[nodiscard]] u64 History_start(const History *history);
+
+/**
+ * \brief Goes back to the latest checkpoint at or before an earlier point.
+ *
+ * The caller is expected to run forward from there up to instret.
+ *
+ * \param history The history to go back in.
+ * \param instret Number of instructions retired at the point to go back to. Must not be less
+ * than History_start().
+ * \param cpu Will be set to the restored CPU state.
+ * \param mem The memory to restore.
+ */
+void History_seek(History *history, u64 instret, Cpu *cpu, SegmentedMemory *mem);
+
+/**
+ * \brief Makes the current point the furthest one executed.
+ *
+ * Called when the target state is changed from outside while re-executing, after which running
+ * forward no longer repeats what happened before.
+ */
+void History_forget_future(History *history, const Cpu *cpu);
+
+void History_destroy(History *history);
+
+#endif
@@ -0,0 +1,622 @@
+#include "hle.h"
+#include "cpu.h"
+#include "log.h"
+#include "macros.h"
+#include "memory.h"
+#include "numeric.h"
+#include "stdinc.h"
+#include "symbols.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static constexpr u32 MIN_SIZE_CLASS = 4;
+static constexpr u32 MAX_SIZE_CLASS = 30;
+static constexpr u32 BLOCK_ALIGN = 1 << MIN_SIZE_CLASS;
+
+static const char *const function_names[HleFunction_Count] = {
+    [HleFunction_Memcpy] = "memcpy",
+    [HleFunction_Memset] = "memset",
+    [HleFunction_Strlen] = "strlen",
+    [HleFunction_Strcmp] = "strcmp",
+    [HleFunction_Malloc] = "malloc",
+    [HleFunction_Free] = "free",
+    [HleFunction_Calloc] = "calloc",
+    [HleFunction_Realloc] = "realloc",
+};
+
+[[nodiscard]] static u64 mask_bit(const u32 addr)
+{
+    return 1ULL << ((addr / 4) % 64);
+}
+
+[[nodiscard]] static bool is_allocator(const HleFunction function)
+{
+    return function >= HleFunction_Malloc;
+}
+
+static void update_entry_mask(Hle *const hle)
+{
+    hle->entry_mask = 0;
+
+    for (size_t i = 0; i < HleFunction_Count; ++i) {
+        if (hle->present[i])
+            hle->entry_mask |= mask_bit(hle->entries[i]);
+    }
+
+    if (hle->checking)
+        hle->entry_mask |= mask_bit(hle->check.ra);
+}
+
+/**
+ * \brief Finds the length of a guest string a page at a time.
+ *
+ * \return false if the string runs into memory that cannot be read.
+ */
+[[nodiscard]] static bool guest_strlen(const Memory *const mem, const u32 addr, u32 *const out)
+{
+    u64 len = 0;
+
+    while (len < CPU_ADDRESS_SPACE) {
+        const u32 pos = (u32)(addr + len);
+        const u32 chunk_size = MEMORY_PAGE_SIZE - (pos % MEMORY_PAGE_SIZE);
+        const u8 *chunk = nullptr;
+
+        if (Memory_read_span(mem, pos, chunk_size, &chunk) != MemoryResult_Ok)
+            return false;
+
+        const u8 *const end = memchr(chunk, '\0', chunk_size);
+
+        if (end != nullptr) {
+            *out = (u32)(len + (u64)(end - chunk));
+            return true;
+        }
+
+        len += chunk_size;
+    }
+
+    return false;
+}
+
+/**
+ * \brief Compares two guest strings a page at a time.
+ *
+ * \return false if either string runs into memory that cannot be read.
+ */
+[[nodiscard]] static bool guest_strcmp(const Memory *const mem, u32 a, u32 b, i32 *const out)
+{
+    while (true) {
+        const u32 a_left = MEMORY_PAGE_SIZE - (a % MEMORY_PAGE_SIZE);
+        const u32 b_left = MEMORY_PAGE_SIZE - (b % MEMORY_PAGE_SIZE);
+        const u32 chunk_size = a_left < b_left ? a_left : b_left;
+
+        const u8 *a_chunk = nullptr;
+        const u8 *b_chunk = nullptr;
+
+        if (Memory_read_span(mem, a, chunk_size, &a_chunk) != MemoryResult_Ok ||
+            Memory_read_span(mem, b, chunk_size, &b_chunk) != MemoryResult_Ok)
+            return false;
+
+        for (u32 i = 0; i < chunk_size; ++i) {
+            if (a_chunk[i] != b_chunk[i] || a_chunk[i] == '\0') {
+                *out = (i32)a_chunk[i] - (i32)b_chunk[i];
+                return true;
+            }
+        }
+
+        a += chunk_size;
+        b += chunk_size;
+    }
+}
+
+[[nodiscard]] static size_t block_slot(const HleAllocator *const alloc, const u32 addr)
+{
+    return ((addr / BLOCK_ALIGN) * 2'654'435'761U) & (alloc->blocks_capacity - 1);
+}
+
+size_t HleAllocator_find_block(const HleAllocator *const alloc, const u32 addr)
+{
+    if (alloc->blocks_capacity == 0 || addr == 0)
+        return alloc->blocks_capacity;
+
+    for (size_t i = block_slot(alloc, addr);; i = (i + 1) & (alloc->blocks_capacity - 1)) {
+        if (alloc->block_addrs[i] == addr)
+            return i;
+
+        if (alloc->block_addrs[i] == 0)
+            return alloc->blocks_capacity;
+    }
+}
+
+void HleAllocator_insert_block(HleAllocator *const alloc, const u32 addr, const u8 size_class)
+{
+    if (2 * (alloc->blocks_size + 1) > alloc->blocks_capacity) {
+        const size_t old_capacity = alloc->blocks_capacity;
+        u32 *const old_addrs = alloc->block_addrs;
+        u8 *const old_classes = alloc->block_classes;
+
+        alloc->blocks_capacity = old_capacity == 0 ? 256 : 2 * old_capacity;
+        alloc->block_addrs = calloc(alloc->blocks_capacity, sizeof(*alloc->block_addrs));
+        alloc->block_classes = calloc(alloc->blocks_capacity, sizeof(*alloc->block_classes));
+        alloc->blocks_size = 0;
+
+        if (alloc->block_addrs == nullptr || alloc->block_classes == nullptr)
+            BAIL("Could not allocate block table");
+
+        for (size_t i = 0; i < old_capacity; ++i) {
+            if (old_addrs[i] != 0)
+                HleAllocator_insert_block(alloc, old_addrs[i], old_classes[i]);
+        }
+
+        free(old_addrs);
+        free(old_classes);
+    }
+
+    size_t i = block_slot(alloc, addr);
+
+    while (alloc->block_addrs[i] != 0)
+        i = (i + 1) & (alloc->blocks_capacity - 1);
+
+    alloc->block_addrs[i] = addr;
+    alloc->block_classes[i] = size_class;
+    ++alloc->blocks_size;
+}
+
+void HleAllocator_remove_block(HleAllocator *const alloc, size_t slot)
+{
+    const size_t mask = alloc->blocks_capacity - 1;
+
+    // Backward-shift deletion keeps every probe sequence free of holes
+    for (size_t next = (slot + 1) & mask; alloc->block_addrs[next] != 0;
+         next = (next + 1) & mask) {
+        const size_t home = block_slot(alloc, alloc->block_addrs[next]);
+
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            alloc->block_addrs[slot] = alloc->block_addrs[next];
+            alloc->block_classes[slot] = alloc->block_classes[next];
+            slot = next;
+        }
+    }
+
+    alloc->block_addrs[slot] = 0;
+    --alloc->blocks_size;
+}
+
+[[nodiscard]] static u32 size_class_of(const u32 size)
+{
+    u32 size_class = MIN_SIZE_CLASS;
+
+    while (size_class <= MAX_SIZE_CLASS && (1U << size_class) < size)
+        ++size_class;
+
+    return size_class;
+}
+
+/**
+ * \brief Hands out a guest block of at least size bytes.
+ *
+ * Blocks are size-aligned, so that they never straddle the end of the arena.
+ *
+ * \return The guest address of the block, or 0 if the arena is exhausted.
+ */
+[[nodiscard]] static u32 hle_malloc(HleAllocator *const alloc, const u32 size)
+{
+    const u32 size_class = size_class_of(size);
+
+    if (size_class > MAX_SIZE_CLASS)
+        return 0;
+
+    u32 addr = 0;
+
+    if (alloc->free_lists_size[size_class] != 0) {
+        addr = alloc->free_lists[size_class][--alloc->free_lists_size[size_class]];
+    } else {
+        const u64 start = ((u64)alloc->arena_top + BLOCK_ALIGN - 1) / BLOCK_ALIGN * BLOCK_ALIGN;
+
+        if (start + (1ULL << size_class) > alloc->arena_end)
+            return 0;
+
+        addr = (u32)start;
+        alloc->arena_top = (u32)(start + (1ULL << size_class));
+    }
+
+    HleAllocator_insert_block(alloc, addr, (u8)size_class);
+    return addr;
+}
+
+static void hle_free(HleAllocator *const alloc, const size_t slot)
+{
+    const u32 addr = alloc->block_addrs[slot];
+    const u8 size_class = alloc->block_classes[slot];
+
+    HleAllocator_remove_block(alloc, slot);
+
+    if (alloc->free_lists_size[size_class] == alloc->free_lists_capacity[size_class]) {
+        const size_t capacity = alloc->free_lists_capacity[size_class];
+        const size_t new_capacity = capacity == 0 ? 16 : 2 * capacity;
+        u32 *const new_list =
+            realloc(alloc->free_lists[size_class], new_capacity * sizeof(*new_list));
+
+        if (new_list == nullptr)
+            BAIL("Could not reallocate free list");
+
+        alloc->free_lists[size_class] = new_list;
+        alloc->free_lists_capacity[size_class] = new_capacity;
+    }
+
+    alloc->free_lists[size_class][alloc->free_lists_size[size_class]++] = addr;
+}
+
+/**
+ * \brief Copies between guest ranges with memmove semantics.
+ *
+ * \return false if either range cannot be fully accessed.
+ */
+[[nodiscard]] static bool guest_memmove(Memory *const mem, const u32 dest, const u32 src,
+                                        const u32 size)
+{
+    const u8 *src_data = nullptr;
+    u8 *dest_data = nullptr;
+
+    if (Memory_read_span(mem, src, size, &src_data) != MemoryResult_Ok ||
+        Memory_write_span(mem, dest, size, &dest_data) != MemoryResult_Ok)
+        return false;
+
+    memmove(dest_data, src_data, size);
+    return true;
+}
+
+[[nodiscard]] static bool guest_memset(Memory *const mem, const u32 dest, const u8 value,
+                                       const u32 size)
+{
+    u8 *data = nullptr;
+
+    if (Memory_write_span(mem, dest, size, &data) != MemoryResult_Ok)
+        return false;
+
+    memset(data, value, size);
+    return true;
+}
+
+[[nodiscard]] static bool hle_realloc(HleAllocator *const alloc, Memory *const mem, const u32 addr,
+                                      const u32 size, u32 *const out)
+{
+    if (addr == 0) {
+        *out = hle_malloc(alloc, size);
+        return true;
+    }
+
+    const size_t slot = HleAllocator_find_block(alloc, addr);
+
+    // Blocks from the guest's own allocator are left to its realloc
+    if (slot == alloc->blocks_capacity)
+        return false;
+
+    const u32 old_size = 1U << alloc->block_classes[slot];
+
+    if (size == 0) {
+        hle_free(alloc, slot);
+        *out = 0;
+        return true;
+    }
+
+    if (size <= old_size && size_class_of(size) == alloc->block_classes[slot]) {
+        *out = addr;
+        return true;
+    }
+
+    const u32 new_addr = hle_malloc(alloc, size);
+
+    if (new_addr != 0) {
+        if (!guest_memmove(mem, new_addr, addr, old_size < size ? old_size : size))
+            BAIL("Could not move reallocated block (0x%08X)", addr);
+
+        hle_free(alloc, HleAllocator_find_block(alloc, addr));
+    }
+
+    *out = new_addr;
+    return true;
+}
+
+/**
+ * \brief Runs the host implementation of a routine.
+ *
+ * \return false if the call has to be left to the emulated routine.
+ */
+[[nodiscard]] static bool run_function(Hle *const hle, const HleFunction function,
+                                       const Cpu *const cpu, Memory *const mem, u32 *const out)
+{
+    const u32 a0 = cpu->regs[10];
+    const u32 a1 = cpu->regs[11];
+    const u32 a2 = cpu->regs[12];
+
+    HleAllocator *const alloc = &hle->allocator;
+
+    switch (function) {
+    case HleFunction_Memcpy:
+        *out = a0;
+        return guest_memmove(mem, a0, a1, a2);
+
+    case HleFunction_Memset:
+        *out = a0;
+        return guest_memset(mem, a0, (u8)a1, a2);
+
+    case HleFunction_Strlen:
+        return guest_strlen(mem, a0, out);
+
+    case HleFunction_Strcmp:
+        return guest_strcmp(mem, a0, a1, (i32 *)out);
+
+    case HleFunction_Malloc:
+        *out = hle_malloc(alloc, a0);
+        return true;
+
+    case HleFunction_Free:
+        const size_t slot = HleAllocator_find_block(alloc, a0);
+
+        if (a0 != 0 && slot == alloc->blocks_capacity)
+            return false;
+
+        if (a0 != 0)
+            hle_free(alloc, slot);
+
+        *out = 0;
+        return true;
+
+    case HleFunction_Calloc:
+        const u64 size = (u64)a0 * a1;
+
+        *out = size <= UINT32_MAX ? hle_malloc(alloc, (u32)size) : 0;
+
+        if (*out != 0 && !guest_memset(mem, *out, 0, (u32)size))
+            BAIL("Could not clear allocated block (0x%08X)", *out);
+
+        return true;
+
+    case HleFunction_Realloc:
+        return hle_realloc(alloc, mem, a0, a1, out);
+
+    case HleFunction_Count:
+    default:
+        return false;
+    }
+}
+
+/**
+ * \brief Computes the expected outcome of a pure routine, to be checked once it returns.
+ */
+static void start_check(Hle *const hle, const HleFunction function, const Cpu *const cpu,
+                        Memory *const mem)
+{
+    const u32 a0 = cpu->regs[10];
+    const u32 a1 = cpu->regs[11];
+    const u32 a2 = cpu->regs[12];
+
+    HlePendingCheck check = {
+        .function = function,
+        .ra = cpu->regs[1],
+        .sp = cpu->regs[2],
+        .result = a0,
+        .dest = a0,
+        .expected = nullptr,
+        .expected_size = 0,
+    };
+
+    bool ok = false;
+
+    if (function == HleFunction_Memcpy || function == HleFunction_Memset) {
+        const u8 *src = nullptr;
+        u8 *dest = nullptr;
+
+        // Only allocate once the guest-sized ranges are known to be mapped. The routine is about
+        // to write the destination anyway, so marking it dirty here changes nothing.
+        ok = Memory_write_span(mem, a0, a2, &dest) == MemoryResult_Ok &&
+             (function == HleFunction_Memset ||
+              Memory_read_span(mem, a1, a2, &src) == MemoryResult_Ok);
+
+        if (ok) {
+            check.expected = malloc((size_t)a2 + 1);
+            check.expected_size = a2;
+
+            if (check.expected == nullptr)
+                BAIL("Could not allocate HLE check");
+
+            if (function == HleFunction_Memset)
+                memset(check.expected, (u8)a1, a2);
+            else
+                memcpy(check.expected, src, a2);
+        }
+    } else if (function == HleFunction_Strlen) {
+        ok = guest_strlen(mem, a0, &check.result);
+    } else if (function == HleFunction_Strcmp) {
+        i32 result = 0;
+        ok = guest_strcmp(mem, a0, a1, &result);
+        check.result = (u32)((result > 0) - (result < 0));
+    }
+
+    // Nothing to compare against if the emulated routine is about to fault anyway
+    if (!ok) {
+        free(check.expected);
+        return;
+    }
+
+    ++hle->hits[function];
+    hle->check = check;
+    hle->checking = true;
+    update_entry_mask(hle);
+}
+
+static void finish_check(Hle *const hle, const Cpu *const cpu, const Memory *const mem)
+{
+    HlePendingCheck *const check = &hle->check;
+    u32 result = cpu->regs[10];
+
+    if (check->function == HleFunction_Strcmp)
+        result = (u32)(((i32)result > 0) - ((i32)result < 0));
+
+    bool ok = result == check->result;
+
+    if (check->expected != nullptr) {
+        const u8 *data = nullptr;
+
+        ok = ok &&
+             Memory_read_span(mem, check->dest, (u32)check->expected_size, &data) ==
+                 MemoryResult_Ok &&
+             memcmp(data, check->expected, check->expected_size) == 0;
+    }
+
+    if (!ok) {
+        ++hle->mismatches[check->function];
+        fprintf(stderr, "[HLE]: %s differs from the host implementation (returning to 0x%08X)\n",
+                function_names[check->function], check->ra);
+    }
+
+    free(check->expected);
+    check->expected = nullptr;
+    hle->checking = false;
+    update_entry_mask(hle);
+}
+
+/**
+ * \brief Moves the upper half of the heap region to a segment of its own, for the allocator.
+ *
+ * The guest's own allocator stays live for blocks it handed out before, and libgloss caches the
+ * break and sets it with absolute addresses, so blocks carved from the heap with sbrk could end
+ * up below the guest's idea of the break.
+ *
+ * \return false if the heap region is too small to spare a page.
+ */
+[[nodiscard]] static bool carve_arena(HleAllocator *const alloc, SegmentedMemory *const mem)
+{
+    const Heap heap = mem->heap;
+
+    if (heap.limit <= heap.start)
+        return false;
+
+    const u64 middle = sz_max(heap.start + (((u64)heap.limit - heap.start) / 2), heap.top);
+    const u64 arena_start = (middle + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE * MEMORY_PAGE_SIZE;
+
+    if (arena_start + MEMORY_PAGE_SIZE > heap.limit)
+        return false;
+
+    SegmentedMemory_set_heap(mem, (Heap){
+                                      .start = heap.start,
+                                      .top = heap.top,
+                                      .limit = (u32)arena_start,
+                                  });
+
+    SegmentedMemory_add_segment(mem, (Segment){
+                                         .addr = (u32)arena_start,
+                                         .size = (u32)(heap.limit - arena_start),
+                                         .perms = SegPerms_Read | SegPerms_Write,
+                                         .device = nullptr,
+                                     });
+
+    alloc->arena_top = (u32)arena_start;
+    alloc->arena_end = heap.limit;
+
+    ver_printf("hle: allocator arena at 0x%08X-0x%08X\n", alloc->arena_top, alloc->arena_end);
+    return true;
+}
+
+Hle Hle_new(const SymbolTable *const symbols, const bool verify, SegmentedMemory *const mem)
+{
+    Hle hle = {
+        .entry_mask = 0,
+        .entries = {},
+        .present = {},
+        .hits = {},
+        .mismatches = {},
+        .verify = verify,
+        .checking = false,
+        .check = {},
+        .allocator = {},
+    };
+
+    for (size_t i = 0; i < HleFunction_Count; ++i) {
+        // Allocator results cannot be compared, so they are left alone when verifying
+        if (verify && is_allocator((HleFunction)i))
+            continue;
+
+        hle.present[i] = SymbolTable_find(symbols, function_names[i], &hle.entries[i]);
+    }
+
+    // Blocks must never be handed out by one allocator and released by the other
+    if (!hle.present[HleFunction_Malloc] || !hle.present[HleFunction_Free] ||
+        !carve_arena(&hle.allocator, mem)) {
+        for (size_t i = HleFunction_Malloc; i < HleFunction_Count; ++i)
+            hle.present[i] = false;
+    }
+
+    for (size_t i = 0; i < HleFunction_Count; ++i) {
+        if (hle.present[i])
+            ver_printf("hle: %s at 0x%08X\n", function_names[i], hle.entries[i]);
+    }
+
+    update_entry_mask(&hle);
+    return hle;
+}
+
+bool Hle_step(Hle *const hle, Cpu *const cpu, Memory *const mem)
+{
+    if (hle->checking && cpu->pc == hle->check.ra && cpu->regs[2] == hle->check.sp)
+        finish_check(hle, cpu, mem);
+
+    for (size_t i = 0; i < HleFunction_Count; ++i) {
+        if (!hle->present[i] || hle->entries[i] != cpu->pc)
+            continue;
+
+        const HleFunction function = (HleFunction)i;
+
+        if (hle->verify) {
+            if (!hle->checking)
+                start_check(hle, function, cpu, mem);
+
+            return false;
+        }
+
+        u32 result = 0;
+
+        if (!run_function(hle, function, cpu, mem, &result))
+            return false;
+
+        ++hle->hits[function];
+        cpu->regs[10] = result;
+        cpu->pc = cpu->regs[1];
+        ++cpu->instret;
+
+        return true;
+    }
+
+    return false;
+}
+
+void Hle_print_stats(const Hle *const hle)
+{
+    for (size_t i = 0; i < HleFunction_Count; ++i) {
+        if (!hle->present[i])
+            continue;
+
+        if (hle->verify) {
+            ver_printf("hle: %s: %llu checked, %llu mismatched\n", function_names[i],
+                       (unsigned long long)hle->hits[i], (unsigned long long)hle->mismatches[i]);
+        } else {
+            ver_printf("hle: %s: %llu hits\n", function_names[i], (unsigned long long)hle->hits[i]);
+        }
+    }
+}
+
+void Hle_destroy(Hle *const hle)
+{
+    HleAllocator *const alloc = &hle->allocator;
+
+    for (size_t i = 0; i < 32; ++i)
+        free(alloc->free_lists[i]);
+
+    free(alloc->block_addrs);
+    free(alloc->block_classes);
+    free(hle->check.expected);
+
+    *hle = (Hle){};
+}
@@ -0,0 +1,137 @@
+#ifndef RV32_EMU_HLE_H
+#define RV32_EMU_HLE_H
+
+#include "cpu.h"
+#include "memory.h"
+#include "stdinc.h"
+#include "symbols.h"
+#include <stddef.h>
+
+/**
+ * \brief Guest routines that can be replaced by host implementations.
+ */
+typedef enum HleFunction : u8 {
+    HleFunction_Memcpy,
+    HleFunction_Memset,
+    HleFunction_Strlen,
+    HleFunction_Strcmp,
+    HleFunction_Malloc,
+    HleFunction_Free,
+    HleFunction_Calloc,
+    HleFunction_Realloc,
+    HleFunction_Count,
+} HleFunction;
+
+/**
+ * \brief A call to a pure routine whose emulated result is yet to be checked.
+ */
+typedef struct HlePendingCheck {
+    HleFunction function;
+    u32 ra;
+    u32 sp;
+    u32 result;
+    u32 dest;
+    u8 *expected;
+    size_t expected_size;
+} HlePendingCheck;
+
+/**
+ * \brief Host-side state of the guest blocks handed out by the replacement allocator.
+ *
+ * Blocks come in power-of-two size classes and are carved out of an arena above the guest heap,
+ * which the guest's own allocator never reaches through brk. Live blocks are kept in an
+ * open-addressing table keyed by guest address, which also tells them apart from blocks allocated
+ * by the guest's own allocator.
+ */
+typedef struct HleAllocator {
+    u32 *free_lists[32];
+    size_t free_lists_size[32];
+    size_t free_lists_capacity[32];
+    u32 *block_addrs;
+    u8 *block_classes;
+    size_t blocks_size;
+    size_t blocks_capacity;
+    u32 arena_top; // Start of the part of the arena never handed out
+    u32 arena_end;
+} HleAllocator;
+
+/**
+ * \brief Finds the slot of a live block in the block table.
+ *
+ * \return The slot index, or blocks_capacity if the block is not live.
+ */
+[[nodiscard]] size_t HleAllocator_find_block(const HleAllocator *alloc, u32 addr);
+
+/**
+ * \brief Adds a live block to the block table, growing it to stay at most half full.
+ *
+ * \param alloc The allocator owning the table.
+ * \param addr Guest address of the block. Must not be 0 or already live.
+ * \param size_class Log2 of the size of the block.
+ */
+void HleAllocator_insert_block(HleAllocator *alloc, u32 addr, u8 size_class);
+
+/**
+ * \brief Removes a block from the block table.
+ *
+ * \param alloc The allocator owning the table.
+ * \param slot Slot of the block, as returned by HleAllocator_find_block().
+ */
+void HleAllocator_remove_block(HleAllocator *alloc, size_t slot);
+
+/**
+ * \brief High-level emulation of hot libc routines.
+ *
+ * Entry points are found by symbol name. entry_mask has bit (addr / 4) % 64 set for every address
+ * that needs attention, so most instructions can be ruled out without a call.
+ */
+typedef struct Hle {
+    u64 entry_mask;
+    u32 entries[HleFunction_Count];
+    bool present[HleFunction_Count];
+    u64 hits[HleFunction_Count];
+    u64 mismatches[HleFunction_Count];
+    bool verify;
+    bool checking;
+    HlePendingCheck check;
+    HleAllocator allocator;
+} Hle;
+
+/**
+ * \brief Looks up the routines to replace in a symbol table.
+ *
+ * The allocator routines are only replaced when both malloc and free are present. Their arena
+ * then takes the upper half of the heap region, which is shortened accordingly.
+ *
+ * \param symbols The symbol table of the guest program.
+ * \param verify If set, pure routines are still emulated, and their results are checked against
+ * the host implementation instead. Allocator routines are left alone.
+ * \param mem The guest memory, whose heap must already be set up.
+ *
+ * \return The new Hle.
+ */
+[[nodiscard]] Hle Hle_new(const SymbolTable *symbols, bool verify, SegmentedMemory *mem);
+
+/**
+ * \brief Runs the host implementation of the routine at the current PC, if any.
+ *
+ * On success, the routine's result is placed in a0 and execution resumes at ra. Calls whose
+ * arguments point to memory that cannot be fully accessed are left to the emulated routine, so
+ * that it faults at the exact instruction.
+ *
+ * \param hle The Hle.
+ * \param cpu The CPU.
+ * \param mem The guest memory.
+ *
+ * \return true if the call was handled, false if the instruction at the PC has to be executed.
+ */
+[[nodiscard]] bool Hle_step(Hle *hle, Cpu *cpu, Memory *mem);
+
+/**
+ * \brief Prints the hit count of every replaced routine in verbose mode.
+ */
+void Hle_print_stats(const Hle *hle);
+
+void Hle_destroy(Hle *hle);
+
+#endif
@@ -1,26 +1,58 @@
 #include "io.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <stddef.h>
-#include <stdio.h>
-#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-u8 *load_file(const char *const filename, size_t *const file_size)
+bool MappedFile_open(const char *const filename, MappedFile *const out)
 {
-    FILE *const file = fopen(filename, "rb");
+    const int fd = open(filename, O_RDONLY | O_CLOEXEC);
 
-    if (file == nullptr)
-        return nullptr;
+    if (fd < 0)
+        return false;
 
-    fseek(file, 0L, SEEK_END);
-    *file_size = ftell(file);
-    fseek(file, 0L, SEEK_SET);
+    struct stat st = {};
 
-    u8 *data = malloc(*file_size * sizeof(*data));
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
 
-    if (!fread(data, sizeof(*data), *file_size, file)) {
-        free(data);
-        data = nullptr;
+    if (st.st_size == 0) {
+        close(fd);
+        errno = EINVAL;
+        return false;
     }
 
-    fclose(file);
-    return data;
+    void *const data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (data == MAP_FAILED) {
+        const int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return false;
+    }
+
+    *out = (MappedFile){
+        .fd = fd,
+        .data = data,
+        .size = (size_t)st.st_size,
+    };
+
+    return true;
+}
+
+void MappedFile_close(MappedFile *const file)
+{
+    if (file->data != nullptr)
+        munmap((void *)file->data, file->size);
+
+    if (file->fd >= 0)
+        close(file->fd);
+
+    file->fd = -1;
+    file->data = nullptr;
+    file->size = 0;
 }
@@ -5,17 +5,28 @@
 #include <stddef.h>
 
 /**
- * \brief Loads a file into memory.
+ * \brief A read-only memory mapping of a whole file.
  *
- * Returns a dynamic array that must be freed with free().
+ * The file descriptor is kept open so that parts of the file can be mapped again elsewhere.
+ */
+typedef struct MappedFile {
+    int fd;
+    const u8 *data;
+    size_t size;
+} MappedFile;
+
+/**
+ * \brief Maps a file into memory.
  *
- * \param filename Path of the file to read.
- * \param file_size Out param for the size of the file read.
+ * The file contents are not read up-front, pages are brought in as they are accessed.
  *
- * If an error occurs, NULL will be returned and errno will be set.
+ * \param filename Path of the file to map.
+ * \param out The mapped file. Must be closed with MappedFile_close().
  *
- * \return The file data in bytes, or NULL if something went wrong.
+ * \return true if successful, false otherwise. If false, errno will be set.
  */
-[[nodiscard]] u8 *load_file(const char *filename, size_t *file_size);
+[[nodiscard]] bool MappedFile_open(const char *filename, MappedFile *out);
+
+void MappedFile_close(MappedFile *file);
 
 #endif
@@ -1,14 +1,32 @@
+#include "agent_expr.h"
+#include "breakpoint.h"
+#include "console.h"
 #include "cpu.h"
 #include "elf.h"
 #include "elf_util.h"
+#include "framebuffer.h"
+#include "history.h"
+#include "hle.h"
 #include "io.h"
 #include "log.h"
+#include "macros.h"
 #include "memory.h"
+#include "numeric.h"
 #include "protocol.h"
+#include "replay.h"
+#include "sha256.h"
+#include "snapshot.h"
 #include "stdinc.h"
 #include "str.h"
+#include "symbols.h"
+#include "syscall.h"
+#include "uart.h"
+#include "watchpoint.h"
 #include <argparse.h>
 #include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <poll.h>
 #include <signal.h>
@@ -19,18 +37,36 @@
 #include <string.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 static const char *const usages[] = {
     "rv32-emu [options] [--] <filename>",
+    "rv32-emu [options] --restore <snapshot>",
     nullptr,
 };
 
 static constexpr u16 DEFAULT_PORT = 3333;
+static constexpr u32 DEFAULT_HEAP_LIMIT = 256 << 20;
+static constexpr int DEFAULT_MHZ = 100;
+
+// Must match GDB_PACKET_SIZE. Memory reads are capped so that their hex encoding fits.
+static constexpr char SUPPORTED_FEATURES[] =
+    "PacketSize=20000;QStartNoAckMode+;qXfer:memory-map:read+;qXfer:features:read+;"
+    "ConditionalBreakpoints+";
+
+// Registers sent along with every stop reply, so that GDB does not have to fetch them: pc, sp, ra
+static constexpr size_t EXPEDITED_REGS[] = {CPU_GDB_REG_PC, 2, 1};
+
+// Instructions run between checks for an interrupt from the client
+static constexpr u32 CONTINUE_BATCH = 4096;
 
 static GdbServer server = {};
 static int client_sock = -1;
 
+static bool hle_enabled = false;
+static Hle hle = {};
+
 static void cleanup(void)
 {
     printf("Shutting down gracefully...\n");
@@ -53,86 +89,377 @@ static void sigint_handler([[maybe_unused]] const int sig_no)
 typedef struct Context {
     Cpu *cpu;
     Memory *mem;
-    String stop_signal;
+    SegmentedMemory *segmem;
+    char stop_signal[32];
+    BreakpointSet breakpoints;
+    WatchpointSet watchpoints;
+    WatchedMemory watched_mem;
+    bool reverse; // Whether history is kept for reverse execution
+    History history;
+    bool async;              // Continue runs in time slices driven by a session server
+    bool leaving_breakpoint; // The next instruction is the one continued from
+    u32 range_start;         // Start of the range being stepped through
+    u32 range_end;           // End of the range being stepped through, or range_start if continuing
 } Context;
 
+/**
+ * \brief Sets up a Context in place, since its watched memory points back into it.
+ *
+ * \param reverse_interval Instructions between checkpoints for reverse execution, or 0 to leave
+ * reverse execution unsupported.
+ * \param reverse_limit Most checkpoints kept for reverse execution.
+ */
+static void Context_init(Context *const ctx, Cpu *const cpu, SegmentedMemory *const segmem,
+                         const u64 reverse_interval, const size_t reverse_limit)
+{
+    *ctx = (Context){
+        .cpu = cpu,
+        .mem = &segmem->mem,
+        .segmem = segmem,
+        .stop_signal = "S05",
+        .breakpoints = BreakpointSet_new(),
+        .watchpoints = WatchpointSet_new(),
+        .watched_mem = {},
+        .reverse = reverse_interval != 0,
+        .history = {},
+        .async = false,
+        .leaving_breakpoint = false,
+        .range_start = 0,
+        .range_end = 0,
+    };
+
+    ctx->watched_mem = WatchedMemory_new(ctx->mem, &ctx->watchpoints);
+
+    if (ctx->reverse)
+        ctx->history = History_new(reverse_interval, reverse_limit, cpu, segmem);
+}
+
 static void Context_destroy(Context *const ctx)
 {
-    String_destroy(&ctx->stop_signal);
+    BreakpointSet_destroy(&ctx->breakpoints);
+    WatchpointSet_destroy(&ctx->watchpoints);
+
+    if (ctx->reverse)
+        History_destroy(&ctx->history);
 }
 
-static bool Context_set_stop_signal(Context *const ctx, const char *const stop_signal)
+/**
+ * \brief Returns the memory the target should run with.
+ *
+ * Accesses only go through the watchpoint checks while there are watchpoints to check.
+ */
+[[nodiscard]] static Memory *Context_exec_mem(Context *const ctx)
 {
-    if (strcmp(ctx->stop_signal.data, stop_signal) == 0)
-        return false;
+    return ctx->watchpoints.size > 0 ? &ctx->watched_mem.mem : ctx->mem;
+}
 
-    String_destroy(&ctx->stop_signal);
-    ctx->stop_signal = String_from(stop_signal);
+/**
+ * \brief Formats the stop reply for a watchpoint hit, and clears the hit.
+ */
+static void Context_take_watch_hit(Context *const ctx, char *const buf, const size_t buf_size)
+{
+    const char *kind = "awatch";
 
-    return true;
+    if (ctx->watchpoints.hit_watchpoint.kind == WatchKind_Write)
+        kind = "watch";
+    else if (ctx->watchpoints.hit_watchpoint.kind == WatchKind_Read)
+        kind = "rwatch";
+
+    snprintf(buf, buf_size, "T05%s:%08x;", kind, ctx->watchpoints.hit_addr);
+    ctx->watchpoints.hit = false;
+}
+
+static void String_push_register_hex(String *const s, const u32 value)
+{
+    const u8 bytes[4] = {(u8)value, (u8)(value >> 8), (u8)(value >> 16), (u8)(value >> 24)};
+    String_push_hex_bytes(s, bytes, sizeof(bytes));
+}
+
+/**
+ * \brief Replies with why the target last stopped.
+ *
+ * Signal replies are sent as T replies with the expedited registers, which saves GDB a g packet
+ * after every step.
+ */
+static void Context_push_stop_reply(const Context *const ctx, String *const out)
+{
+    const char *const reason = ctx->stop_signal;
+
+    if (reason[0] != 'S' && reason[0] != 'T') {
+        String_push_raw(out, reason);
+        return;
+    }
+
+    // Any stop reason of a T reply already ends with a ';'
+    String_push(out, 'T');
+    String_push_raw(out, reason + 1);
+
+    for (size_t i = 0; i < sizeof(EXPEDITED_REGS) / sizeof(EXPEDITED_REGS[0]); ++i) {
+        char key[8] = {};
+        snprintf(key, sizeof(key), "%02zx:", EXPEDITED_REGS[i]);
+
+        String_push_raw(out, key);
+        String_push_register_hex(out, Cpu_read_gdb_register(ctx->cpu, EXPEDITED_REGS[i]));
+        String_push(out, ';');
+    }
+}
+
+/**
+ * \brief Remembers why the target stopped, and replies with it.
+ */
+static void Context_stop(Context *const ctx, const char *const stop_signal, String *const out)
+{
+    snprintf(ctx->stop_signal, sizeof(ctx->stop_signal), "%s", stop_signal);
+    Context_push_stop_reply(ctx, out);
 }
 
-[[nodiscard]] static String handle_q_packet(const Packet *const packet, GdbServer *const server)
+static void push_memory_region(String *const xml, const char *const type, const u64 start,
+                               const u64 end)
 {
-    if (strncmp(packet->data.data, "qSupported", strlen("qSupported")) == 0)
-        return String_from("QStartNoAckMode+");
+    if (end <= start)
+        return;
+
+    char line[128] = {};
+    snprintf(line, sizeof(line), "  <memory type=\"%s\" start=\"0x%08" PRIx64
+             "\" length=\"0x%" PRIx64 "\"/>\n", type, start, end - start);
+    String_push_raw(xml, line);
+}
+
+/**
+ * \brief Describes the guest address space to GDB.
+ *
+ * Guests may use memory outside of any segment, like a stack at the top of the address space, and
+ * debugger writes ignore guest permissions so that load can fill read-only segments. GDB refuses
+ * to write to ROM, so the whole address space is reported as RAM.
+ */
+[[nodiscard]] static String memory_map_xml(void)
+{
+    String xml = String_from("<?xml version=\"1.0\"?>\n"
+                             "<!DOCTYPE memory-map PUBLIC "
+                             "\"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\" "
+                             "\"http://sourceware.org/gdb/gdb-memory-map.dtd\">\n"
+                             "<memory-map>\n");
+
+    push_memory_region(&xml, "ram", 0, CPU_ADDRESS_SPACE);
+    String_push_raw(&xml, "</memory-map>\n");
+    return xml;
+}
+
+/**
+ * \brief Describes the registers to GDB, including the FP registers that g leaves out.
+ */
+[[nodiscard]] static String target_xml(void)
+{
+    String xml = String_from("<?xml version=\"1.0\"?>\n"
+                             "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+                             "<target version=\"1.0\">\n"
+                             "  <architecture>riscv:rv32</architecture>\n"
+                             "  <feature name=\"org.gnu.gdb.riscv.cpu\">\n");
+    char line[128] = {};
+
+    for (size_t i = 0; i < CPU_REGS_SIZE; ++i) {
+        snprintf(line, sizeof(line),
+                 "    <reg name=\"x%zu\" bitsize=\"32\" type=\"int\" regnum=\"%zu\"/>\n", i, i);
+        String_push_raw(&xml, line);
+    }
+
+    snprintf(line, sizeof(line),
+             "    <reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\" regnum=\"%zu\"/>\n",
+             CPU_GDB_REG_PC);
+    String_push_raw(&xml, line);
+    String_push_raw(&xml, "  </feature>\n"
+                          "  <feature name=\"org.gnu.gdb.riscv.fpu\">\n");
+
+    for (size_t i = 0; i < CPU_REGS_SIZE; ++i) {
+        snprintf(line, sizeof(line),
+                 "    <reg name=\"f%zu\" bitsize=\"32\" type=\"ieee_single\" regnum=\"%zu\"/>\n",
+                 i, CPU_GDB_REG_F0 + i);
+        String_push_raw(&xml, line);
+    }
+
+    String_push_raw(&xml, "  </feature>\n"
+                          "</target>\n");
+    return xml;
+}
+
+/**
+ * \brief Serves a qXfer read of a whole document.
+ *
+ * \param doc The document being read.
+ * \param args The "offset,length" part of the packet.
+ *
+ * \return The requested slice, prefixed by 'l' if it reaches the end of the document or by 'm'
+ * otherwise.
+ */
+static void handle_xfer_read(const String *const doc, const char *const args, String *const out)
+{
+    char *split = nullptr;
+    const size_t offset = strtoul(args, &split, 16);
+
+    if (*split != ',') {
+        String_push_raw(out, "E01"); // Bad packet
+        return;
+    }
+
+    const size_t length = strtoul(split + 1, nullptr, 16);
+
+    if (offset >= doc->size) {
+        String_push_raw(out, "l");
+        return;
+    }
+
+    const size_t chunk = sz_min(length, doc->size - offset);
+
+    String_reserve(out, chunk + 1);
+    String_push(out, offset + chunk < doc->size ? 'm' : 'l');
+
+    memcpy(out->data + out->size, doc->data + offset, chunk);
+    out->size += chunk;
+    out->data[out->size] = '\0';
+}
+
+static void handle_q_packet(Context *const ctx, const Packet *const packet,
+                            GdbServer *const server, String *const out)
+{
+    if (strncmp(packet->data.data, "qSupported", strlen("qSupported")) == 0) {
+        String_push_raw(out, SUPPORTED_FEATURES);
+
+        if (ctx->reverse)
+            String_push_raw(out, ";ReverseStep+;ReverseContinue+");
+
+        return;
+    }
+
+    if (strncmp(packet->data.data, "qXfer:memory-map:read::", strlen("qXfer:memory-map:read::")) ==
+        0) {
+        String map = memory_map_xml();
+        handle_xfer_read(&map, &packet->data.data[strlen("qXfer:memory-map:read::")], out);
+
+        String_destroy(&map);
+        return;
+    }
+
+    if (strncmp(packet->data.data, "qXfer:features:read:", strlen("qXfer:features:read:")) == 0) {
+        const char *const annex = &packet->data.data[strlen("qXfer:features:read:")];
+
+        if (strncmp(annex, "target.xml:", strlen("target.xml:")) != 0) {
+            String_push_raw(out, "E00"); // Unknown annex
+            return;
+        }
+
+        String xml = target_xml();
+        handle_xfer_read(&xml, &annex[strlen("target.xml:")], out);
+
+        String_destroy(&xml);
+        return;
+    }
 
     if (strcmp(packet->data.data, "QStartNoAckMode") == 0) {
         GdbServer_set_no_ack_mode(server, true);
-        return String_from("OK");
+        String_push_raw(out, "OK");
+        return;
     }
 
-    if (strcmp(packet->data.data, "qfThreadInfo") == 0)
-        return String_from("m1");
+    if (strcmp(packet->data.data, "qfThreadInfo") == 0) {
+        String_push_raw(out, "m1");
+        return;
+    }
 
-    if (strcmp(packet->data.data, "qsThreadInfo") == 0)
-        return String_from("l");
+    if (strcmp(packet->data.data, "qsThreadInfo") == 0) {
+        String_push_raw(out, "l");
+        return;
+    }
 
-    if (strcmp(packet->data.data, "qC") == 0)
-        return String_from("QC1");
+    if (strcmp(packet->data.data, "qC") == 0) {
+        String_push_raw(out, "QC1");
+        return;
+    }
 
     if (strcmp(packet->data.data, "qTStatus") == 0)
-        return String_new();
+        return;
 
-    return String_new();
+    return;
 }
 
-[[nodiscard]] static String handle_v_packet(const Packet *const packet)
+/**
+ * \brief Executes a single instruction, after injecting any writes due from a replay log.
+ *
+ * Calls to routines replaced by high-level emulation run on the host instead.
+ */
+[[nodiscard]] static CpuStepResult step(Cpu *const cpu, Memory *const mem)
 {
-    if (strcmp(packet->data.data, "vCont?") == 0) {
-        return String_from("vCont;c;s;t");
-    }
+    if (replay_replaying())
+        replay_inject(cpu, mem);
+
+    if (hle_enabled && (hle.entry_mask & (1ULL << ((cpu->pc / 4) % 64))) != 0 &&
+        Hle_step(&hle, cpu, mem))
+        return CpuStepResult_None;
 
-    return String_new();
+    return Cpu_step(cpu, mem);
 }
 
-static void String_push_register_hex(String *const s, u32 value)
+/**
+ * \brief Executes a single instruction of the target, keeping its history up to date.
+ */
+[[nodiscard]] static CpuStepResult Context_step(Context *const ctx, Memory *const mem)
 {
-    for (size_t i = 0; i < 4; ++i) {
-        const u8 byte = (value >> (8 * i)) & 0xFF;
-        String_push_hex(s, byte);
-    }
+    const CpuStepResult result = step(ctx->cpu, mem);
+
+    if (ctx->reverse && ctx->cpu->instret >= ctx->history.due)
+        History_update(&ctx->history, ctx->cpu, ctx->segmem);
+
+    return result;
 }
 
-[[nodiscard]] static String handle_read_mem(Context *const ctx, const Packet *const packet)
+/**
+ * \brief Called when GDB changes the target state, which then takes a new path from here on.
+ */
+static void Context_state_changed(Context *const ctx)
+{
+    if (ctx->reverse)
+        History_forget_future(&ctx->history, ctx->cpu);
+}
+
+static void handle_read_mem(Context *const ctx, const Packet *const packet, String *const out)
 {
     char *split = nullptr;
 
     const u32 addr = strtol(&packet->data.data[1], &split, 16);
-    const size_t len = strtol(split + 1, nullptr, 16);
+    const size_t len = sz_min(strtoul(split + 1, nullptr, 16), (GDB_PACKET_SIZE - 4) / 2);
 
-    String s = String_with_capacity(2 * len);
+    const u8 *data = nullptr;
 
-    for (size_t i = 0; i < len; ++i) {
-        // TODO: handle invalid reads
-        const u8 byte = Memory_read(ctx->mem, addr + i);
-        String_push_hex(&s, byte);
+    if (Memory_read_span(ctx->mem, addr, (u32)len, &data) != MemoryResult_Ok) {
+        String_push_raw(out, "E14"); // Bad address
+        return;
     }
 
-    return s;
+    String_push_hex_bytes(out, data, len);
 }
 
-[[nodiscard]] static String handle_write_mem(Context *const ctx, const Packet *const packet)
+/**
+ * \brief Saves a memory write done by GDB to the replay log, if recording.
+ */
+static void record_memory_write(Context *const ctx, const u32 addr, const u8 *const data,
+                                const size_t len)
+{
+    Context_state_changed(ctx);
+
+    if (replay_mode() != ReplayMode_Record && replay_mode() != ReplayMode_History)
+        return;
+
+    u8 *const event = malloc(sizeof(addr) + len);
+
+    if (event == nullptr)
+        BAIL("Could not allocate replay event");
+
+    memcpy(event, &addr, sizeof(addr));
+    memcpy(event + sizeof(addr), data, len);
+    replay_record(ReplayEvent_MemoryWrite, ctx->cpu->instret, event, sizeof(addr) + len);
+    free(event);
+}
+
+static void handle_write_mem(Context *const ctx, const Packet *const packet, String *const out)
 {
     char *split_1 = nullptr;
     char *split_2 = nullptr;
@@ -142,30 +469,130 @@ static void String_push_register_hex(String *const s, u32 value)
 
     const char *const byte_data = split_2 + 1;
 
-    if (2 * len != strlen(byte_data))
-        return String_from("E01"); // Bad packet
+    if (2 * len != strlen(byte_data)) {
+        String_push_raw(out, "E01"); // Bad packet
+        return;
+    }
+
+    u8 *data = nullptr;
+
+    if (len > UINT32_MAX ||
+        SegmentedMemory_debug_write_span(ctx->segmem, addr, (u32)len, &data) != MemoryResult_Ok) {
+        String_push_raw(out, "E14"); // Bad address
+        return;
+    }
 
     for (size_t i = 0; i < len; ++i) {
         char buf[3] = {};
         memcpy(buf, byte_data + (2 * i), 2);
 
-        const u8 byte = strtol(buf, nullptr, 16);
-        // TODO: handle invalid writes
-        Memory_write(ctx->mem, addr + i, byte);
+        data[i] = strtol(buf, nullptr, 16);
+    }
+
+    record_memory_write(ctx, addr, data, len);
+    String_push_raw(out, "OK");
+}
+
+/**
+ * \brief Handles X packets, which carry memory writes as escaped binary data.
+ */
+static void handle_write_mem_binary(Context *const ctx, const Packet *const packet,
+                                    String *const out)
+{
+    char *split_1 = nullptr;
+    char *split_2 = nullptr;
+
+    const u32 addr = strtoul(&packet->data.data[1], &split_1, 16);
+
+    if (*split_1 != ',') {
+        String_push_raw(out, "E01"); // Bad packet
+        return;
+    }
+
+    const size_t len = strtoul(split_1 + 1, &split_2, 16);
+
+    if (*split_2 != ':') {
+        String_push_raw(out, "E01"); // Bad packet
+        return;
+    }
+
+    const char *const start = split_2 + 1;
+    const char *const end = packet->data.data + packet->data.size;
+
+    // Check the size first, so that malformed packets leave memory alone
+    size_t decoded = 0;
+
+    for (const char *src = start; src < end; ++decoded) {
+        if (*src == '}' && src + 1 == end) {
+            String_push_raw(out, "E01"); // Bad packet
+            return;
+        }
+
+        src += *src == '}' ? 2 : 1;
+    }
+
+    if (decoded != len) {
+        String_push_raw(out, "E01"); // Bad packet
+        return;
+    }
+
+    u8 *data = nullptr;
+
+    if (len > UINT32_MAX ||
+        SegmentedMemory_debug_write_span(ctx->segmem, addr, (u32)len, &data) != MemoryResult_Ok) {
+        String_push_raw(out, "E14"); // Bad address
+        return;
+    }
+
+    const char *src = start;
+
+    for (size_t i = 0; i < len; ++i) {
+        if (*src == '}') {
+            data[i] = (u8)src[1] ^ 0x20;
+            src += 2;
+        } else {
+            data[i] = (u8)*src;
+            ++src;
+        }
     }
 
-    return String_from("OK");
+    record_memory_write(ctx, addr, data, len);
+    String_push_raw(out, "OK");
 }
 
-[[nodiscard]] String handle_read_regs(Context *const ctx)
+/**
+ * \brief Records a register write from GDB, which the target could not have made itself.
+ *
+ * \param float_regs Whether the FP registers were written rather than the integer ones and pc.
+ */
+static void record_register_write(Context *const ctx, const bool float_regs)
 {
-    String s = String_with_capacity(8L * (CPU_REGS_SIZE + 1L));
+    Context_state_changed(ctx);
 
-    for (size_t i = 0; i < CPU_REGS_SIZE; ++i)
-        String_push_register_hex(&s, ctx->cpu->regs[i]);
+    if (float_regs) {
+        replay_record(ReplayEvent_FloatRegisterWrite, ctx->cpu->instret, ctx->cpu->float_regs,
+                      sizeof(ctx->cpu->float_regs));
+        return;
+    }
+
+    u8 event[sizeof(ctx->cpu->regs) + sizeof(ctx->cpu->pc)] = {};
+    memcpy(event, ctx->cpu->regs, sizeof(ctx->cpu->regs));
+    memcpy(event + sizeof(ctx->cpu->regs), &ctx->cpu->pc, sizeof(ctx->cpu->pc));
+    replay_record(ReplayEvent_RegisterWrite, ctx->cpu->instret, event, sizeof(event));
+}
+
+static void handle_read_regs(Context *const ctx, String *const out)
+{
+    u8 bytes[4 * (CPU_REGS_SIZE + 1)] = {};
+
+    for (size_t i = 0; i <= CPU_GDB_REG_PC; ++i) {
+        const u32 value = Cpu_read_gdb_register(ctx->cpu, i);
+
+        for (size_t j = 0; j < 4; ++j)
+            bytes[(4 * i) + j] = (u8)(value >> (8 * j));
+    }
 
-    String_push_register_hex(&s, ctx->cpu->pc);
-    return s;
+    String_push_hex_bytes(out, bytes, sizeof(bytes));
 }
 
 [[nodiscard]] u32 u32_read_hex_le(const char *const str)
@@ -183,10 +610,12 @@ static void String_push_register_hex(String *const s, u32 value)
     return out;
 }
 
-[[nodiscard]] String handle_write_regs(Context *const ctx, const Packet *const packet)
+static void handle_write_regs(Context *const ctx, const Packet *const packet, String *const out)
 {
-    if (packet->data.size != 1 + 8L * (CPU_REGS_SIZE + 1))
-        return String_from("E01"); // Bad packet
+    if (packet->data.size != 1 + 8L * (CPU_REGS_SIZE + 1)) {
+        String_push_raw(out, "E01"); // Bad packet
+        return;
+    }
 
     size_t pos = 1;
 
@@ -196,231 +625,1164 @@ static void String_push_register_hex(String *const s, u32 value)
     }
 
     ctx->cpu->pc = u32_read_hex_le(&packet->data.data[pos]);
-    return String_from("OK");
+
+    record_register_write(ctx, false);
+    String_push_raw(out, "OK");
 }
 
-[[nodiscard]] static String handle_continue(Context *const ctx, GdbServer *const server,
-                                            BufSock *const client)
+/**
+ * \brief Handles p packets, which read a single register.
+ */
+static void handle_read_reg(Context *const ctx, const Packet *const packet, String *const out)
 {
-    char ch = '\0';
+    char *end = nullptr;
+    const size_t regno = strtoul(&packet->data.data[1], &end, 16);
 
-    while (!BufSock_try_read_buf(client, &ch) || ch != 0x03) {
-        const CpuStepResult result = Cpu_step(ctx->cpu, ctx->mem);
+    if (end == &packet->data.data[1] || *end != '\0' || regno >= CPU_GDB_REGS_SIZE) {
+        String_push_raw(out, "E01"); // Bad packet
+        return;
+    }
 
-        if (result == CpuStepResult_Exit) {
-            server->quit = true;
-            Context_set_stop_signal(ctx, "W00");
-            return String_clone(ctx->stop_signal);
-        }
+    String_push_register_hex(out, Cpu_read_gdb_register(ctx->cpu, regno));
+}
 
-        if (result == CpuStepResult_Break) {
-            Context_set_stop_signal(ctx, "S05");
-            return String_clone(ctx->stop_signal);
-        }
+/**
+ * \brief Handles P packets, which write a single register.
+ */
+static void handle_write_reg(Context *const ctx, const Packet *const packet, String *const out)
+{
+    char *end = nullptr;
+    const size_t regno = strtoul(&packet->data.data[1], &end, 16);
 
-        if (result == CpuStepResult_IllegalInstruction) {
-            Context_set_stop_signal(ctx, "S04");
-            return String_clone(ctx->stop_signal);
-        }
+    if (end == &packet->data.data[1] || *end != '=' || strlen(end + 1) != 8 ||
+        regno >= CPU_GDB_REGS_SIZE) {
+        String_push_raw(out, "E01"); // Bad packet
+        return;
     }
 
-    Context_set_stop_signal(ctx, "S02");
-    return String_clone(ctx->stop_signal);
+    const u32 value = u32_read_hex_le(end + 1);
+
+    if (regno < CPU_REGS_SIZE)
+        ctx->cpu->regs[regno] = value;
+    else if (regno == CPU_GDB_REG_PC)
+        ctx->cpu->pc = value;
+    else
+        memcpy(&ctx->cpu->float_regs[regno - CPU_GDB_REG_F0], &value, sizeof(value));
+
+    record_register_write(ctx, regno >= CPU_GDB_REG_F0);
+    String_push_raw(out, "OK");
 }
 
-[[nodiscard]] static String packet_handler(void *const ctx_raw, const Packet *const packet,
-                                           GdbServer *const server, BufSock *const client)
+/**
+ * \brief Handles Z and z packets, which insert and remove breakpoints and watchpoints.
+ *
+ * Software (Z0) and hardware (Z1) breakpoints are both kept by the emulator, so guest text is
+ * never patched. Their conditions are evaluated by the emulator too, so GDB only hears about the
+ * hits it cares about. Write (Z2), read (Z3) and access (Z4) watchpoints are checked on every data
+ * access to the pages they cover.
+ */
+static void handle_breakpoint(Context *const ctx, const Packet *const packet, String *const out)
 {
-    Context *const ctx = ctx_raw;
+    const char type = packet->data.data[1];
 
-    if (packet->data.size == 0)
-        return String_new();
+    if (type < '0' || type > '4')
+        return; // Unsupported
+
+    if (packet->data.data[2] != ',') {
+        String_push_raw(out, "E01"); // Bad packet
+        return;
+    }
 
-    if (packet->data.data[0] == 'q' || packet->data.data[0] == 'Q')
-        return handle_q_packet(packet, server);
+    char *end = nullptr;
+    const u32 addr = strtoul(&packet->data.data[3], &end, 16);
 
-    if (packet->data.data[0] == 'v')
-        return handle_v_packet(packet);
+    if (*end != ',') {
+        String_push_raw(out, "E01"); // Bad packet
+        return;
+    }
 
-    if (packet->data.data[0] == '?')
-        return String_clone(ctx->stop_signal);
+    const bool insert = packet->data.data[0] == 'Z';
 
-    if (packet->data.data[0] == 's') {
-        const CpuStepResult result = Cpu_step(ctx->cpu, ctx->mem);
+    if ((type == '0' || type == '1') && !insert) {
+        BreakpointSet_remove(&ctx->breakpoints, addr);
+        String_push_raw(out, "OK");
+        return;
+    }
 
-        if (result == CpuStepResult_Exit) {
-            server->quit = true;
-            Context_set_stop_signal(ctx, "W00");
-            return String_clone(ctx->stop_signal);
-        }
+    if (type == '0' || type == '1') {
+        AgentExpr *conditions = nullptr;
+        size_t conditions_size = 0;
 
-        if (result == CpuStepResult_IllegalInstruction) {
-            Context_set_stop_signal(ctx, "S04");
-            return String_clone(ctx->stop_signal);
+        if (!AgentExpr_parse_conditions(end + 1, &conditions, &conditions_size)) {
+            String_push_raw(out, "E01"); // Bad packet
+            return;
         }
 
-        Context_set_stop_signal(ctx, "S05");
-        return String_clone(ctx->stop_signal);
+        BreakpointSet_insert_conditional(&ctx->breakpoints, addr, conditions, conditions_size);
+        String_push_raw(out, "OK");
+        return;
     }
 
-    if (packet->data.data[0] == 'c')
-        return handle_continue(ctx, server, client);
+    static constexpr WatchKind KINDS[] = {WatchKind_Write, WatchKind_Read, WatchKind_Access};
 
-    if (strncmp(packet->data.data, "Hg", 2) == 0)
-        return String_from("OK");
+    const unsigned long long size = strtoull(end + 1, nullptr, 16);
 
-    if (strncmp(packet->data.data, "Hc", 2) == 0)
-        return String_from("OK");
+    if (size == 0 || addr + size > CPU_ADDRESS_SPACE) {
+        String_push_raw(out, "E01"); // Empty or past the end of the address space
+        return;
+    }
 
-    if (strcmp(packet->data.data, "Hc-1") == 0)
-        return String_from("OK");
+    const Watchpoint watchpoint = {
+        .addr = addr,
+        .size = (u32)size,
+        .kind = KINDS[type - '2'],
+    };
 
-    if (packet->data.data[0] == 'm')
-        return handle_read_mem(ctx, packet);
+    if (insert) {
+        if (!WatchpointSet_insert(&ctx->watchpoints, watchpoint)) {
+            String_push_raw(out, "E01");
+            return;
+        }
+    } else {
+        WatchpointSet_remove(&ctx->watchpoints, watchpoint);
+    }
 
-    if (packet->data.data[0] == 'M')
-        return handle_write_mem(ctx, packet);
+    String_push_raw(out, "OK");
+}
 
-    if (packet->data.data[0] == 'g')
-        return handle_read_regs(ctx);
+/**
+ * \brief Returns whether the client sent an interrupt (Ctrl-C), consuming any bytes it sent.
+ *
+ * Meant to be called once the client is known to have sent something. A client that has nothing
+ * to read has hung up, which is reported as an interrupt too.
+ */
+[[nodiscard]] static bool interrupt_requested(BufSock *const client)
+{
+    char ch = '\0';
+    bool received = false;
+    bool interrupted = false;
 
-    if (packet->data.data[0] == 'G')
-        return handle_write_regs(ctx, packet);
+    while (BufSock_try_read_buf(client, &ch)) {
+        received = true;
+        interrupted = interrupted || ch == 0x03;
+    }
 
-    return String_new();
+    return interrupted || !received;
 }
 
-static bool load_elf(const char *const filename, Cpu *const cpu, SegmentedMemory *const mem)
+/**
+ * \brief Acknowledges a command that may run for a while, and starts watching for an interrupt.
+ *
+ * \return false if the client already asked for an interrupt, in which case the command should
+ * stop right away.
+ */
+[[nodiscard]] static bool start_long_command(BufSock *const client, SockWatcher *const watcher)
 {
-    ver_printf("Reading %s\n", filename);
+    // Retransmissions of the command are taken for interrupts too, so it never runs twice
+    if (BufSock_has_buffered(client) && interrupt_requested(client))
+        return false;
 
-    size_t elf_data_size = 0;
-    u8 *elf_data = load_file(filename, &elf_data_size);
+    // GDB should not wait for the response to see the ack, or it would send the command again
+    if (!BufSock_flush_ack(client))
+        BAIL("Could not acknowledge packet");
 
-    if (elf_data == nullptr) {
-        perror("Could not read file");
+    if (!SockWatcher_start(watcher, client->sock))
+        BAIL("Could not watch client socket");
+
+    return true;
+}
+
+/**
+ * \brief Returns whether the client asked for an interrupt, stopping the watcher if so.
+ */
+[[nodiscard]] static bool poll_interrupt(BufSock *const client, SockWatcher *const watcher)
+{
+    if (!SockWatcher_readable(watcher))
         return false;
-    }
 
-    const Elf32_Ehdr *ehdr = nullptr;
-    const Elf32_Phdr *phdrs = nullptr;
+    SockWatcher_stop(watcher);
 
-    const ElfResult elf_result = parse_elf(elf_data, elf_data_size, &ehdr, &phdrs);
+    if (interrupt_requested(client))
+        return true;
 
-    if (elf_result != ElfResult_Ok) {
-        fprintf(stderr, "Could not load ELF: %s\n", ElfResult_display(elf_result));
-        return false;
-    }
+    if (!SockWatcher_start(watcher, client->sock))
+        BAIL("Could not watch client socket");
 
-    ver_printf("Loading program...\n");
-    ver_printf("\n");
+    return false;
+}
 
-    cpu->pc = ehdr->e_entry;
+/**
+ * \brief Returns whether the target is at a breakpoint whose condition holds.
+ *
+ * A condition that cannot be evaluated counts as holding, so that the user gets to see it.
+ */
+[[nodiscard]] static bool Context_at_breakpoint(const Context *const ctx)
+{
+    const Breakpoint *const bp = BreakpointSet_find(&ctx->breakpoints, ctx->cpu->pc);
 
-    for (size_t i = 0; i < ehdr->e_phnum; ++i) {
-        const Elf32_Phdr *const phdr = &phdrs[i];
+    if (bp == nullptr)
+        return false;
 
-        if (phdr->p_type == PT_LOAD) {
-            Segment seg = {};
-            const ElfResult result =
-                Segment_from_phdr(phdr, i, elf_data, elf_data_size, mem->data, &seg);
+    if (bp->conditions_size == 0)
+        return true;
 
-            if (result != ElfResult_Ok) {
-                fprintf(stderr, "Could not load ELF header: %s\n", ElfResult_display(result));
-                return false;
-            }
+    for (size_t i = 0; i < bp->conditions_size; ++i) {
+        i64 value = 0;
+        const AgentExprResult result =
+            AgentExpr_eval(&bp->conditions[i], ctx->cpu, ctx->mem, &value);
 
-            SegmentedMemory_add_segment(mem, seg);
+        if (result != AgentExprResult_Ok) {
+            ver_printf("Breakpoint condition at 0x%08X failed: %s\n", bp->addr,
+                       AgentExprResult_display(result));
+            return true;
         }
+
+        if (value != 0)
+            return true;
     }
 
-    free(elf_data);
-    return true;
+    return false;
 }
 
-static int run_emulator_with_gdb(Cpu *const cpu, Memory *const mem, const u16 port)
+/**
+ * \brief Runs a continued target until it stops, or for at most budget instructions.
+ *
+ * When a range is being stepped through, the target also stops as soon as the pc leaves it.
+ *
+ * \param watch_stop Buffer for the stop reply of a watchpoint hit.
+ *
+ * \return The stop reply, or nullptr if the target is still running.
+ */
+[[nodiscard]] static const char *Context_run(Context *const ctx, GdbServer *const server,
+                                             const u32 budget, char *const watch_stop,
+                                             const size_t watch_stop_size)
 {
-    Context ctx = {
-        .cpu = cpu,
-        .mem = mem,
-        .stop_signal = String_from("S05"),
-    };
-
-    if (!GdbServer_new(packet_handler, &ctx, &server)) {
-        perror("Could not create server");
-        return EXIT_FAILURE;
-    }
+    Memory *const mem = Context_exec_mem(ctx);
 
-    if (!GdbServer_listen(&server, port)) {
-        perror("Could not start server");
-        return EXIT_FAILURE;
-    }
+    for (u32 i = 0; i < budget; ++i) {
+        // The instruction continued from is never stopped at, even if it has a breakpoint
+        if (!ctx->leaving_breakpoint && Context_at_breakpoint(ctx))
+            return "S05";
 
-    atexit(cleanup);
-    const struct sigaction action = {.sa_handler = &sigint_handler};
-    sigaction(SIGINT, &action, &old_action);
+        ctx->leaving_breakpoint = false;
 
-    printf("Server listening on port %i\n", port);
+        const CpuStepResult result = Context_step(ctx, mem);
 
-    struct sockaddr_in client_addr = {};
-    socklen_t addr_len = 0;
-    client_sock = GdbServer_accept_connection(&server, &client_addr, &addr_len);
+        if (result == CpuStepResult_None && ctx->watchpoints.hit) {
+            Context_take_watch_hit(ctx, watch_stop, watch_stop_size);
+            return watch_stop;
+        }
 
-    if (client_sock < 0) {
-        perror("Could not accept connection");
-        Context_destroy(&ctx);
-        return EXIT_FAILURE;
-    }
+        if (result == CpuStepResult_None && ctx->range_end != ctx->range_start &&
+            ctx->cpu->pc - ctx->range_start >= ctx->range_end - ctx->range_start)
+            return "S05";
 
-    printf("Connection from %s\n", inet_ntoa(client_addr.sin_addr));
+        if (result == CpuStepResult_None)
+            continue;
 
-    const GdbResult result = GdbServer_handle_client(&server, client_sock);
+        if (result == CpuStepResult_Exit) {
+            server->quit = true;
+            return "W00";
+        }
 
-    if (result != GdbResult_Ok) {
-        fprintf(stderr, "Error: %s\n", GdbResult_display(result));
-        Context_destroy(&ctx);
-        return EXIT_FAILURE;
+        return result == CpuStepResult_Break ? "S05" : "S04";
     }
 
-    Context_destroy(&ctx);
-    return EXIT_SUCCESS;
+    return nullptr;
 }
 
-static int run_emulator(Cpu *const cpu, Memory *const mem)
+/**
+ * \brief Continues the target, or steps it through a range of addresses.
+ *
+ * \param range_start Start of the range to step through.
+ * \param range_end End of the range to step through (exclusive), or range_start to continue.
+ */
+static void handle_continue(Context *const ctx, GdbServer *const server, BufSock *const client,
+                            const u32 range_start, const u32 range_end, String *const out)
 {
-    while (true) {
-        const CpuStepResult result = Cpu_step(cpu, mem);
+    ctx->leaving_breakpoint = true;
+    ctx->range_start = range_start;
+    ctx->range_end = range_end;
+
+    // The session server runs the target and replies once it stops
+    if (ctx->async) {
+        GdbServer_defer_response(server);
+        return;
+    }
 
-        switch (result) {
-        case CpuStepResult_Exit:
-            return EXIT_SUCCESS;
+    SockWatcher watcher = {};
 
-        case CpuStepResult_IllegalInstruction:
-            fprintf(stderr, "[EXCEPTION]: Illegal instruction\n");
-            return EXIT_FAILURE;
+    if (!start_long_command(client, &watcher)) {
+        Context_stop(ctx, "S02", out);
+        return;
+    }
 
-        case CpuStepResult_Break:
-            fprintf(stderr, "[EXCEPTION]: Program break\n");
-            return EXIT_FAILURE;
+    const char *stop_signal = nullptr;
+    char watch_stop[32] = {};
 
-        case CpuStepResult_None:
-        default:
+    while (stop_signal == nullptr) {
+        stop_signal = Context_run(ctx, server, CONTINUE_BATCH, watch_stop, sizeof(watch_stop));
+
+        if (stop_signal == nullptr && poll_interrupt(client, &watcher)) {
+            Context_stop(ctx, "S02", out);
+            return;
         }
     }
+
+    SockWatcher_stop(&watcher);
+    Context_stop(ctx, stop_signal, out);
 }
 
-int main(int argc, const char *argv[])
+static void handle_step(Context *const ctx, GdbServer *const server, String *const out)
 {
-    int port = DEFAULT_PORT;
-    bool verbose = false;
-    bool listen = false;
+    const CpuStepResult result = Context_step(ctx, Context_exec_mem(ctx));
 
-    struct argparse_option options[] = {
-        OPT_HELP(),
-        OPT_BOOLEAN('l', "listen", &listen, "listen for a gdb connection", nullptr, 0, 0),
-        OPT_INTEGER('p', "port", &port, "port to listen on", nullptr, 0, 0),
-        OPT_BOOLEAN('v', "verbose", &verbose, nullptr, nullptr, 0, 0),
-        OPT_END(),
+    if (result == CpuStepResult_Exit) {
+        server->quit = true;
+        Context_stop(ctx, "W00", out);
+        return;
+    }
+
+    if (result == CpuStepResult_IllegalInstruction) {
+        Context_stop(ctx, "S04", out);
+        return;
+    }
+
+    if (ctx->watchpoints.hit) {
+        char watch_stop[32] = {};
+        Context_take_watch_hit(ctx, watch_stop, sizeof(watch_stop));
+        Context_stop(ctx, watch_stop, out);
+        return;
+    }
+
+    Context_stop(ctx, "S05", out);
+}
+
+/**
+ * \brief Runs the target forward, without stopping, until it has retired a number of instructions.
+ */
+static void Context_run_to(Context *const ctx, const u64 instret)
+{
+    while (ctx->cpu->instret < instret) {
+        if (Context_step(ctx, ctx->mem) != CpuStepResult_None)
+            break;
+    }
+}
+
+static void handle_reverse_step(Context *const ctx, String *const out)
+{
+    if (ctx->cpu->instret <= History_start(&ctx->history)) {
+        Context_stop(ctx, "T05replaylog:begin;", out);
+        return;
+    }
+
+    const u64 target = ctx->cpu->instret - 1;
+
+    History_seek(&ctx->history, target, ctx->cpu, ctx->segmem);
+    Context_run_to(ctx, target);
+    Context_stop(ctx, "S05", out);
+}
+
+/**
+ * \brief Goes back to the latest breakpoint or watchpoint hit before the current instruction.
+ *
+ * History is searched one checkpoint interval at a time, latest first, by re-executing each
+ * interval and remembering its last hit. Watchpoints stop the target before the instruction
+ * accessing the watched memory. An interrupt stops the target where the search has got to, past
+ * which there are no hits.
+ */
+static void handle_reverse_continue(Context *const ctx, BufSock *const client, String *const out)
+{
+    const u64 start = History_start(&ctx->history);
+    Memory *const mem = Context_exec_mem(ctx);
+    u64 end = ctx->cpu->instret;
+
+    SockWatcher watcher = {};
+
+    if (!start_long_command(client, &watcher)) {
+        Context_stop(ctx, "S02", out);
+        return;
+    }
+
+    while (end > start) {
+        History_seek(&ctx->history, end - 1, ctx->cpu, ctx->segmem);
+
+        const u64 from = ctx->cpu->instret;
+        bool found = false;
+        u64 hit = 0;
+        char hit_stop[32] = {};
+
+        while (ctx->cpu->instret < end) {
+            const u64 instret = ctx->cpu->instret;
+
+            if ((instret - from) % CONTINUE_BATCH == 0 && poll_interrupt(client, &watcher)) {
+                History_seek(&ctx->history, end, ctx->cpu, ctx->segmem);
+                Context_run_to(ctx, end);
+                Context_stop(ctx, "S02", out);
+                return;
+            }
+
+            if (Context_at_breakpoint(ctx)) {
+                found = true;
+                hit = instret;
+                snprintf(hit_stop, sizeof(hit_stop), "S05");
+            }
+
+            const CpuStepResult result = Context_step(ctx, mem);
+
+            if (ctx->watchpoints.hit) {
+                found = true;
+                hit = instret;
+                Context_take_watch_hit(ctx, hit_stop, sizeof(hit_stop));
+            }
+
+            if (result != CpuStepResult_None)
+                break;
+        }
+
+        if (found) {
+            SockWatcher_stop(&watcher);
+            History_seek(&ctx->history, hit, ctx->cpu, ctx->segmem);
+            Context_run_to(ctx, hit);
+            Context_stop(ctx, hit_stop, out);
+            return;
+        }
+
+        end = from;
+    }
+
+    SockWatcher_stop(&watcher);
+    History_seek(&ctx->history, start, ctx->cpu, ctx->segmem);
+    Context_stop(ctx, "T05replaylog:begin;", out);
+}
+
+/**
+ * \brief Handles vCont packets, of which only the first action applies since there is one thread.
+ *
+ * Range stepping (r) single-steps in the emulator for as long as the pc stays in the range, so
+ * stepping over a source line takes a single round trip.
+ */
+static void handle_vcont(Context *const ctx, GdbServer *const server, BufSock *const client,
+                         const char *const actions, String *const out)
+{
+    switch (actions[0]) {
+    case 'c':
+    case 'C':
+        handle_continue(ctx, server, client, 0, 0, out);
+        break;
+
+    case 's':
+    case 'S':
+        handle_step(ctx, server, out);
+        break;
+
+    case 'r': {
+        char *split = nullptr;
+        const u32 start = strtoul(&actions[1], &split, 16);
+
+        if (*split != ',') {
+            String_push_raw(out, "E01"); // Bad packet
+            return;
+        }
+
+        const u32 end = strtoul(split + 1, nullptr, 16);
+
+        // An empty range still steps once
+        if (end <= start)
+            handle_step(ctx, server, out);
+        else
+            handle_continue(ctx, server, client, start, end, out);
+
+        break;
+    }
+
+    default:
+        String_push_raw(out, "E01"); // Bad packet
+    }
+}
+
+static void handle_v_packet(Context *const ctx, const Packet *const packet,
+                            GdbServer *const server, BufSock *const client, String *const out)
+{
+    if (strcmp(packet->data.data, "vCont?") == 0) {
+        String_push_raw(out, "vCont;c;C;s;S;r");
+        return;
+    }
+
+    if (strncmp(packet->data.data, "vCont;", strlen("vCont;")) == 0)
+        handle_vcont(ctx, server, client, &packet->data.data[strlen("vCont;")], out);
+}
+
+static void packet_handler(void *const ctx_raw, const Packet *const packet,
+                           GdbServer *const server, BufSock *const client, String *const out)
+{
+    Context *const ctx = ctx_raw;
+
+    if (packet->data.size == 0)
+        return;
+
+    switch (packet->data.data[0]) {
+    case 'q':
+    case 'Q':
+        handle_q_packet(ctx, packet, server, out);
+        break;
+
+    case 'v':
+        handle_v_packet(ctx, packet, server, client, out);
+        break;
+
+    case '?':
+        Context_push_stop_reply(ctx, out);
+        break;
+
+    case 's':
+        handle_step(ctx, server, out);
+        break;
+
+    case 'c':
+        handle_continue(ctx, server, client, 0, 0, out);
+        break;
+
+    case 'b':
+        if (!ctx->reverse)
+            break;
+
+        if (strcmp(packet->data.data, "bs") == 0)
+            handle_reverse_step(ctx, out);
+        else if (strcmp(packet->data.data, "bc") == 0)
+            handle_reverse_continue(ctx, client, out);
+
+        break;
+
+    case 'H':
+        String_push_raw(out, "OK");
+        break;
+
+    case 'Z':
+    case 'z':
+        handle_breakpoint(ctx, packet, out);
+        break;
+
+    case 'm':
+        handle_read_mem(ctx, packet, out);
+        break;
+
+    case 'M':
+        handle_write_mem(ctx, packet, out);
+        break;
+
+    case 'X':
+        handle_write_mem_binary(ctx, packet, out);
+        break;
+
+    case 'g':
+        handle_read_regs(ctx, out);
+        break;
+
+    case 'G':
+        handle_write_regs(ctx, packet, out);
+        break;
+
+    case 'p':
+        handle_read_reg(ctx, packet, out);
+        break;
+
+    case 'P':
+        handle_write_reg(ctx, packet, out);
+        break;
+
+    default:
+    }
+}
+
+static bool load_elf(const MappedFile *const elf, Cpu *const cpu, SegmentedMemory *const mem,
+                     SymbolTable *const symbols)
+{
+    const Elf32_Ehdr *ehdr = nullptr;
+    const Elf32_Phdr *phdrs = nullptr;
+
+    const ElfResult elf_result = parse_elf(elf->data, elf->size, &ehdr, &phdrs);
+
+    if (elf_result != ElfResult_Ok) {
+        fprintf(stderr, "Could not load ELF: %s\n", ElfResult_display(elf_result));
+        return false;
+    }
+
+    const ElfResult sym_result = SymbolTable_from_elf(elf->data, elf->size, ehdr, symbols);
+
+    if (sym_result != ElfResult_Ok)
+        fprintf(stderr, "Warning: Ignoring symbol table: %s\n", ElfResult_display(sym_result));
+    else
+        ver_printf("Loaded %zu symbols.\n", symbols->symbols_size);
+
+    ver_printf("Loading program...\n");
+    ver_printf("\n");
+
+    *mem = SegmentedMemory_new();
+    cpu->pc = ehdr->e_entry;
+
+    for (size_t i = 0; i < ehdr->e_phnum; ++i) {
+        const Elf32_Phdr *const phdr = &phdrs[i];
+
+        if (phdr->p_type == PT_LOAD) {
+            Segment seg = {};
+            const ElfResult result =
+                Segment_from_phdr(phdr, i, elf->data, elf->size, elf->fd, mem->data, &seg);
+
+            if (result != ElfResult_Ok) {
+                fprintf(stderr, "Could not load ELF header: %s\n", ElfResult_display(result));
+                SegmentedMemory_destroy(mem);
+                return false;
+            }
+
+            SegmentedMemory_add_segment(mem, seg);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * \brief Loads a program from the image cache.
+ *
+ * Cached images are snapshots taken right after loading, so a hit skips ELF validation and
+ * segment construction altogether. Images record the size and digest of the ELF they were built
+ * from, and are only used if both match.
+ */
+static bool load_cached_image(const char *const image_path, const MappedFile *const elf,
+                              const SnapshotSource *const source, Cpu *const cpu,
+                              SegmentedMemory *const mem, SymbolTable *const symbols)
+{
+    Snapshot snapshot = {};
+
+    if (Snapshot_open(image_path, &snapshot) != SnapshotResult_Ok)
+        return false;
+
+    if (snapshot.source.size != source->size ||
+        memcmp(snapshot.source.sha256, source->sha256, SHA256_SIZE) != 0) {
+        ver_printf("Ignoring cached image %s, built from another file\n", image_path);
+        Snapshot_destroy(&snapshot);
+        return false;
+    }
+
+    const SnapshotResult result = Snapshot_instantiate(&snapshot, cpu, mem);
+    Snapshot_destroy(&snapshot);
+
+    if (result != SnapshotResult_Ok)
+        return false;
+
+    // The image was built from a file with the same contents, so its header was already validated
+    const Elf32_Ehdr *const ehdr = (const Elf32_Ehdr *)elf->data;
+
+    if (SymbolTable_from_elf(elf->data, elf->size, ehdr, symbols) != ElfResult_Ok)
+        *symbols = SymbolTable_new();
+
+    ver_printf("Loaded cached image %s\n", image_path);
+    return true;
+}
+
+static void save_cached_image(const char *const cache_dir, const char *const image_path,
+                              const SnapshotSource *const source, const Cpu *const cpu,
+                              const SegmentedMemory *const mem)
+{
+    if (mkdir(cache_dir, 0755) < 0 && errno != EEXIST) {
+        perror("Warning: Could not create cache directory");
+        return;
+    }
+
+    // Write under a unique name first, so that concurrent runs never see a partial image
+    char tmp_path[PATH_MAX] = {};
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", image_path, (int)getpid());
+
+    const SnapshotResult result = Snapshot_save(tmp_path, cpu, mem, source);
+
+    if (result != SnapshotResult_Ok) {
+        fprintf(stderr, "Warning: Could not save cached image: %s\n",
+                SnapshotResult_display(result));
+        unlink(tmp_path);
+        return;
+    }
+
+    if (rename(tmp_path, image_path) < 0) {
+        perror("Warning: Could not save cached image");
+        unlink(tmp_path);
+    }
+}
+
+static bool load_program(const char *const filename, const char *const cache_dir,
+                         Cpu *const cpu, SegmentedMemory *const mem, SymbolTable *const symbols)
+{
+    ver_printf("Reading %s\n", filename);
+
+    MappedFile elf = {};
+
+    if (!MappedFile_open(filename, &elf)) {
+        perror("Could not read file");
+        return false;
+    }
+
+    if (cache_dir == nullptr) {
+        const bool ok = load_elf(&elf, cpu, mem, symbols);
+        MappedFile_close(&elf);
+        return ok;
+    }
+
+    SnapshotSource source = {
+        .size = elf.size,
+        .sha256 = {},
+    };
+
+    sha256_digest(elf.data, elf.size, source.sha256);
+
+    // Images are named after the start of the digest, and the rest is checked on every hit
+    u64 name = 0;
+
+    for (size_t i = 0; i < sizeof(name); ++i)
+        name = (name << 8) | source.sha256[i];
+
+    char image_path[PATH_MAX] = {};
+    snprintf(image_path, sizeof(image_path), "%s/%016" PRIx64 ".img", cache_dir, name);
+
+    if (load_cached_image(image_path, &elf, &source, cpu, mem, symbols)) {
+        MappedFile_close(&elf);
+        return true;
+    }
+
+    const bool ok = load_elf(&elf, cpu, mem, symbols);
+
+    if (ok)
+        save_cached_image(cache_dir, image_path, &source, cpu, mem);
+
+    MappedFile_close(&elf);
+    return ok;
+}
+
+/**
+ * \brief Serves a GDB session.
+ *
+ * \param reverse_interval Instructions between checkpoints for reverse execution, or 0 to leave
+ * reverse execution unsupported.
+ * \param reverse_limit Most checkpoints kept for reverse execution.
+ */
+static int run_emulator_with_gdb(Cpu *const cpu, SegmentedMemory *const segmem, const u16 port,
+                                 const u64 reverse_interval, const size_t reverse_limit)
+{
+    Context ctx = {};
+    Context_init(&ctx, cpu, segmem, reverse_interval, reverse_limit);
+
+    if (!GdbServer_new(packet_handler, &ctx, &server)) {
+        perror("Could not create server");
+        return EXIT_FAILURE;
+    }
+
+    if (!GdbServer_listen(&server, port, 1)) {
+        perror("Could not start server");
+        return EXIT_FAILURE;
+    }
+
+    atexit(cleanup);
+    const struct sigaction action = {.sa_handler = &sigint_handler};
+    sigaction(SIGINT, &action, &old_action);
+
+    printf("Server listening on port %i\n", port);
+
+    struct sockaddr_in client_addr = {};
+    socklen_t addr_len = 0;
+    client_sock = GdbServer_accept_connection(&server, &client_addr, &addr_len);
+
+    if (client_sock < 0) {
+        perror("Could not accept connection");
+        Context_destroy(&ctx);
+        return EXIT_FAILURE;
+    }
+
+    printf("Connection from %s\n", inet_ntoa(client_addr.sin_addr));
+
+    const GdbResult result = GdbServer_handle_client(&server, client_sock);
+
+    if (result != GdbResult_Ok) {
+        fprintf(stderr, "Error: %s\n", GdbResult_display(result));
+        Context_destroy(&ctx);
+        return EXIT_FAILURE;
+    }
+
+    Context_destroy(&ctx);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * \brief The program as loaded, which every GDB session starts from.
+ */
+typedef struct SessionImage {
+    const Cpu *cpu;
+    const SegmentedMemory *mem;
+} SessionImage;
+
+/**
+ * \brief The target of a GDB session.
+ */
+typedef struct SessionTarget {
+    HostState host;
+    Cpu cpu;
+    SegmentedMemory mem;
+    Context ctx;
+} SessionTarget;
+
+[[nodiscard]] static void *session_open(void *const arg)
+{
+    const SessionImage *const image = arg;
+    SessionTarget *const target = malloc(sizeof(*target));
+
+    if (target == nullptr)
+        BAIL("Could not allocate session target");
+
+    // The host stdin cannot be shared between sessions, so guests see it as empty
+    target->host = HostState_new();
+    target->host.stdin_eof = true;
+
+    target->cpu = *image->cpu;
+    target->cpu.host = &target->host;
+    target->mem = SegmentedMemory_clone(image->mem);
+
+    Context_init(&target->ctx, &target->cpu, &target->mem, 0, 0);
+    target->ctx.async = true;
+
+    return &target->ctx;
+}
+
+static void session_close(void *const ctx_raw)
+{
+    SessionTarget *const target = CONTAINER_OF(ctx_raw, SessionTarget, ctx);
+
+    Context_destroy(&target->ctx);
+    SegmentedMemory_destroy(&target->mem);
+    HostState_destroy(&target->host);
+    free(target);
+}
+
+[[nodiscard]] static bool session_resume(void *const ctx_raw, const bool interrupted,
+                                         GdbServer *const server, String *const out)
+{
+    // Instructions run before other sessions get their turn, around 10 ms worth
+    static constexpr u32 SESSION_SLICE = 1 << 20;
+
+    Context *const ctx = ctx_raw;
+
+    if (interrupted) {
+        Context_stop(ctx, "S02", out);
+        return true;
+    }
+
+    char watch_stop[32] = {};
+    const char *const stop_signal =
+        Context_run(ctx, server, SESSION_SLICE, watch_stop, sizeof(watch_stop));
+
+    if (stop_signal == nullptr)
+        return false;
+
+    Context_stop(ctx, stop_signal, out);
+    return true;
+}
+
+/**
+ * \brief Serves concurrent GDB sessions, each with its own copy of the loaded program.
+ */
+static int run_gdb_sessions(const Cpu *const cpu, const SegmentedMemory *const segmem,
+                            const u16 port, const u32 max_sessions, const u32 workers)
+{
+    SessionImage image = {
+        .cpu = cpu,
+        .mem = segmem,
+    };
+
+    const SessionHooks hooks = {
+        .open = session_open,
+        .close = session_close,
+        .handler = packet_handler,
+        .resume = session_resume,
+        .arg = &image,
+    };
+
+    if (!GdbServer_new(packet_handler, nullptr, &server)) {
+        perror("Could not create server");
+        return EXIT_FAILURE;
+    }
+
+    if (!GdbServer_listen(&server, port, SOMAXCONN)) {
+        perror("Could not start server");
+        return EXIT_FAILURE;
+    }
+
+    atexit(cleanup);
+    const struct sigaction action = {.sa_handler = &sigint_handler};
+    sigaction(SIGINT, &action, &old_action);
+
+    printf("Server listening on port %i for up to %u sessions\n", port, max_sessions);
+
+    if (!GdbServer_serve_sessions(&server, &hooks, max_sessions, workers)) {
+        perror("Could not serve sessions");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void print_exception(const char *const message, const u32 pc,
+                            const SymbolTable *const symbols)
+{
+    console_flush();
+
+    char location[128] = {};
+    SymbolTable_format(symbols, pc, location, sizeof(location));
+
+    if (location[0] != '\0')
+        fprintf(stderr, "[EXCEPTION]: %s at 0x%08X <%s>\n", message, pc, location);
+    else
+        fprintf(stderr, "[EXCEPTION]: %s at 0x%08X\n", message, pc);
+}
+
+static int run_emulator(Cpu *const cpu, Memory *const mem, const SymbolTable *const symbols)
+{
+    while (true) {
+        const CpuStepResult result = step(cpu, mem);
+
+        switch (result) {
+        case CpuStepResult_Exit:
+            return cpu->exit_code;
+
+        case CpuStepResult_IllegalInstruction:
+            print_exception("Illegal instruction", cpu->pc, symbols);
+            return EXIT_FAILURE;
+
+        case CpuStepResult_Break:
+            print_exception("Program break", cpu->pc, symbols);
+            return EXIT_FAILURE;
+
+        case CpuStepResult_None:
+        default:
+        }
+    }
+}
+
+static bool restore_snapshot(const char *const filename, Cpu *const cpu,
+                             SegmentedMemory *const mem)
+{
+    ver_printf("Restoring %s\n", filename);
+
+    Snapshot snapshot = {};
+    SnapshotResult result = Snapshot_open(filename, &snapshot);
+
+    if (result == SnapshotResult_Ok) {
+        result = Snapshot_instantiate(&snapshot, cpu, mem);
+        Snapshot_destroy(&snapshot);
+    }
+
+    if (result != SnapshotResult_Ok) {
+        fprintf(stderr, "Could not restore snapshot: %s\n", SnapshotResult_display(result));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * \brief Parses an address given either as a number or as a symbol name.
+ */
+[[nodiscard]] static bool parse_address(const char *const str, const SymbolTable *const symbols,
+                                        u32 *const out)
+{
+    if (SymbolTable_find(symbols, str, out))
+        return true;
+
+    char *end = nullptr;
+    *out = strtoul(str, &end, 0);
+
+    return *str != '\0' && *end == '\0';
+}
+
+/**
+ * \brief Parses a size in bytes, optionally followed by a K, M or G suffix.
+ */
+[[nodiscard]] static bool parse_size(const char *const str, u32 *const out)
+{
+    char *end = nullptr;
+    u64 size = strtoull(str, &end, 0);
+
+    switch (*end) {
+    case 'K':
+        size <<= 10;
+        ++end;
+        break;
+
+    case 'M':
+        size <<= 20;
+        ++end;
+        break;
+
+    case 'G':
+        size <<= 30;
+        ++end;
+        break;
+
+    default:
+    }
+
+    *out = (u32)size;
+    return *str != '\0' && *end == '\0' && size <= UINT32_MAX;
+}
+
+/**
+ * \brief Parses framebuffer dimensions given as WIDTHxHEIGHT.
+ */
+[[nodiscard]] static bool parse_geometry(const char *const str, u32 *const width,
+                                         u32 *const height)
+{
+    char *end = nullptr;
+    const unsigned long w = strtoul(str, &end, 10);
+
+    if (end == str || *end != 'x')
+        return false;
+
+    const char *const height_str = end + 1;
+    const unsigned long h = strtoul(height_str, &end, 10);
+
+    if (end == height_str || *end != '\0' || w == 0 || h == 0 || w > FB_MAX_SIZE ||
+        h > FB_MAX_SIZE)
+        return false;
+
+    *width = (u32)w;
+    *height = (u32)h;
+    return true;
+}
+
+static int save_snapshot(const char *const filename, const char *const snapshot_at,
+                         Cpu *const cpu, SegmentedMemory *const mem,
+                         const SymbolTable *const symbols)
+{
+    if (snapshot_at != nullptr) {
+        u32 addr = 0;
+
+        if (!parse_address(snapshot_at, symbols, &addr)) {
+            fprintf(stderr, "Invalid snapshot address: %s\n", snapshot_at);
+            return EXIT_FAILURE;
+        }
+
+        while (cpu->pc != addr) {
+            if (step(cpu, (Memory *)mem) != CpuStepResult_None) {
+                fprintf(stderr, "Program stopped before reaching 0x%08X\n", addr);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    const SnapshotResult result = Snapshot_save(filename, cpu, mem, nullptr);
+
+    if (result != SnapshotResult_Ok) {
+        fprintf(stderr, "Could not save snapshot: %s\n", SnapshotResult_display(result));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, const char *argv[])
+{
+    int port = DEFAULT_PORT;
+    bool verbose = false;
+    bool listen = false;
+    const char *restore_path = nullptr;
+    const char *snapshot_path = nullptr;
+    const char *snapshot_at = nullptr;
+    const char *cache_dir = nullptr;
+    const char *output_buffering = nullptr;
+    bool output_thread = false;
+    const char *abi = nullptr;
+    const char *heap_start_str = nullptr;
+    const char *record_path = nullptr;
+    bool hle_verify = false;
+    const char *replay_path = nullptr;
+    const char *heap_limit_str = nullptr;
+    bool virtual_time = false;
+    int mhz = DEFAULT_MHZ;
+    bool uart = false;
+    const char *uart_base_str = nullptr;
+    const char *fb_geometry = nullptr;
+    const char *fb_base_str = nullptr;
+    const char *fb_format = nullptr;
+    const char *fb_shm = nullptr;
+    const char *fb_dump = nullptr;
+    int fb_dump_every = 1;
+    bool reverse = false;
+    int reverse_interval = (int)HISTORY_DEFAULT_INTERVAL;
+    int reverse_limit = (int)HISTORY_DEFAULT_LIMIT;
+    int sessions = 0;
+    int workers = 0;
+
+    struct argparse_option options[] = {
+        OPT_HELP(),
+        OPT_BOOLEAN('l', "listen", &listen, "listen for a gdb connection", nullptr, 0, 0),
+        OPT_INTEGER('p', "port", &port, "port to listen on", nullptr, 0, 0),
+        OPT_BOOLEAN(0, "reverse", &reverse, "let gdb step and continue backwards", nullptr, 0, 0),
+        OPT_INTEGER(0, "reverse-interval", &reverse_interval,
+                    "instructions between checkpoints for --reverse (default: 1000000)", nullptr, 0,
+                    0),
+        OPT_INTEGER(0, "reverse-limit", &reverse_limit,
+                    "checkpoints kept for --reverse, past which the oldest are merged "
+                    "(default: 1024)",
+                    nullptr, 0, 0),
+        OPT_INTEGER(0, "sessions", &sessions,
+                    "serve up to this many gdb sessions at once, each with its own copy of the "
+                    "program",
+                    nullptr, 0, 0),
+        OPT_INTEGER(0, "workers", &workers,
+                    "threads running gdb sessions (default: number of CPUs)", nullptr, 0, 0),
+        OPT_BOOLEAN('v', "verbose", &verbose, nullptr, nullptr, 0, 0),
+        OPT_STRING(0, "abi", &abi, "syscall ABI: spim (default) or linux", nullptr, 0, 0),
+        OPT_STRING(0, "heap-start", &heap_start_str,
+                   "address the heap starts at (default: after the last segment)", nullptr, 0, 0),
+        OPT_STRING(0, "heap-limit", &heap_limit_str,
+                   "maximum heap size in bytes, K, M or G (default: 256M)", nullptr, 0, 0),
+        OPT_BOOLEAN(0, "virtual-time", &virtual_time,
+                    "derive guest time from retired instructions and skip over sleeps", nullptr, 0,
+                    0),
+        OPT_INTEGER(0, "mhz", &mhz, "instructions per microsecond under virtual time (default: 100)",
+                    nullptr, 0, 0),
+        OPT_BOOLEAN(0, "uart", &uart, "map a 16550 UART at 0x10000000", nullptr, 0, 0),
+        OPT_STRING(0, "uart-base", &uart_base_str, "address to map the UART at (implies --uart)",
+                   nullptr, 0, 0),
+        OPT_STRING(0, "fb", &fb_geometry, "map a WIDTHxHEIGHT framebuffer at 0x40000000", nullptr,
+                   0, 0),
+        OPT_STRING(0, "fb-base", &fb_base_str, "address to map the framebuffer at", nullptr, 0, 0),
+        OPT_STRING(0, "fb-format", &fb_format,
+                   "framebuffer pixel format: xrgb8888 (default), rgb565 or gray8", nullptr, 0, 0),
+        OPT_STRING(0, "fb-shm", &fb_shm, "file to share framebuffer pixels through", nullptr, 0,
+                   0),
+        OPT_STRING(0, "fb-dump", &fb_dump, "write presented frames to <prefix><frame>.ppm",
+                   nullptr, 0, 0),
+        OPT_INTEGER(0, "fb-dump-every", &fb_dump_every, "only dump every n-th frame", nullptr, 0,
+                    0),
+        OPT_BOOLEAN(0, "hle", &hle_enabled,
+                    "run memcpy, memset, strlen, strcmp and malloc/free on the host", nullptr, 0, 0),
+        OPT_BOOLEAN(0, "hle-verify", &hle_verify,
+                    "check emulated memcpy, memset, strlen and strcmp against the host", nullptr, 0,
+                    0),
+        OPT_STRING(0, "record", &record_path, "record nondeterministic inputs to a file", nullptr,
+                   0, 0),
+        OPT_STRING(0, "replay", &replay_path, "replay nondeterministic inputs from a file", nullptr,
+                   0, 0),
+        OPT_STRING(0, "output-buffering", &output_buffering,
+                   "guest output buffering: none, line or full", nullptr, 0, 0),
+        OPT_BOOLEAN(0, "output-thread", &output_thread,
+                    "write guest output from a background thread", nullptr, 0, 0),
+        OPT_STRING(0, "cache-dir", &cache_dir, "directory to cache preprocessed images in",
+                   nullptr, 0, 0),
+        OPT_STRING(0, "restore", &restore_path, "start from a snapshot instead of an executable",
+                   nullptr, 0, 0),
+        OPT_STRING(0, "save-snapshot", &snapshot_path, "save a snapshot to a file and exit",
+                   nullptr, 0, 0),
+        OPT_STRING(0, "snapshot-at", &snapshot_at,
+                   "address or symbol to run up to before saving a snapshot", nullptr, 0, 0),
+        OPT_END(),
     };
 
     struct argparse argparse;
@@ -432,26 +1794,217 @@ int main(int argc, const char *argv[])
     argc = argparse_parse(&argparse, argc, argv);
     set_verbose(verbose);
 
-    if (argc < 1) {
-        argparse_usage(&argparse);
+    ConsoleBuffering buffering = ConsoleBuffering_default();
+
+    if (output_buffering != nullptr && !ConsoleBuffering_parse(output_buffering, &buffering)) {
+        fprintf(stderr, "Invalid output buffering: %s\n", output_buffering);
+        return EXIT_FAILURE;
+    }
+
+    console_init(buffering, output_thread);
+
+    SyscallAbi syscall_abi = SyscallAbi_Spim;
+
+    if (abi != nullptr && !SyscallAbi_parse(abi, &syscall_abi)) {
+        fprintf(stderr, "Invalid syscall ABI: %s\n", abi);
+        return EXIT_FAILURE;
+    }
+
+    set_syscall_abi(syscall_abi);
+
+    if (mhz <= 0) {
+        fprintf(stderr, "Invalid clock speed: %i MHz\n", mhz);
+        return EXIT_FAILURE;
+    }
+
+    set_virtual_time(virtual_time ? (u32)mhz : 0);
+
+    if (record_path != nullptr && replay_path != nullptr) {
+        fprintf(stderr, "Cannot record and replay at the same time\n");
+        return EXIT_FAILURE;
+    }
+
+    // UART input arrives straight from the reader thread, outside of the replay log
+    if ((record_path != nullptr || replay_path != nullptr) &&
+        (uart || uart_base_str != nullptr)) {
+        fprintf(stderr, "--record and --replay do not support --uart\n");
+        return EXIT_FAILURE;
+    }
+
+    hle_enabled = hle_enabled || hle_verify;
+
+    if (reverse && (!listen || record_path != nullptr || replay_path != nullptr || hle_enabled ||
+                    uart || uart_base_str != nullptr || fb_geometry != nullptr)) {
+        fprintf(stderr, "--reverse needs --listen, and does not support --record, --replay, --hle, "
+                        "--uart or --fb\n");
         return EXIT_FAILURE;
     }
 
-    const char *const filename = argv[0];
+    if (sessions < 0 || workers < 0) {
+        fprintf(stderr, "Invalid number of sessions or workers\n");
+        return EXIT_FAILURE;
+    }
 
-    Cpu cpu = Cpu_new();
-    SegmentedMemory mem = SegmentedMemory_new();
+    if (sessions > 0 && (!listen || reverse || record_path != nullptr || replay_path != nullptr ||
+                         hle_enabled || uart || uart_base_str != nullptr ||
+                         fb_geometry != nullptr || output_thread)) {
+        fprintf(stderr, "--sessions needs --listen, and does not support --reverse, --record, "
+                        "--replay, --hle, --uart, --fb or --output-thread\n");
+        return EXIT_FAILURE;
+    }
 
-    if (!load_elf(filename, &cpu, &mem))
+    if (reverse && reverse_interval <= 0) {
+        fprintf(stderr, "Invalid reverse checkpoint interval: %i\n", reverse_interval);
         return EXIT_FAILURE;
+    }
+
+    if (reverse && reverse_limit < 2) {
+        fprintf(stderr, "Invalid reverse checkpoint limit: %i\n", reverse_limit);
+        return EXIT_FAILURE;
+    }
+
+    if (reverse)
+        replay_start_history();
+
+    if (record_path != nullptr && !replay_start_recording(record_path)) {
+        perror("Could not create replay log");
+        return EXIT_FAILURE;
+    }
+
+    if (replay_path != nullptr && !replay_start_replaying(replay_path)) {
+        fprintf(stderr, "Could not open replay log: %s\n", replay_path);
+        return EXIT_FAILURE;
+    }
+
+    u32 heap_start = 0;
+    u32 heap_limit = DEFAULT_HEAP_LIMIT;
+
+    if (heap_start_str != nullptr && !parse_size(heap_start_str, &heap_start)) {
+        fprintf(stderr, "Invalid heap start: %s\n", heap_start_str);
+        return EXIT_FAILURE;
+    }
+
+    if (heap_limit_str != nullptr && !parse_size(heap_limit_str, &heap_limit)) {
+        fprintf(stderr, "Invalid heap limit: %s\n", heap_limit_str);
+        return EXIT_FAILURE;
+    }
+
+    u32 uart_base = UART_DEFAULT_BASE;
+
+    if (uart_base_str != nullptr && !parse_size(uart_base_str, &uart_base)) {
+        fprintf(stderr, "Invalid UART address: %s\n", uart_base_str);
+        return EXIT_FAILURE;
+    }
+
+    uart = uart || uart_base_str != nullptr;
+
+    FbConfig fb_config = {
+        .base = FB_DEFAULT_BASE,
+        .width = 0,
+        .height = 0,
+        .format = FbFormat_Xrgb8888,
+        .shm_path = fb_shm,
+        .dump_prefix = fb_dump,
+        .dump_every = (u32)fb_dump_every,
+    };
+
+    if (fb_geometry != nullptr &&
+        !parse_geometry(fb_geometry, &fb_config.width, &fb_config.height)) {
+        fprintf(stderr, "Invalid framebuffer size: %s\n", fb_geometry);
+        return EXIT_FAILURE;
+    }
+
+    if (fb_base_str != nullptr && !parse_size(fb_base_str, &fb_config.base)) {
+        fprintf(stderr, "Invalid framebuffer address: %s\n", fb_base_str);
+        return EXIT_FAILURE;
+    }
+
+    if (fb_format != nullptr && !FbFormat_parse(fb_format, &fb_config.format)) {
+        fprintf(stderr, "Invalid framebuffer format: %s\n", fb_format);
+        return EXIT_FAILURE;
+    }
+
+    if (fb_dump_every <= 0) {
+        fprintf(stderr, "Invalid frame dump interval: %i\n", fb_dump_every);
+        return EXIT_FAILURE;
+    }
+
+    HostState host = HostState_new();
+    Cpu cpu = Cpu_new(&host);
+    SegmentedMemory mem = {};
+    SymbolTable symbols = SymbolTable_new();
+
+    if (restore_path != nullptr) {
+        if (!restore_snapshot(restore_path, &cpu, &mem))
+            return EXIT_FAILURE;
+
+        if (uart && !uart_attach(&mem, uart_base)) {
+            fprintf(stderr, "UART at 0x%08X overlaps the program\n", uart_base);
+            return EXIT_FAILURE;
+        }
+
+        if (fb_geometry != nullptr && !framebuffer_attach(&mem, &fb_config)) {
+            fprintf(stderr, "Could not map framebuffer at 0x%08X\n", fb_config.base);
+            return EXIT_FAILURE;
+        }
+    } else {
+        if (argc < 1) {
+            argparse_usage(&argparse);
+            return EXIT_FAILURE;
+        }
+
+        if (!load_program(argv[0], cache_dir, &cpu, &mem, &symbols))
+            return EXIT_FAILURE;
+
+        if (uart && !uart_attach(&mem, uart_base)) {
+            fprintf(stderr, "UART at 0x%08X overlaps the program\n", uart_base);
+            return EXIT_FAILURE;
+        }
+
+        if (fb_geometry != nullptr && !framebuffer_attach(&mem, &fb_config)) {
+            fprintf(stderr, "Could not map framebuffer at 0x%08X\n", fb_config.base);
+            return EXIT_FAILURE;
+        }
+
+        if (!SegmentedMemory_init_heap(&mem, heap_start, heap_limit)) {
+            fprintf(stderr, "Heap start 0x%08X overlaps the program\n", heap_start);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (snapshot_path != nullptr) {
+        const int result = save_snapshot(snapshot_path, snapshot_at, &cpu, &mem, &symbols);
+        SegmentedMemory_destroy(&mem);
+        SymbolTable_destroy(&symbols);
+        return result;
+    }
+
+    if (hle_enabled)
+        hle = Hle_new(&symbols, hle_verify, &mem);
 
     int result = -1;
 
-    if (listen)
-        result = run_emulator_with_gdb(&cpu, (Memory *)&mem, port);
+    if (listen && sessions > 0) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        const u32 worker_count = workers > 0 ? (u32)workers : (cpus > 0 ? (u32)cpus : 1);
+
+        result = run_gdb_sessions(&cpu, &mem, port, (u32)sessions, worker_count);
+    } else {
+        if (listen)
+            result = run_emulator_with_gdb(&cpu, &mem, port, reverse ? (u64)reverse_interval : 0,
+                                           (size_t)reverse_limit);
 
-    result = run_emulator(&cpu, (Memory *)&mem);
+        // Once the debugger is done, the guest runs on its own
+        if (!listen || result == EXIT_SUCCESS)
+            result = run_emulator(&cpu, (Memory *)&mem, &symbols);
+    }
+
+    if (hle_enabled) {
+        Hle_print_stats(&hle);
+        Hle_destroy(&hle);
+    }
 
     SegmentedMemory_destroy(&mem);
+    SymbolTable_destroy(&symbols);
     return result;
 }
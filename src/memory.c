@@ -2,9 +2,11 @@
 #include "cpu.h"
 #include "log.h"
 #include "macros.h"
+#include "numeric.h"
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 [[nodiscard]] static const Segment *find_segment(const SegmentedMemory *const mem, const u32 addr)
 {
@@ -26,6 +28,9 @@
     if (seg != nullptr && (seg->perms & SegPerms_Read) == 0)
         BAIL("memory read without permission (0x%08X)", addr);
 
+    if (seg != nullptr && seg->device != nullptr)
+        return seg->device->read(seg->device, addr - seg->addr);
+
     return segmem->data[addr];
 }
 
@@ -51,6 +56,141 @@
     return a | (b << 8) | (c << 16) | (d << 24);
 }
 
+static constexpr size_t PAGE_BITMAP_SIZE = MEMORY_PAGE_COUNT / 64;
+
+/**
+ * \brief Checks that every segment overlapping a range grants some permission.
+ *
+ * Ranges overlapping a device are reported as faults, as device registers have no host memory
+ * behind them.
+ */
+[[nodiscard]] static MemoryResult check_range(const SegmentedMemory *const mem, const u32 addr,
+                                              const u32 size, const SegPerms perm,
+                                              const MemoryResult fault)
+{
+    const u64 end = (u64)addr + size;
+
+    if (end > CPU_ADDRESS_SPACE)
+        return MemoryResult_OutOfBounds;
+
+    for (size_t i = 0; i < mem->segments_size; ++i) {
+        const Segment *const seg = &mem->segments[i];
+
+        if (seg->addr < end && addr < (u64)seg->addr + seg->size &&
+            ((seg->perms & perm) == 0 || seg->device != nullptr))
+            return fault;
+    }
+
+    return MemoryResult_Ok;
+}
+
+MemoryResult SegmentedMemory_debug_write_span(SegmentedMemory *const mem, const u32 addr,
+                                             const u32 size, u8 **const out)
+{
+    static constexpr SegPerms ANY_ACCESS = SegPerms_Read | SegPerms_Write | SegPerms_Execute;
+    const MemoryResult result = check_range(mem, addr, size, ANY_ACCESS, MemoryResult_WriteFault);
+
+    if (result == MemoryResult_Ok) {
+        SegmentedMemory_mark_dirty(mem, addr, size);
+        *out = &mem->data[addr];
+    }
+
+    return result;
+}
+
+[[nodiscard]] static MemoryResult SegmentedMemory_read_span(const Memory *const mem, const u32 addr,
+                                                            const u32 size, const u8 **const out)
+{
+    const SegmentedMemory *const segmem = CONTAINER_OF(mem, SegmentedMemory, mem);
+    const MemoryResult result =
+        check_range(segmem, addr, size, SegPerms_Read, MemoryResult_ReadFault);
+
+    if (result == MemoryResult_Ok)
+        *out = &segmem->data[addr];
+
+    return result;
+}
+
+[[nodiscard]] static MemoryResult SegmentedMemory_write_span(Memory *const mem, const u32 addr,
+                                                             const u32 size, u8 **const out)
+{
+    SegmentedMemory *const segmem = CONTAINER_OF(mem, SegmentedMemory, mem);
+    const MemoryResult result =
+        check_range(segmem, addr, size, SegPerms_Write, MemoryResult_WriteFault);
+
+    if (result == MemoryResult_Ok) {
+        SegmentedMemory_mark_dirty(segmem, addr, size);
+        *out = &segmem->data[addr];
+    }
+
+    return result;
+}
+
+/**
+ * \brief Returns the segment backing the heap, or nullptr if the heap has never grown.
+ */
+[[nodiscard]] static Segment *find_heap_segment(const SegmentedMemory *const mem)
+{
+    if (mem->heap.limit == 0)
+        return nullptr;
+
+    for (size_t i = mem->segments_size; i-- > 0;) {
+        Segment *const seg = &mem->segments[i];
+
+        if (seg->addr == mem->heap.start && seg->perms == (SegPerms_Read | SegPerms_Write))
+            return seg;
+    }
+
+    return nullptr;
+}
+
+static void resize_heap_segment(SegmentedMemory *const mem)
+{
+    Segment *const seg = find_heap_segment(mem);
+    const u32 size = mem->heap.top - mem->heap.start;
+
+    if (seg != nullptr) {
+        seg->size = size;
+    } else if (size != 0) {
+        SegmentedMemory_add_segment(mem, (Segment){
+                                             .addr = mem->heap.start,
+                                             .size = size,
+                                             .perms = SegPerms_Read | SegPerms_Write,
+                                             .device = nullptr,
+                                         });
+    }
+}
+
+[[nodiscard]] static MemoryResult SegmentedMemory_sbrk(Memory *const mem, const i32 increment,
+                                                       u32 *const out)
+{
+    SegmentedMemory *const segmem = CONTAINER_OF(mem, SegmentedMemory, mem);
+    Heap *const heap = &segmem->heap;
+    const i64 new_top = (i64)heap->top + increment;
+
+    if (new_top < heap->start || new_top > heap->limit)
+        return MemoryResult_OutOfBounds;
+
+    // Pages that were never touched are still zero-filled, and are left uncommitted
+    for (size_t addr = heap->top; addr < (size_t)new_top;) {
+        const size_t page = addr / MEMORY_PAGE_SIZE;
+        const size_t end = sz_min((page + 1) * MEMORY_PAGE_SIZE, (size_t)new_top);
+
+        if (SegmentedMemory_page_is_touched(segmem, page)) {
+            memset(&segmem->data[addr], 0, end - addr);
+            SegmentedMemory_mark_dirty(segmem, (u32)addr, (u32)(end - addr));
+        }
+
+        addr = end;
+    }
+
+    *out = heap->top;
+    heap->top = (u32)new_top;
+    resize_heap_segment(segmem);
+
+    return MemoryResult_Ok;
+}
+
 static void SegmentedMemory_write(Memory *const mem, const u32 addr, const u8 value)
 {
     const SegmentedMemory *const segmem = CONTAINER_OF(mem, SegmentedMemory, mem);
@@ -61,11 +201,19 @@ static void SegmentedMemory_write(Memory *const mem, const u32 addr, const u8 va
         if (addr >= seg->addr && addr < seg->addr + seg->size) {
             if ((seg->perms & SegPerms_Write) == 0)
                 BAIL("memory write without permission (0x%08X)", addr);
-            else
-                break;
+
+            if (seg->device != nullptr) {
+                seg->device->write(seg->device, addr - seg->addr, value);
+                return;
+            }
+
+            break;
         }
     }
 
+    const u32 page = addr / MEMORY_PAGE_SIZE;
+    segmem->dirty_pages[page / 64] |= 1ULL << (page % 64);
+
     segmem->data[addr] = value;
 }
 
@@ -84,6 +232,22 @@ void Memory_write(Memory *mem, u32 addr, u8 value)
     mem->write(mem, addr, value);
 }
 
+MemoryResult Memory_read_span(const Memory *const mem, const u32 addr, const u32 size,
+                              const u8 **const out)
+{
+    return mem->read_span(mem, addr, size, out);
+}
+
+MemoryResult Memory_write_span(Memory *const mem, const u32 addr, const u32 size, u8 **const out)
+{
+    return mem->write_span(mem, addr, size, out);
+}
+
+MemoryResult Memory_sbrk(Memory *const mem, const i32 increment, u32 *const out)
+{
+    return mem->sbrk(mem, increment, out);
+}
+
 [[nodiscard]] u16 Memory_read_u16_le(const Memory *const memory, const u32 addr)
 {
     if ((addr % 2) != 0)
@@ -131,18 +295,69 @@ void Memory_write_u32_le(Memory *const mem, const u32 addr, const u32 value)
 
 SegmentedMemory SegmentedMemory_new(void)
 {
-    u8 *const data = malloc(CPU_ADDRESS_SPACE);
+    // Reserve the whole address space up-front. Pages are only committed once touched, and
+    // snapshots can map their own pages over the reservation.
+    u8 *const data = mmap(nullptr, CPU_ADDRESS_SPACE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (data == MAP_FAILED)
+        BAIL("Could not reserve guest address space");
+
+    u64 *const dirty_pages = calloc(PAGE_BITMAP_SIZE, sizeof(*dirty_pages));
+    u64 *const touched_pages = calloc(PAGE_BITMAP_SIZE, sizeof(*touched_pages));
+
+    if (dirty_pages == nullptr || touched_pages == nullptr)
+        BAIL("Could not allocate page bitmaps");
 
     return (SegmentedMemory){
         .mem.read = SegmentedMemory_read,
         .mem.read_instr = SegmentedMemory_read_instr,
         .mem.write = SegmentedMemory_write,
+        .mem.read_span = SegmentedMemory_read_span,
+        .mem.write_span = SegmentedMemory_write_span,
+        .mem.sbrk = SegmentedMemory_sbrk,
         .data = data,
         .segments = nullptr,
         .segments_size = 0,
+        .dirty_pages = dirty_pages,
+        .touched_pages = touched_pages,
+        .heap = {},
     };
 }
 
+SegmentedMemory SegmentedMemory_clone(const SegmentedMemory *const mem)
+{
+    static constexpr u8 ZERO_PAGE[MEMORY_PAGE_SIZE] = {};
+
+    SegmentedMemory clone = SegmentedMemory_new();
+
+    for (size_t page = 0; page < MEMORY_PAGE_COUNT; ++page) {
+        if (!SegmentedMemory_page_is_touched(mem, page))
+            continue;
+
+        const size_t offset = page * MEMORY_PAGE_SIZE;
+
+        // Zero-filled pages, e.g. of .bss, are left uncommitted in the clone
+        if (memcmp(&mem->data[offset], ZERO_PAGE, MEMORY_PAGE_SIZE) != 0)
+            memcpy(&clone.data[offset], &mem->data[offset], MEMORY_PAGE_SIZE);
+    }
+
+    memcpy(clone.dirty_pages, mem->dirty_pages, PAGE_BITMAP_SIZE * sizeof(*clone.dirty_pages));
+    memcpy(clone.touched_pages, mem->touched_pages,
+           PAGE_BITMAP_SIZE * sizeof(*clone.touched_pages));
+
+    clone.segments = malloc(sz_max(mem->segments_size, 1) * sizeof(*clone.segments));
+
+    if (clone.segments == nullptr)
+        BAIL("Could not allocate segments");
+
+    memcpy(clone.segments, mem->segments, mem->segments_size * sizeof(*clone.segments));
+    clone.segments_size = mem->segments_size;
+    clone.heap = mem->heap;
+
+    return clone;
+}
+
 void SegmentedMemory_add_segment(SegmentedMemory *const mem, const Segment seg)
 {
     const size_t new_size = mem->segments_size + 1;
@@ -162,12 +377,165 @@ void SegmentedMemory_add_segment(SegmentedMemory *const mem, const Segment seg)
     ver_printf("perms: %03B\n", seg.perms);
 }
 
+bool SegmentedMemory_range_is_free(const SegmentedMemory *const mem, const u32 addr,
+                                   const u32 size)
+{
+    const u64 end = (u64)addr + size;
+
+    if (end > CPU_ADDRESS_SPACE)
+        return false;
+
+    for (size_t i = 0; i < mem->segments_size; ++i) {
+        const Segment *const seg = &mem->segments[i];
+
+        if (seg->addr < end && addr < (u64)seg->addr + seg->size)
+            return false;
+    }
+
+    return mem->heap.limit == 0 || mem->heap.start >= end || addr >= mem->heap.limit;
+}
+
+bool SegmentedMemory_map_shared(SegmentedMemory *const mem, const u32 addr, const u32 size,
+                                const int fd, const size_t offset)
+{
+    u8 *const contents = malloc(size);
+
+    if (contents == nullptr)
+        BAIL("Could not allocate memory for shared mapping");
+
+    memcpy(contents, &mem->data[addr], size);
+
+    const void *const mapped = mmap(&mem->data[addr], size, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_FIXED, fd, (off_t)offset);
+
+    if (mapped == MAP_FAILED) {
+        free(contents);
+        return false;
+    }
+
+    memcpy(&mem->data[addr], contents, size);
+    free(contents);
+
+    SegmentedMemory_mark_dirty(mem, addr, size);
+    return true;
+}
+
+[[nodiscard]] static bool belongs_to_device(const Segment *const seg)
+{
+    return seg->device != nullptr || (seg->perms & SegPerms_Device) != 0;
+}
+
+bool SegmentedMemory_init_heap(SegmentedMemory *const mem, u32 start, const u32 max_size)
+{
+    size_t segments_end = 0;
+
+    for (size_t i = 0; i < mem->segments_size; ++i) {
+        const Segment *const seg = &mem->segments[i];
+
+        if (!belongs_to_device(seg))
+            segments_end = sz_max(segments_end, (size_t)seg->addr + seg->size);
+    }
+
+    if (start == 0) {
+        const size_t aligned_end =
+            (segments_end + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE * MEMORY_PAGE_SIZE;
+
+        if (aligned_end >= CPU_ADDRESS_SPACE)
+            return false;
+
+        start = (u32)aligned_end;
+    } else if (start < segments_end) {
+        return false;
+    }
+
+    size_t limit = sz_min((size_t)start + max_size, CPU_ADDRESS_SPACE - 1);
+
+    // Devices may sit past the program, in which case the heap stops short of them
+    for (size_t i = 0; i < mem->segments_size; ++i) {
+        const Segment *const seg = &mem->segments[i];
+
+        if (!belongs_to_device(seg))
+            continue;
+
+        if (seg->addr < start + (size_t)MEMORY_PAGE_SIZE && start < (size_t)seg->addr + seg->size)
+            return false;
+
+        if (seg->addr >= start)
+            limit = sz_min(limit, seg->addr);
+    }
+
+    SegmentedMemory_set_heap(mem, (Heap){
+                                      .start = start,
+                                      .top = start,
+                                      .limit = (u32)limit,
+                                  });
+
+    ver_printf("heap: 0x%08X-0x%08X\n", start, (u32)limit);
+    return true;
+}
+
+void SegmentedMemory_set_heap(SegmentedMemory *const mem, const Heap heap)
+{
+    mem->heap = heap;
+    resize_heap_segment(mem);
+}
+
+void SegmentedMemory_mark_dirty(SegmentedMemory *const mem, const u32 addr, const u32 size)
+{
+    if (size == 0)
+        return;
+
+    const size_t first = addr / MEMORY_PAGE_SIZE;
+    const size_t last = ((size_t)addr + size - 1) / MEMORY_PAGE_SIZE;
+
+    for (size_t page = first; page <= last; ++page)
+        mem->dirty_pages[page / 64] |= 1ULL << (page % 64);
+}
+
+bool SegmentedMemory_page_is_dirty(const SegmentedMemory *const mem, const size_t page)
+{
+    return (mem->dirty_pages[page / 64] & (1ULL << (page % 64))) != 0;
+}
+
+void SegmentedMemory_clear_dirty(SegmentedMemory *const mem)
+{
+    for (size_t i = 0; i < PAGE_BITMAP_SIZE; ++i) {
+        mem->touched_pages[i] |= mem->dirty_pages[i];
+        mem->dirty_pages[i] = 0;
+    }
+}
+
+bool SegmentedMemory_page_is_touched(const SegmentedMemory *const mem, const size_t page)
+{
+    if (SegmentedMemory_page_is_dirty(mem, page) ||
+        (mem->touched_pages[page / 64] & (1ULL << (page % 64))) != 0)
+        return true;
+
+    const size_t page_start = page * MEMORY_PAGE_SIZE;
+
+    for (size_t i = 0; i < mem->segments_size; ++i) {
+        const Segment *const seg = &mem->segments[i];
+
+        if (page_start < (size_t)seg->addr + seg->size &&
+            page_start + MEMORY_PAGE_SIZE > seg->addr)
+            return true;
+    }
+
+    return false;
+}
+
 void SegmentedMemory_destroy(SegmentedMemory *const mem)
 {
-    free(mem->data);
+    if (mem->data != nullptr)
+        munmap(mem->data, CPU_ADDRESS_SPACE);
+
     free(mem->segments);
+    free(mem->dirty_pages);
+    free(mem->touched_pages);
 
     mem->data = nullptr;
     mem->segments = nullptr;
     mem->segments_size = 0;
+    mem->dirty_pages = nullptr;
+    mem->touched_pages = nullptr;
 }
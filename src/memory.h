@@ -18,6 +18,9 @@ typedef struct Memory {
     u8 (*read)(const Memory *mem, u32 addr);
     u32 (*read_instr)(const Memory *mem, u32 addr);
     void (*write)(Memory *mem, u32 addr, u8 value);
+    MemoryResult (*read_span)(const Memory *mem, u32 addr, u32 size, const u8 **out);
+    MemoryResult (*write_span)(Memory *mem, u32 addr, u32 size, u8 **out);
+    MemoryResult (*sbrk)(Memory *mem, i32 increment, u32 *out);
 } Memory;
 
 [[nodiscard]] u8 Memory_read(const Memory *mem, u32 addr);
@@ -30,6 +33,51 @@ typedef struct Memory {
 
 void Memory_write(Memory *mem, u32 addr, u8 value);
 
+/**
+ * \brief Validates a whole range for reading and returns it as host memory.
+ *
+ * The returned pointer stays valid until the memory is destroyed, and points to size contiguous
+ * bytes mirroring [addr, addr + size).
+ *
+ * \param mem The memory to read from.
+ * \param addr Start address of the range.
+ * \param size Size of the range.
+ * \param out Will be set to the host address of the range.
+ *
+ * \return MemoryResult_Ok if every byte in the range can be read, an error otherwise.
+ */
+[[nodiscard]] MemoryResult Memory_read_span(const Memory *mem, u32 addr, u32 size,
+                                            const u8 **out);
+
+/**
+ * \brief Validates a whole range for writing and returns it as host memory.
+ *
+ * Same as Memory_read_span(), but the range is checked for write permission and considered
+ * written to.
+ *
+ * \param mem The memory to write to.
+ * \param addr Start address of the range.
+ * \param size Size of the range.
+ * \param out Will be set to the host address of the range.
+ *
+ * \return MemoryResult_Ok if every byte in the range can be written, an error otherwise.
+ */
+[[nodiscard]] MemoryResult Memory_write_span(Memory *mem, u32 addr, u32 size, u8 **out);
+
+/**
+ * \brief Grows or shrinks the guest heap.
+ *
+ * Memory added to the heap always reads as zero, even if the heap had shrunk over it before.
+ *
+ * \param mem The memory whose heap is to be resized.
+ * \param increment Number of bytes to add to the heap. May be zero or negative.
+ * \param out Will be set to the previous end of the heap.
+ *
+ * \return MemoryResult_Ok on success, or MemoryResult_OutOfBounds if the new end would fall
+ * outside the heap region.
+ */
+[[nodiscard]] MemoryResult Memory_sbrk(Memory *mem, i32 increment, u32 *out);
+
 void Memory_write_u16_le(Memory *memory, u32 addr, u16 value);
 
 void Memory_write_u32_le(Memory *memory, u32 addr, u32 value);
@@ -39,25 +87,180 @@ typedef enum SegPerms : u8 {
     SegPerms_Read = 1 << 0,
     SegPerms_Write = 1 << 1,
     SegPerms_Execute = 1 << 2,
+    SegPerms_Device = 1 << 3, // Plain memory owned by a device, like framebuffer pixels
 } SegPerms;
 
+static constexpr u32 MEMORY_PAGE_SIZE = 4096;
+static constexpr size_t MEMORY_PAGE_COUNT = 0x1'0000'0000 / MEMORY_PAGE_SIZE;
+
+typedef struct Device Device;
+
+/**
+ * \brief A memory-mapped device.
+ *
+ * Byte accesses to a segment backed by a device are forwarded to it, with offsets relative to the
+ * start of the segment. Device ranges cannot be accessed through spans.
+ */
+typedef struct Device {
+    u8 (*read)(Device *dev, u32 offset);
+    void (*write)(Device *dev, u32 offset, u8 value);
+} Device;
+
 typedef struct Segment {
     u32 addr;
     u32 size;
     u8 perms;
+    Device *device;
 } Segment;
 
+/**
+ * \brief The region the guest heap lives in.
+ *
+ * The heap spans [start, top) and may grow up to limit. It is backed by a read/write segment
+ * starting at start, which is added once the heap first grows.
+ */
+typedef struct Heap {
+    u32 start;
+    u32 top;
+    u32 limit;
+} Heap;
+
 typedef struct SegmentedMemory {
     Memory mem;
     u8 *data;
     Segment *segments;
     size_t segments_size;
+    u64 *dirty_pages;
+    u64 *touched_pages;
+    Heap heap;
 } SegmentedMemory;
 
 [[nodiscard]] SegmentedMemory SegmentedMemory_new(void);
 
+/**
+ * \brief Makes an independent copy of a SegmentedMemory.
+ *
+ * Only pages that may be non-zero are copied, so the cost scales with the memory in use.
+ * Device segments are shared with the original.
+ */
+[[nodiscard]] SegmentedMemory SegmentedMemory_clone(const SegmentedMemory *mem);
+
 void SegmentedMemory_add_segment(SegmentedMemory *mem, Segment seg);
 
+/**
+ * \brief Validates a range for a debugger write and returns it as host memory.
+ *
+ * Unlike Memory_write_span(), guest permissions are not enforced, so a debugger can load or patch
+ * read-only code and data. Ranges overlapping a device are still refused.
+ *
+ * \param mem The SegmentedMemory to write to.
+ * \param addr Start address of the range.
+ * \param size Size of the range.
+ * \param out Will be set to the host address of the range.
+ *
+ * \return MemoryResult_Ok if the range can be written, an error otherwise.
+ */
+[[nodiscard]] MemoryResult SegmentedMemory_debug_write_span(SegmentedMemory *mem, u32 addr,
+                                                           u32 size, u8 **out);
+
+/**
+ * \brief Returns whether a range is clear of every segment and of the heap region.
+ *
+ * \param mem The SegmentedMemory to query.
+ * \param addr Start address of the range.
+ * \param size Size of the range.
+ *
+ * \return true if nothing is or may later be mapped in the range, false otherwise.
+ */
+[[nodiscard]] bool SegmentedMemory_range_is_free(const SegmentedMemory *mem, u32 addr, u32 size);
+
+/**
+ * \brief Backs a range of guest memory with a shared file mapping.
+ *
+ * The current contents of the range are carried over to the file, so that host processes mapping
+ * the same file see guest writes as they happen.
+ *
+ * \param mem The SegmentedMemory to map into.
+ * \param addr Start address of the range. Must be page-aligned.
+ * \param size Size of the range. Must be a multiple of the page size.
+ * \param fd The file to map, at least offset + size bytes long.
+ * \param offset Offset into the file. Must be page-aligned.
+ *
+ * \return true on success, false if the file could not be mapped.
+ */
+[[nodiscard]] bool SegmentedMemory_map_shared(SegmentedMemory *mem, u32 addr, u32 size, int fd,
+                                              size_t offset);
+
+/**
+ * \brief Sets up an empty heap.
+ *
+ * Heap pages are only committed once the guest touches them, so a generous limit costs nothing
+ * up-front.
+ *
+ * \param mem The SegmentedMemory to set up the heap of.
+ * \param start Start address of the heap, or 0 to start at the first page after every segment.
+ * \param max_size Maximum size of the heap in bytes. Clamped to the end of the address space.
+ *
+ * \return true on success, or false if start lies below the end of an existing segment or on a
+ * device. The heap is shortened to stop before any device mapped above start. Segments flagged
+ * SegPerms_Device count as devices.
+ */
+[[nodiscard]] bool SegmentedMemory_init_heap(SegmentedMemory *mem, u32 start, u32 max_size);
+
+/**
+ * \brief Replaces the heap state, resizing the heap segment to match.
+ *
+ * Unlike Memory_sbrk(), memory contents are left untouched. This is meant for restoring a heap
+ * that was saved together with its pages.
+ *
+ * \param mem The SegmentedMemory whose heap is to be replaced.
+ * \param heap The new heap state.
+ */
+void SegmentedMemory_set_heap(SegmentedMemory *mem, Heap heap);
+
+/**
+ * \brief Marks every page overlapping a range as dirty.
+ *
+ * Writes done through the Memory interface are tracked automatically. This is meant for code that
+ * writes to SegmentedMemory::data directly.
+ *
+ * \param mem The SegmentedMemory that was written to.
+ * \param addr Start address of the written range.
+ * \param size Size of the written range.
+ */
+void SegmentedMemory_mark_dirty(SegmentedMemory *mem, u32 addr, u32 size);
+
+/**
+ * \brief Returns whether a page has been written to since the dirty bits were last cleared.
+ *
+ * \param mem The SegmentedMemory to query.
+ * \param page Index of the page (address / MEMORY_PAGE_SIZE).
+ *
+ * \return true if the page is dirty, false otherwise.
+ */
+[[nodiscard]] bool SegmentedMemory_page_is_dirty(const SegmentedMemory *mem, size_t page);
+
+/**
+ * \brief Clears all dirty bits, remembering the cleared pages as touched.
+ *
+ * \param mem The SegmentedMemory whose dirty bits are to be cleared.
+ *
+ * \sa SegmentedMemory_page_is_touched
+ */
+void SegmentedMemory_clear_dirty(SegmentedMemory *mem);
+
+/**
+ * \brief Returns whether a page has ever been written to or belongs to a segment.
+ *
+ * Pages for which this returns false are guaranteed to still be zero-filled.
+ *
+ * \param mem The SegmentedMemory to query.
+ * \param page Index of the page (address / MEMORY_PAGE_SIZE).
+ *
+ * \return true if the page may hold non-zero data, false otherwise.
+ */
+[[nodiscard]] bool SegmentedMemory_page_is_touched(const SegmentedMemory *mem, size_t page);
+
 void SegmentedMemory_destroy(SegmentedMemory *mem);
 
 #endif
@@ -14,6 +14,16 @@
  */
 [[nodiscard]] size_t sz_max(size_t a, size_t b);
 
+/**
+ * \brief Returns the lesser of two size_t's.
+ *
+ * \param a A number.
+ * \param b Another number.
+ *
+ * \return a if a < b, b otherwise.
+ */
+[[nodiscard]] size_t sz_min(size_t a, size_t b);
+
 /**
  * \brief Returns whether a number is a power of 2 or not.
  *
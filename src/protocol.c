@@ -1,15 +1,24 @@
 #include "protocol.h"
 #include "log.h"
+#include "macros.h"
 #include "stdinc.h"
 #include "str.h"
+#include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 [[nodiscard]] static bool safe_write(const int fd, const void *buf, const size_t count)
@@ -34,7 +43,10 @@
 }
 
 /**
- * \brief Reads data from a BufSock and fills its buffer.
+ * \brief Reads more data from a BufSock into the free end of its buffer.
+ *
+ * Bytes that were already read are dropped first to make room, the others are moved to the start
+ * of the buffer.
  *
  * \param buf_sock The BufSock to read from.
  *
@@ -42,17 +54,30 @@
  */
 [[nodiscard]] static GdbResult BufSock_refill(BufSock *const buf_sock)
 {
-    const ssize_t result =
-        read(buf_sock->sock, buf_sock->buf, buf_sock->buf_capacity * sizeof(*buf_sock->buf));
+    if (buf_sock->buf_head > 0) {
+        memmove(buf_sock->buf, &buf_sock->buf[buf_sock->buf_head],
+                buf_sock->buf_size - buf_sock->buf_head);
+
+        buf_sock->buf_size -= buf_sock->buf_head;
+        buf_sock->buf_head = 0;
+    }
+
+    if (buf_sock->buf_size == buf_sock->buf_capacity)
+        return GdbResult_PacketTooLong;
+
+    const ssize_t result = read(buf_sock->sock, &buf_sock->buf[buf_sock->buf_size],
+                                buf_sock->buf_capacity - buf_sock->buf_size);
 
     if (result == 0)
         return GdbResult_UnexpectedEof;
 
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return GdbResult_WouldBlock;
+
     if (result < 0)
         return GdbResult_ReadError;
 
-    buf_sock->buf_size = result;
-    buf_sock->buf_head = 0;
+    buf_sock->buf_size += result;
 
     return GdbResult_Ok;
 }
@@ -71,54 +96,108 @@
     return GdbResult_Ok;
 }
 
-[[nodiscard]] static GdbResult BufSock_receive_packet(BufSock *const buf_sock, Packet *const dest)
+[[nodiscard]] static u8 hex_digit_value(const char ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return (u8)(ch - '0');
+
+    if (ch >= 'a' && ch <= 'f')
+        return (u8)(ch - 'a' + 10);
+
+    if (ch >= 'A' && ch <= 'F')
+        return (u8)(ch - 'A' + 10);
+
+    return 0;
+}
+
+GdbResult BufSock_receive_packet(BufSock *const buf_sock, Packet *const dest)
 {
-    char ch = '\0';
+    // Offset of the end of the data from the '$', which the head is kept pointing to
+    size_t scanned = 0;
+
+    while (true) {
+        // Acks and anything else outside of packets are skipped
+        while (buf_sock->buf_head < buf_sock->buf_size && buf_sock->buf[buf_sock->buf_head] != '$')
+            ++buf_sock->buf_head;
+
+        if (buf_sock->buf_head < buf_sock->buf_size) {
+            const char *const data = &buf_sock->buf[buf_sock->buf_head + 1];
+            const size_t available = buf_sock->buf_size - buf_sock->buf_head - 1;
+            const char *const end = memchr(data + scanned, '#', available - scanned);
+
+            // The checksum has to be there too
+            if (end != nullptr && (size_t)(end - data) + 2 < available) {
+                const size_t size = end - data;
+
+                *dest = (Packet){
+                    .data = {.data = data, .size = size},
+                    .checksum = (u8)((hex_digit_value(end[1]) << 4) | hex_digit_value(end[2])),
+                };
+
+                buf_sock->buf[buf_sock->buf_head + 1 + size] = '\0';
+                buf_sock->buf_head += size + 4;
+                return GdbResult_Ok;
+            }
 
-    while (ch != '$') {
+            scanned = end != nullptr ? (size_t)(end - data) : available;
+        }
 
-        const GdbResult result = BufSock_read_buf(buf_sock, &ch);
+        const GdbResult result = BufSock_refill(buf_sock);
         if (result != GdbResult_Ok)
             return result;
     }
+}
 
-    String data = String_new();
+/**
+ * \brief Writes a packet, preceded by the pending acknowledgement if there is one, in a single
+ * system call.
+ */
+[[nodiscard]] static bool write_packet(BufSock *const client, const String *const data,
+                                       const char trailer[3])
+{
+    const bool ack = client->ack_pending;
+    char *const prefix = ack ? "+$" : "$";
 
-    while (true) {
-        const GdbResult result = BufSock_read_buf(buf_sock, &ch);
-        if (result != GdbResult_Ok) {
-            String_destroy(&data);
-            return result;
-        }
+    struct iovec iov[3] = {
+        {.iov_base = prefix, .iov_len = ack ? 2 : 1},
+        {.iov_base = data->data, .iov_len = data->size},
+        {.iov_base = (void *)trailer, .iov_len = 3},
+    };
 
-        if (ch == '#')
-            break;
+    size_t remaining = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+    struct iovec *next = iov;
 
-        String_push(&data, ch);
-    }
+    while (remaining > 0) {
+        const ssize_t written = writev(client->sock, next, (int)(&iov[3] - next));
+        if (written < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+                continue;
 
-    char checksum_str[3] = {};
+            return false;
+        }
 
-    GdbResult result = BufSock_read_buf(buf_sock, &checksum_str[0]);
-    if (result != GdbResult_Ok) {
-        String_destroy(&data);
-        return result;
-    }
+        remaining -= written;
+
+        // Skip whatever was written, in case it was only partially
+        size_t skip = written;
+
+        while (remaining > 0 && skip >= next->iov_len) {
+            skip -= next->iov_len;
+            ++next;
+        }
 
-    result = BufSock_read_buf(buf_sock, &checksum_str[1]);
-    if (result != GdbResult_Ok) {
-        String_destroy(&data);
-        return result;
+        if (remaining > 0) {
+            next->iov_base = (char *)next->iov_base + skip;
+            next->iov_len -= skip;
+        }
     }
 
-    *dest = (Packet){
-        .data = data,
-        .checksum = strtol(checksum_str, nullptr, 16),
-    };
-    return GdbResult_Ok;
+    client->ack_pending = false;
+    return true;
 }
 
-[[nodiscard]] static GdbResult wait_for_ack(BufSock *const client, const String *const raw_packet)
+[[nodiscard]] static GdbResult wait_for_ack(BufSock *const client, const String *const data,
+                                            const char trailer[3])
 {
     while (true) {
         char ch = '\0';
@@ -132,7 +211,7 @@
 
         if (ch == '-') {
             // Resend packet
-            if (!safe_write(client->sock, raw_packet->data, raw_packet->size))
+            if (!write_packet(client, data, trailer))
                 return GdbResult_WriteError;
         }
     }
@@ -143,26 +222,19 @@
 [[nodiscard]] static GdbResult
 GdbServer_send_response(GdbServer *const server, BufSock *const client, const String *const data)
 {
-    ver_printf("Response: %s\n", data->data);
+    static constexpr char HEX_DIGITS[] = "0123456789abcdef";
 
-    const u8 checksum = data_checksum(data);
+    ver_printf("Response: %s\n", data->data);
 
-    String raw_packet = String_with_capacity(data->size + 4);
-    String_push(&raw_packet, '$');
-    String_push_str(&raw_packet, *data);
-    String_push(&raw_packet, '#');
-    String_push_hex(&raw_packet, checksum);
+    const u8 checksum = data_checksum(data->data, data->size);
+    const char trailer[3] = {'#', HEX_DIGITS[checksum >> 4], HEX_DIGITS[checksum & 0xF]};
 
-    if (!safe_write(client->sock, raw_packet.data, raw_packet.size))
+    if (!write_packet(client, data, trailer))
         return GdbResult_WriteError;
 
-    if (!server->no_ack_mode) {
-        GdbResult result = wait_for_ack(client, &raw_packet);
-        if (result != GdbResult_Ok)
-            return result;
-    }
+    if (!server->no_ack_mode)
+        return wait_for_ack(client, data, trailer);
 
-    String_destroy(&raw_packet);
     return GdbResult_Ok;
 }
 
@@ -183,6 +255,10 @@ char *GdbResult_display(const GdbResult result)
         return "Error listening on address.";
     case GdbResult_WriteError:
         return "Error writing to socket.";
+    case GdbResult_PacketTooLong:
+        return "Client sent a packet that is too long.";
+    case GdbResult_WouldBlock:
+        return "Socket has no data yet.";
     default:
         return "Invalid result value.";
     }
@@ -196,14 +272,15 @@ BufSock BufSock_new(const int sock, const size_t buf_capacity)
         .buf_capacity = buf_capacity,
         .buf_size = 0,
         .buf_head = 0,
+        .ack_pending = false,
     };
 
     return buf_sock;
 }
 
-GdbResult BufSock_try_read_buf(BufSock *const buf_sock, char *const out)
+bool BufSock_try_read_buf(BufSock *const buf_sock, char *const out)
 {
-    if (buf_sock->buf_head >= buf_sock->buf_capacity) {
+    if (buf_sock->buf_head >= buf_sock->buf_size) {
         struct pollfd pfd = {
             .fd = buf_sock->sock,
             .events = POLLIN,
@@ -214,9 +291,8 @@ GdbResult BufSock_try_read_buf(BufSock *const buf_sock, char *const out)
         if (ret <= 0 || ((pfd.revents & POLLIN) == 0))
             return false;
 
-        const GdbResult refill_result = BufSock_refill(buf_sock);
-        if (refill_result != GdbResult_Ok)
-            return refill_result;
+        if (BufSock_refill(buf_sock) != GdbResult_Ok)
+            return false;
     }
 
     *out = buf_sock->buf[buf_sock->buf_head];
@@ -225,6 +301,77 @@ GdbResult BufSock_try_read_buf(BufSock *const buf_sock, char *const out)
     return true;
 }
 
+bool BufSock_has_buffered(const BufSock *const buf_sock)
+{
+    return buf_sock->buf_head < buf_sock->buf_size;
+}
+
+bool BufSock_flush_ack(BufSock *const buf_sock)
+{
+    if (!buf_sock->ack_pending)
+        return true;
+
+    buf_sock->ack_pending = false;
+    return safe_write(buf_sock->sock, "+", 1);
+}
+
+static void *SockWatcher_main(void *const arg)
+{
+    SockWatcher *const watcher = arg;
+
+    struct pollfd pfds[2] = {
+        {.fd = watcher->sock, .events = POLLIN, .revents = 0},
+        {.fd = watcher->wake_pipe[0], .events = POLLIN, .revents = 0},
+    };
+
+    while (poll(pfds, 2, -1) < 0) {
+        if (errno != EINTR)
+            return nullptr;
+    }
+
+    // Hangups and errors count as readable too, so that they are noticed by the next read
+    if (pfds[0].revents != 0)
+        atomic_store_explicit(&watcher->readable, true, memory_order_release);
+
+    return nullptr;
+}
+
+bool SockWatcher_start(SockWatcher *const watcher, const int sock)
+{
+    watcher->sock = sock;
+    atomic_init(&watcher->readable, false);
+
+    if (pipe(watcher->wake_pipe) != 0)
+        return false;
+
+    const int err = pthread_create(&watcher->thread, nullptr, SockWatcher_main, watcher);
+
+    if (err != 0) {
+        close(watcher->wake_pipe[0]);
+        close(watcher->wake_pipe[1]);
+        errno = err;
+        return false;
+    }
+
+    return true;
+}
+
+bool SockWatcher_readable(const SockWatcher *const watcher)
+{
+    return atomic_load_explicit(&watcher->readable, memory_order_relaxed);
+}
+
+void SockWatcher_stop(SockWatcher *const watcher)
+{
+    if (!safe_write(watcher->wake_pipe[1], "", 1))
+        BAIL("Could not wake socket watcher");
+
+    pthread_join(watcher->thread, nullptr);
+
+    close(watcher->wake_pipe[0]);
+    close(watcher->wake_pipe[1]);
+}
+
 void BufSock_destroy(BufSock *const buf_sock)
 {
     free(buf_sock->buf);
@@ -251,15 +398,14 @@ bool GdbServer_new(const PacketHandler handler, void *const ctx, GdbServer *cons
         .handler = handler,
         .ctx = ctx,
         .quit = false,
+        .deferred = false,
     };
 
     return true;
 }
 
-bool GdbServer_listen(GdbServer *const server, const u16 port)
+bool GdbServer_listen(GdbServer *const server, const u16 port, const int backlog)
 {
-    static constexpr int MAX_CONNECTIONS = 1;
-
     server->addr = (struct sockaddr_in){
         .sin_family = AF_INET,
         .sin_addr = {.s_addr = INADDR_ANY},
@@ -269,7 +415,7 @@ bool GdbServer_listen(GdbServer *const server, const u16 port)
     if (bind(server->sock, (struct sockaddr *)&server->addr, sizeof(server->addr)) < 0)
         return false;
 
-    if (listen(server->sock, MAX_CONNECTIONS) < 0)
+    if (listen(server->sock, backlog) < 0)
         return false;
 
     server->listening = true;
@@ -284,54 +430,406 @@ int GdbServer_accept_connection(GdbServer *const server, struct sockaddr_in *con
 
 GdbResult GdbServer_handle_client(GdbServer *const server, const int client_sock)
 {
-    static constexpr size_t CLIENT_BUF_CAPACITY = 128;
+    // Room for the largest packet along with its framing, and whatever GDB sends right after it
+    static constexpr size_t CLIENT_BUF_CAPACITY = GDB_PACKET_SIZE + 64;
+
+    // Responses are small and sent one at a time, so they should not wait for more data
+    const int yes = true;
+    setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
 
     BufSock client = BufSock_new(client_sock, CLIENT_BUF_CAPACITY);
+    String response = String_with_capacity(GDB_PACKET_SIZE);
+    GdbResult result = GdbResult_Ok;
 
     while (!server->quit) {
         Packet packet = {};
-        GdbResult result = BufSock_receive_packet(&client, &packet);
+        result = BufSock_receive_packet(&client, &packet);
 
-        if (result != GdbResult_Ok) {
-            BufSock_destroy(&client);
-            return result;
-        }
+        if (result != GdbResult_Ok)
+            break;
 
         if (!server->no_ack_mode) {
-            const u8 computed_checksum = data_checksum(&packet.data);
+            const u8 computed_checksum = data_checksum(packet.data.data, packet.data.size);
 
             if (computed_checksum != packet.checksum) {
-                Packet_destroy(&packet);
-
-                if (!safe_write(client_sock, "-", 1)) // NACK
-                    return GdbResult_WriteError;
+                if (!safe_write(client_sock, "-", 1)) { // NACK
+                    result = GdbResult_WriteError;
+                    break;
+                }
 
                 continue;
             }
+
+            // Sent along with the response
+            client.ack_pending = true;
         }
 
         ver_printf("=======================================\n");
         ver_printf("Packet: '%s'\n", packet.data.data);
 
-        if (!server->no_ack_mode)
-            if (!safe_write(client_sock, "+", 1)) // NACK
-                return GdbResult_WriteError;
+        String_truncate(&response, 0);
+        server->handler(server->ctx, &packet, server, &client, &response);
+
+        result = GdbServer_send_response(server, &client, &response);
+
+        if (result != GdbResult_Ok)
+            break;
+    }
+
+    if (result == GdbResult_Ok)
+        close(client.sock);
+
+    String_destroy(&response);
+    BufSock_destroy(&client);
+    return result;
+}
+
+/**
+ * \brief A client of a multi-session server.
+ *
+ * A session is owned by a single thread at a time: the event loop while its socket is armed in
+ * epoll, or a worker while it is queued or being worked on.
+ */
+typedef struct Session {
+    GdbServer conn;
+    BufSock client;
+    String response;
+    void *ctx;
+    bool running; // The target was resumed and has not stopped yet
+    struct Session *next;
+} Session;
+
+typedef struct SessionServer {
+    GdbServer *server;
+    const SessionHooks *hooks;
+    int epoll_fd;
+    pthread_mutex_t lock;
+    pthread_cond_t queue_ready;
+    Session *queue_head; // Sessions waiting for a worker, in order
+    Session *queue_tail;
+    u32 sessions_size;
+} SessionServer;
+
+static void SessionServer_push(SessionServer *const self, Session *const session)
+{
+    pthread_mutex_lock(&self->lock);
+
+    session->next = nullptr;
+
+    if (self->queue_tail != nullptr)
+        self->queue_tail->next = session;
+    else
+        self->queue_head = session;
+
+    self->queue_tail = session;
+
+    pthread_cond_signal(&self->queue_ready);
+    pthread_mutex_unlock(&self->lock);
+}
+
+[[nodiscard]] static Session *SessionServer_pop(SessionServer *const self)
+{
+    pthread_mutex_lock(&self->lock);
+
+    while (self->queue_head == nullptr)
+        pthread_cond_wait(&self->queue_ready, &self->lock);
+
+    Session *const session = self->queue_head;
+    self->queue_head = session->next;
+
+    if (self->queue_head == nullptr)
+        self->queue_tail = nullptr;
+
+    pthread_mutex_unlock(&self->lock);
+    return session;
+}
+
+static void SessionServer_close(SessionServer *const self, Session *const session)
+{
+    epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, session->client.sock, nullptr);
+    close(session->client.sock);
 
-        String response_data = server->handler(server->ctx, &packet, server, &client);
-        result = GdbServer_send_response(server, &client, &response_data);
+    self->hooks->close(session->ctx);
+    BufSock_destroy(&session->client);
+    String_destroy(&session->response);
+    free(session);
 
-        Packet_destroy(&packet);
-        String_destroy(&response_data);
+    pthread_mutex_lock(&self->lock);
+    --self->sessions_size;
+    pthread_mutex_unlock(&self->lock);
+
+    ver_printf("Session closed\n");
+}
+
+/**
+ * \brief Hands a session back to the event loop, until more data arrives.
+ */
+static void SessionServer_arm(SessionServer *const self, Session *const session)
+{
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLONESHOT,
+        .data = {.ptr = session},
+    };
+
+    if (epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, session->client.sock, &event) != 0)
+        SessionServer_close(self, session);
+}
+
+/**
+ * \brief Reads whatever the client sent while its target was running.
+ *
+ * \return The result of the read, with interrupted set if an interrupt (Ctrl-C) was among it.
+ */
+[[nodiscard]] static GdbResult Session_poll_interrupt(Session *const session,
+                                                      bool *const interrupted)
+{
+    BufSock *const client = &session->client;
+    GdbResult result = BufSock_refill(client);
+
+    *interrupted = false;
+
+    while (result == GdbResult_Ok) {
+        *interrupted = *interrupted ||
+                       memchr(&client->buf[client->buf_head], 0x03,
+                              client->buf_size - client->buf_head) != nullptr;
+
+        // Nothing else is expected until the target stops
+        client->buf_head = client->buf_size;
+        result = BufSock_refill(client);
+    }
+
+    return result == GdbResult_WouldBlock ? GdbResult_Ok : result;
+}
+
+[[nodiscard]] static GdbResult Session_send(Session *const session)
+{
+    const u8 checksum = data_checksum(session->response.data, session->response.size);
+    char trailer[4] = {};
+
+    snprintf(trailer, sizeof(trailer), "#%02x", checksum);
+
+    ver_printf("Response: %s\n", session->response.data);
+
+    return write_packet(&session->client, &session->response, trailer) ? GdbResult_Ok
+                                                                        : GdbResult_WriteError;
+}
+
+/**
+ * \brief Handles the packets a session has received, or runs its target for one time slice.
+ */
+static void SessionServer_work(SessionServer *const self, Session *const session)
+{
+    if (session->running) {
+        bool interrupted = false;
+
+        if (Session_poll_interrupt(session, &interrupted) != GdbResult_Ok) {
+            SessionServer_close(self, session);
+            return;
+        }
+
+        String_truncate(&session->response, 0);
+
+        if (!self->hooks->resume(session->ctx, interrupted, &session->conn, &session->response)) {
+            SessionServer_push(self, session);
+            return;
+        }
+
+        session->running = false;
+
+        if (Session_send(session) != GdbResult_Ok || session->conn.quit) {
+            SessionServer_close(self, session);
+            return;
+        }
+    }
+
+    while (true) {
+        Packet packet = {};
+        const GdbResult result = BufSock_receive_packet(&session->client, &packet);
+
+        if (result == GdbResult_WouldBlock) {
+            SessionServer_arm(self, session);
+            return;
+        }
 
         if (result != GdbResult_Ok) {
-            BufSock_destroy(&client);
-            return result;
+            SessionServer_close(self, session);
+            return;
+        }
+
+        ver_printf("=======================================\n");
+        ver_printf("Packet: '%s'\n", packet.data.data);
+
+        session->client.ack_pending = !session->conn.no_ack_mode;
+        session->conn.deferred = false;
+
+        String_truncate(&session->response, 0);
+        self->hooks->handler(session->ctx, &packet, &session->conn, &session->client,
+                             &session->response);
+
+        if (session->conn.deferred) {
+            if (!BufSock_flush_ack(&session->client)) {
+                SessionServer_close(self, session);
+                return;
+            }
+
+            session->running = true;
+            SessionServer_push(self, session);
+            return;
+        }
+
+        if (Session_send(session) != GdbResult_Ok || session->conn.quit) {
+            SessionServer_close(self, session);
+            return;
         }
     }
+}
 
-    close(client.sock);
-    BufSock_destroy(&client);
-    return GdbResult_Ok;
+static void *SessionServer_worker_main(void *const arg)
+{
+    SessionServer *const self = arg;
+
+    while (true)
+        SessionServer_work(self, SessionServer_pop(self));
+
+    return nullptr;
+}
+
+/**
+ * \brief Accepts a new connection and opens a session for it.
+ */
+static void SessionServer_accept(SessionServer *const self, const u32 max_sessions)
+{
+    // Room for the largest packet along with its framing, and whatever GDB sends right after it
+    static constexpr size_t CLIENT_BUF_CAPACITY = GDB_PACKET_SIZE + 64;
+
+    struct sockaddr_in client_addr = {};
+    socklen_t addr_len = sizeof(client_addr);
+
+    const int client_sock =
+        accept(self->server->sock, (struct sockaddr *)&client_addr, &addr_len);
+
+    if (client_sock < 0)
+        return;
+
+    // Workers must never block on a read, which would hold up every queued session
+    if (fcntl(client_sock, F_SETFL, fcntl(client_sock, F_GETFL) | O_NONBLOCK) != 0) {
+        close(client_sock);
+        return;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    const bool full = self->sessions_size >= max_sessions;
+
+    if (!full)
+        ++self->sessions_size;
+
+    pthread_mutex_unlock(&self->lock);
+
+    if (full) {
+        fprintf(stderr, "Refusing connection from %s, too many sessions\n",
+                inet_ntoa(client_addr.sin_addr));
+        close(client_sock);
+        return;
+    }
+
+    const int yes = true;
+    setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+    Session *const session = malloc(sizeof(*session));
+
+    if (session == nullptr)
+        BAIL("Could not allocate session");
+
+    *session = (Session){
+        .conn = *self->server,
+        .client = BufSock_new(client_sock, CLIENT_BUF_CAPACITY),
+        .response = String_with_capacity(GDB_PACKET_SIZE),
+        .ctx = self->hooks->open(self->hooks->arg),
+        .running = false,
+        .next = nullptr,
+    };
+
+    session->conn.no_ack_mode = false;
+    session->conn.quit = false;
+    session->conn.deferred = false;
+
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLONESHOT,
+        .data = {.ptr = session},
+    };
+
+    if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, client_sock, &event) != 0) {
+        SessionServer_close(self, session);
+        return;
+    }
+
+    printf("Session opened for %s\n", inet_ntoa(client_addr.sin_addr));
+}
+
+bool GdbServer_serve_sessions(GdbServer *const server, const SessionHooks *const hooks,
+                              const u32 max_sessions, const u32 workers)
+{
+    static constexpr int MAX_EVENTS = 64;
+
+    // Workers only ever exit with the process, so this is never destroyed
+    static SessionServer self = {};
+
+    self = (SessionServer){
+        .server = server,
+        .hooks = hooks,
+        .epoll_fd = epoll_create1(EPOLL_CLOEXEC),
+        .lock = {},
+        .queue_ready = {},
+        .queue_head = nullptr,
+        .queue_tail = nullptr,
+        .sessions_size = 0,
+    };
+
+    if (self.epoll_fd < 0)
+        return false;
+
+    pthread_mutex_init(&self.lock, nullptr);
+    pthread_cond_init(&self.queue_ready, nullptr);
+
+    // The listening socket is the only one registered without a session
+    struct epoll_event listen_event = {
+        .events = EPOLLIN,
+        .data = {.ptr = nullptr},
+    };
+
+    if (epoll_ctl(self.epoll_fd, EPOLL_CTL_ADD, server->sock, &listen_event) != 0)
+        return false;
+
+    for (u32 i = 0; i < workers; ++i) {
+        pthread_t thread;
+        const int err = pthread_create(&thread, nullptr, SessionServer_worker_main, &self);
+
+        if (err != 0) {
+            errno = err;
+            return false;
+        }
+
+        pthread_detach(thread);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        const int count = epoll_wait(self.epoll_fd, events, MAX_EVENTS, -1);
+
+        if (count < 0 && errno == EINTR)
+            continue;
+
+        if (count < 0)
+            return false;
+
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.ptr == nullptr)
+                SessionServer_accept(&self, max_sessions);
+            else
+                SessionServer_push(&self, events[i].data.ptr);
+        }
+    }
 }
 
 void GdbServer_set_no_ack_mode(GdbServer *const server, const bool no_ack_mode)
@@ -339,6 +837,11 @@ void GdbServer_set_no_ack_mode(GdbServer *const server, const bool no_ack_mode)
     server->no_ack_mode = no_ack_mode;
 }
 
+void GdbServer_defer_response(GdbServer *const server)
+{
+    server->deferred = true;
+}
+
 void GdbServer_destroy(GdbServer *const server)
 {
     if (!server->listening)
@@ -348,18 +851,12 @@ void GdbServer_destroy(GdbServer *const server)
     close(server->sock);
 }
 
-void Packet_destroy(Packet *const packet)
-{
-    String_destroy(&packet->data);
-    packet->checksum = 0;
-}
-
-u8 data_checksum(const String *const s)
+u8 data_checksum(const char *const data, const size_t size)
 {
     u8 checksum = 0;
 
-    for (size_t i = 0; i < s->size; ++i)
-        checksum += (u8)s->data[i];
+    for (size_t i = 0; i < size; ++i)
+        checksum += (u8)data[i];
 
     return checksum;
 }
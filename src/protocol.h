@@ -4,11 +4,22 @@
 #include "stdinc.h"
 #include "str.h"
 #include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <sys/socket.h>
 
+// Largest packet GDB may send, and the largest response we build
+static constexpr size_t GDB_PACKET_SIZE = 0x20000;
+
+/**
+ * \brief A packet received from GDB.
+ *
+ * The data points into the receive buffer of the connection and is NUL-terminated, so it only
+ * stays valid until the next read from that connection.
+ */
 typedef struct Packet {
-    String data;
+    StrView data;
     u8 checksum;
 } Packet;
 
@@ -18,8 +29,22 @@ typedef struct BufSock {
     size_t buf_capacity;
     size_t buf_size;
     size_t buf_head;
+    bool ack_pending; // The last packet was not acknowledged yet
 } BufSock;
 
+/**
+ * \brief Watches a socket for incoming data from a background thread.
+ *
+ * This lets the target run without checking the socket itself, which would take a system call
+ * every time.
+ */
+typedef struct SockWatcher {
+    pthread_t thread;
+    int sock;
+    int wake_pipe[2];
+    atomic_bool readable;
+} SockWatcher;
+
 typedef enum GdbResult : u8 {
     GdbResult_Ok = 0,
     GdbResult_UnexpectedEof,
@@ -28,13 +53,46 @@ typedef enum GdbResult : u8 {
     GdbResult_BindError,
     GdbResult_ListenError,
     GdbResult_WriteError,
+    GdbResult_PacketTooLong,
+    GdbResult_WouldBlock,
 } GdbResult;
 
 typedef struct GdbServer GdbServer;
 
-typedef String (*PacketHandler)(void *ctx, const Packet *const packet, GdbServer *server,
-                                BufSock *client);
+/**
+ * \brief Handles a packet by appending the response to out, which starts out empty.
+ */
+typedef void (*PacketHandler)(void *ctx, const Packet *packet, GdbServer *server, BufSock *client,
+                              String *out);
+
+/**
+ * \brief Runs a target resumed by a deferred packet for a while.
+ *
+ * \param ctx The context of the session.
+ * \param interrupted Whether the client asked to stop the target.
+ * \param server The connection state of the session.
+ * \param out The stop reply is appended to it once the target stops.
+ *
+ * \return true once the target has stopped, false if it should be resumed again later.
+ */
+typedef bool (*ResumeHandler)(void *ctx, bool interrupted, GdbServer *server, String *out);
+
+/**
+ * \brief Callbacks used to serve many sessions at once, each with its own target.
+ */
+typedef struct SessionHooks {
+    void *(*open)(void *arg); // Creates the context of a new session
+    void (*close)(void *ctx);
+    PacketHandler handler;
+    ResumeHandler resume;
+    void *arg;
+} SessionHooks;
 
+/**
+ * \brief A listening socket, and the protocol state of a connection.
+ *
+ * Every session of a multi-session server gets its own copy, which is what packet handlers see.
+ */
 struct GdbServer {
     int sock;
     struct sockaddr_in addr;
@@ -43,6 +101,7 @@ struct GdbServer {
     PacketHandler handler;
     void *ctx;
     bool quit;
+    bool deferred; // The handler resumed the target and will reply from the resume hook
 };
 
 char *GdbResult_display(GdbResult result);
@@ -51,7 +110,63 @@ char *GdbResult_display(GdbResult result);
 
 void BufSock_destroy(BufSock *buf_sock);
 
-[[nodiscard]] GdbResult BufSock_try_read_buf(BufSock *buf_sock, char *out);
+/**
+ * \brief Receives the next packet, leaving its data in place in the buffer of the BufSock.
+ *
+ * The '#' ending the data is replaced by a NUL terminator. Nothing is consumed until a whole
+ * packet has arrived, so a non-blocking socket can be read from again after GdbResult_WouldBlock.
+ *
+ * \param buf_sock The BufSock to read from.
+ * \param dest Will be set to the packet received.
+ *
+ * \return The result of the operation, GdbResult_PacketTooLong if a packet does not fit in the
+ * buffer.
+ */
+[[nodiscard]] GdbResult BufSock_receive_packet(BufSock *buf_sock, Packet *dest);
+
+/**
+ * \brief Reads a byte from a BufSock if one is available without blocking.
+ *
+ * \param buf_sock The BufSock to read from.
+ * \param out Will be set to the byte read.
+ *
+ * \return true if a byte was read, false if none was available or the socket failed.
+ */
+[[nodiscard]] bool BufSock_try_read_buf(BufSock *buf_sock, char *out);
+
+/**
+ * \brief Returns whether a BufSock has buffered bytes that were not read yet.
+ */
+[[nodiscard]] bool BufSock_has_buffered(const BufSock *buf_sock);
+
+/**
+ * \brief Acknowledges the last packet right away instead of along with its response.
+ *
+ * Meant for packets whose response may take a while, so that GDB does not time out.
+ *
+ * \return true if successful, false if the socket failed.
+ */
+[[nodiscard]] bool BufSock_flush_ack(BufSock *buf_sock);
+
+/**
+ * \brief Starts watching a socket until data arrives on it or the watcher is stopped.
+ *
+ * \param watcher The SockWatcher to start.
+ * \param sock The socket to watch.
+ *
+ * \return true if successful, false otherwise. If false, errno will be set.
+ */
+[[nodiscard]] bool SockWatcher_start(SockWatcher *watcher, int sock);
+
+/**
+ * \brief Returns whether data has arrived on the watched socket. Safe to call at any rate.
+ */
+[[nodiscard]] bool SockWatcher_readable(const SockWatcher *watcher);
+
+/**
+ * \brief Stops a SockWatcher and waits for its thread to finish.
+ */
+void SockWatcher_stop(SockWatcher *watcher);
 
 /**
  * \brief Initializes a new GdbServer.
@@ -69,10 +184,11 @@ void BufSock_destroy(BufSock *buf_sock);
  *
  * \param server GdbServer to start listening
  * \param port Port to listen on.
+ * \param backlog Number of pending connections to queue up.
  *
  * \return true if successful, false otherwise. If false, errno will be set.
  */
-[[nodiscard]] bool GdbServer_listen(GdbServer *server, u16 port);
+[[nodiscard]] bool GdbServer_listen(GdbServer *server, u16 port, int backlog);
 
 /**
  * \brief Accepts the next connection to a GdbServer.
@@ -90,12 +206,33 @@ void BufSock_destroy(BufSock *buf_sock);
 
 [[nodiscard]] GdbResult GdbServer_handle_client(GdbServer *server, int client_sock);
 
+/**
+ * \brief Serves every connection to a listening GdbServer, each in its own session.
+ *
+ * All sockets are multiplexed with epoll, and packets are handled by a pool of worker threads.
+ * A packet handler that resumes the target calls GdbServer_defer_response(), after which the
+ * target runs in time slices through the resume hook, so that sessions running forever do not
+ * starve the others. Sessions do not wait for acks, TCP is reliable enough.
+ *
+ * \param server The listening GdbServer.
+ * \param hooks The callbacks creating and driving sessions.
+ * \param max_sessions Connections beyond this many concurrent sessions are closed right away.
+ * \param workers Number of worker threads.
+ *
+ * \return Only returns on failure, with errno set.
+ */
+[[nodiscard]] bool GdbServer_serve_sessions(GdbServer *server, const SessionHooks *hooks,
+                                            u32 max_sessions, u32 workers);
+
 void GdbServer_set_no_ack_mode(GdbServer *server, bool no_ack_mode);
 
-void GdbServer_destroy(GdbServer *server);
+/**
+ * \brief Leaves the response to the current packet to the resume hook of a session.
+ */
+void GdbServer_defer_response(GdbServer *server);
 
-[[nodiscard]] u8 data_checksum(const String *s);
+void GdbServer_destroy(GdbServer *server);
 
-void Packet_destroy(Packet *packet);
+[[nodiscard]] u8 data_checksum(const char *data, size_t size);
 
 #endif
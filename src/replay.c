@@ -0,0 +1,391 @@
+#include "replay.h"
+#include "cpu.h"
+#include "macros.h"
+#include "memory.h"
+#include "numeric.h"
+#include "stdinc.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static constexpr char REPLAY_MAGIC[8] = "RV32RPLY";
+static constexpr u32 REPLAY_VERSION = 1;
+static constexpr size_t REPLAY_BUF_SIZE = 1 << 20;
+
+// Every event is laid out as a type byte, the LEB128-encoded number of instructions retired since
+// the previous event, the LEB128-encoded payload size and the payload itself.
+typedef struct ReplayHeader {
+    char magic[8];
+    u32 version;
+} ReplayHeader;
+
+static ReplayMode mode = ReplayMode_Off;
+static FILE *log_file = nullptr;
+static u64 last_instret = 0;
+
+// The next event is read ahead while replaying, so that replay_inject() can cheaply tell whether
+// anything is due.
+static bool next_valid = false;
+static ReplayEvent next_type = ReplayEvent_Input;
+static u64 next_instret = 0;
+static u8 *next_data = nullptr;
+static size_t next_size = 0;
+static size_t next_capacity = 0;
+
+typedef struct HistoryEvent {
+    u64 instret;
+    size_t offset; // Offset of the payload within history_data
+    size_t size;
+    ReplayEvent type;
+} HistoryEvent;
+
+// Events kept in memory under ReplayMode_History, in the order they happened
+static HistoryEvent *history = nullptr;
+static size_t history_size = 0;
+static size_t history_capacity = 0;
+static u8 *history_data = nullptr;
+static size_t history_data_size = 0;
+static size_t history_data_capacity = 0;
+
+// Index of the next event to read ahead from history, history_size once caught up
+static size_t history_pos = 0;
+
+static void close_log(void)
+{
+    if (log_file != nullptr)
+        fclose(log_file);
+
+    free(next_data);
+    free(history);
+    free(history_data);
+
+    log_file = nullptr;
+    next_data = nullptr;
+    next_capacity = 0;
+    history = nullptr;
+    history_size = 0;
+    history_capacity = 0;
+    history_data = nullptr;
+    history_data_size = 0;
+    history_data_capacity = 0;
+}
+
+static void write_uleb128(u64 value)
+{
+    do {
+        u8 byte = value & 0x7F;
+        value >>= 7;
+
+        if (value != 0)
+            byte |= 0x80;
+
+        fputc(byte, log_file);
+    } while (value != 0);
+}
+
+[[nodiscard]] static bool read_uleb128(u64 *const out)
+{
+    u64 value = 0;
+
+    for (u32 shift = 0; shift < 64; shift += 7) {
+        const int byte = fgetc(log_file);
+
+        if (byte == EOF)
+            return false;
+
+        value |= (u64)(byte & 0x7F) << shift;
+
+        if ((byte & 0x80) == 0) {
+            *out = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void reserve_next(const size_t size)
+{
+    if (size <= next_capacity)
+        return;
+
+    u8 *const new_data = realloc(next_data, size);
+
+    if (new_data == nullptr)
+        BAIL("Could not allocate replay event");
+
+    next_data = new_data;
+    next_capacity = size;
+}
+
+/**
+ * \brief Takes the next event kept in history into the read-ahead slot.
+ */
+static void read_ahead_history(void)
+{
+    next_valid = false;
+
+    if (history_pos >= history_size)
+        return;
+
+    const HistoryEvent *const event = &history[history_pos];
+    reserve_next(event->size);
+
+    memcpy(next_data, &history_data[event->offset], event->size);
+    next_type = event->type;
+    next_instret = event->instret;
+    next_size = event->size;
+    next_valid = true;
+
+    ++history_pos;
+}
+
+/**
+ * \brief Reads the next event from the log into the read-ahead slot.
+ */
+static void read_ahead(void)
+{
+    if (mode == ReplayMode_History) {
+        read_ahead_history();
+        return;
+    }
+
+    const int type = fgetc(log_file);
+    u64 delta = 0;
+    u64 size = 0;
+
+    next_valid = false;
+
+    if (type == EOF || !read_uleb128(&delta) || !read_uleb128(&size))
+        return;
+
+    reserve_next(size);
+
+    if (fread(next_data, 1, size, log_file) != size)
+        return;
+
+    next_type = (ReplayEvent)type;
+    next_instret = last_instret + delta;
+    next_size = size;
+    next_valid = true;
+
+    last_instret = next_instret;
+}
+
+bool replay_start_recording(const char *const filename)
+{
+    log_file = fopen(filename, "wb");
+
+    if (log_file == nullptr)
+        return false;
+
+    setvbuf(log_file, nullptr, _IOFBF, REPLAY_BUF_SIZE);
+
+    ReplayHeader header = {
+        .magic = {},
+        .version = REPLAY_VERSION,
+    };
+
+    memcpy(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+
+    if (fwrite(&header, sizeof(header), 1, log_file) != 1) {
+        close_log();
+        return false;
+    }
+
+    mode = ReplayMode_Record;
+    atexit(close_log);
+
+    return true;
+}
+
+bool replay_start_replaying(const char *const filename)
+{
+    log_file = fopen(filename, "rb");
+
+    if (log_file == nullptr)
+        return false;
+
+    setvbuf(log_file, nullptr, _IOFBF, REPLAY_BUF_SIZE);
+
+    ReplayHeader header = {};
+
+    if (fread(&header, sizeof(header), 1, log_file) != 1 ||
+        memcmp(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC)) != 0 ||
+        header.version != REPLAY_VERSION) {
+        close_log();
+        return false;
+    }
+
+    mode = ReplayMode_Replay;
+    atexit(close_log);
+
+    read_ahead();
+    return true;
+}
+
+void replay_start_history(void)
+{
+    mode = ReplayMode_History;
+    atexit(close_log);
+}
+
+ReplayMode replay_mode(void)
+{
+    return mode;
+}
+
+bool replay_replaying(void)
+{
+    return mode == ReplayMode_Replay || (mode == ReplayMode_History && next_valid);
+}
+
+void replay_rewind(const u64 instret)
+{
+    if (mode != ReplayMode_History)
+        return;
+
+    size_t lo = 0;
+    size_t hi = history_size;
+
+    while (lo < hi) {
+        const size_t mid = lo + ((hi - lo) / 2);
+
+        if (history[mid].instret < instret)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    history_pos = lo;
+    read_ahead_history();
+}
+
+/**
+ * \brief Appends an event to history, after discarding the events that were still to be replayed.
+ */
+static void record_history(const ReplayEvent type, const u64 instret, const void *const data,
+                           const size_t size)
+{
+    // The read-ahead slot holds the event before history_pos
+    const size_t keep = next_valid ? history_pos - 1 : history_pos;
+
+    if (keep < history_size) {
+        history_size = keep;
+        history_data_size = history[keep].offset;
+    }
+
+    next_valid = false;
+
+    if (history_size == history_capacity) {
+        const size_t new_capacity = history_capacity == 0 ? 64 : 2 * history_capacity;
+        HistoryEvent *const new_history = realloc(history, new_capacity * sizeof(*new_history));
+
+        if (new_history == nullptr)
+            BAIL("Could not allocate replay history");
+
+        history = new_history;
+        history_capacity = new_capacity;
+    }
+
+    if (history_data_size + size > history_data_capacity) {
+        const size_t new_capacity = sz_max(history_data_size + size, 2 * history_data_capacity);
+        u8 *const new_data = realloc(history_data, new_capacity);
+
+        if (new_data == nullptr)
+            BAIL("Could not allocate replay history");
+
+        history_data = new_data;
+        history_data_capacity = new_capacity;
+    }
+
+    history[history_size] = (HistoryEvent){
+        .instret = instret,
+        .offset = history_data_size,
+        .size = size,
+        .type = type,
+    };
+
+    memcpy(&history_data[history_data_size], data, size);
+    history_data_size += size;
+    ++history_size;
+    history_pos = history_size;
+}
+
+void replay_record(const ReplayEvent type, const u64 instret, const void *const data,
+                   const size_t size)
+{
+    if (mode == ReplayMode_History) {
+        record_history(type, instret, data, size);
+        return;
+    }
+
+    if (mode != ReplayMode_Record)
+        return;
+
+    fputc(type, log_file);
+    write_uleb128(instret - last_instret);
+    write_uleb128(size);
+    fwrite(data, 1, size, log_file);
+
+    last_instret = instret;
+}
+
+bool replay_next(const ReplayEvent type, const u64 instret, void *const out, size_t *const size)
+{
+    // Caught up with history, the event happens live
+    if (mode == ReplayMode_History && !next_valid)
+        return false;
+
+    if (mode != ReplayMode_Replay && mode != ReplayMode_History)
+        return false;
+
+    if (!next_valid)
+        BAIL("Replay log ended before instruction %llu", (unsigned long long)instret);
+
+    if (next_type != type || next_instret != instret || next_size > *size)
+        BAIL("Replay diverged at instruction %llu", (unsigned long long)instret);
+
+    memcpy(out, next_data, next_size);
+    *size = next_size;
+
+    read_ahead();
+    return true;
+}
+
+void replay_inject(Cpu *const cpu, Memory *const mem)
+{
+    while (next_valid && next_instret == cpu->instret) {
+        if (next_type == ReplayEvent_RegisterWrite) {
+            if (next_size != sizeof(cpu->regs) + sizeof(cpu->pc))
+                BAIL("Malformed register write in replay log");
+
+            memcpy(cpu->regs, next_data, sizeof(cpu->regs));
+            memcpy(&cpu->pc, next_data + sizeof(cpu->regs), sizeof(cpu->pc));
+        } else if (next_type == ReplayEvent_FloatRegisterWrite) {
+            if (next_size != sizeof(cpu->float_regs))
+                BAIL("Malformed float register write in replay log");
+
+            memcpy(cpu->float_regs, next_data, sizeof(cpu->float_regs));
+        } else if (next_type == ReplayEvent_MemoryWrite) {
+            u32 addr = 0;
+            u8 *dest = nullptr;
+
+            if (next_size < sizeof(addr))
+                BAIL("Malformed memory write in replay log");
+
+            memcpy(&addr, next_data, sizeof(addr));
+            const u32 size = (u32)(next_size - sizeof(addr));
+
+            if (Memory_write_span(mem, addr, size, &dest) != MemoryResult_Ok)
+                BAIL("Replayed memory write out of bounds (0x%08X)", addr);
+
+            memcpy(dest, next_data + sizeof(addr), size);
+        } else {
+            return;
+        }
+
+        read_ahead();
+    }
+}
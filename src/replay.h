@@ -0,0 +1,106 @@
+#ifndef RV32_EMU_REPLAY_H
+#define RV32_EMU_REPLAY_H
+
+#include "cpu.h"
+#include "memory.h"
+#include "stdinc.h"
+#include <stddef.h>
+
+typedef enum ReplayMode : u8 {
+    ReplayMode_Off,
+    ReplayMode_Record,
+    ReplayMode_Replay,
+    ReplayMode_History, // Events are kept in memory, to re-execute the guest from earlier on
+} ReplayMode;
+
+/**
+ * \brief Kinds of nondeterministic events stored in a replay log.
+ *
+ * Input and time events are consumed by the ecall that produced them. Register and memory writes
+ * come from outside the guest, and are injected again before the instruction they preceded.
+ */
+typedef enum ReplayEvent : u8 {
+    ReplayEvent_Input = 1,
+    ReplayEvent_Time = 2,
+    ReplayEvent_RegisterWrite = 3,
+    ReplayEvent_MemoryWrite = 4,
+    ReplayEvent_FloatRegisterWrite = 5,
+} ReplayEvent;
+
+/**
+ * \brief Starts recording nondeterministic events to a file.
+ *
+ * \param filename Path of the log to write.
+ *
+ * \return true on success, false if the file could not be created.
+ */
+[[nodiscard]] bool replay_start_recording(const char *filename);
+
+/**
+ * \brief Starts replaying nondeterministic events from a file.
+ *
+ * \param filename Path of the log to read.
+ *
+ * \return true on success, false if the file could not be opened or is not a replay log.
+ */
+[[nodiscard]] bool replay_start_replaying(const char *filename);
+
+/**
+ * \brief Starts keeping nondeterministic events in memory.
+ *
+ * Once rewound with replay_rewind(), the guest gets the same inputs again as it re-executes, until
+ * it catches up with the last recorded event.
+ */
+void replay_start_history(void);
+
+[[nodiscard]] ReplayMode replay_mode(void);
+
+/**
+ * \brief Returns whether events are being replayed, from a file or from history.
+ */
+[[nodiscard]] bool replay_replaying(void);
+
+/**
+ * \brief Replays the events kept in history again, starting from a point in the past.
+ *
+ * Recording an event while history is being replayed discards every event that was still to be
+ * replayed, since the guest is then taking a different path.
+ *
+ * \param instret Number of instructions retired at the point the guest is re-executed from.
+ */
+void replay_rewind(u64 instret);
+
+/**
+ * \brief Appends an event to the log when recording or keeping history.
+ *
+ * \param type The kind of event.
+ * \param instret Number of instructions retired when the event happened.
+ * \param data The event payload.
+ * \param size Size of data in bytes.
+ */
+void replay_record(ReplayEvent type, u64 instret, const void *data, size_t size);
+
+/**
+ * \brief Takes the next event from the log when replaying.
+ *
+ * Bails if the next event in the log is not of the expected type at the expected instruction,
+ * since the guest has then diverged from the recorded run.
+ *
+ * \param type The expected kind of event.
+ * \param instret Number of instructions retired so far.
+ * \param out Will be filled with the event payload.
+ * \param size Size of out in bytes. Will be set to the size of the payload.
+ *
+ * \return true if the payload was replayed into out, false if not replaying.
+ */
+[[nodiscard]] bool replay_next(ReplayEvent type, u64 instret, void *out, size_t *size);
+
+/**
+ * \brief Applies every recorded register and memory write due before the next instruction.
+ *
+ * \param cpu The CPU to write registers to.
+ * \param mem The memory to write to.
+ */
+void replay_inject(Cpu *cpu, Memory *mem);
+
+#endif
@@ -0,0 +1,579 @@
+#include "semihost.h"
+#include "console.h"
+#include "cpu.h"
+#include "memory.h"
+#include "replay.h"
+#include "stdinc.h"
+#include "syscall.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr u32 SEMIHOST_PRE = 0x01F0'1013;  // slli x0, x0, 0x1f
+static constexpr u32 SEMIHOST_POST = 0x4070'5013; // srai x0, x0, 7
+
+static constexpr u32 TICKS_PER_SECOND = 1'000'000;
+static constexpr u32 ADP_STOPPED_APPLICATION_EXIT = 0x2'0026;
+
+[[nodiscard]] static bool read_word(const Memory *const mem, const u32 addr, u32 *const out)
+{
+    const u8 *data = nullptr;
+
+    if (Memory_read_span(mem, addr, sizeof(*out), &data) != MemoryResult_Ok)
+        return false;
+
+    *out = (u32)data[0] | ((u32)data[1] << 8) | ((u32)data[2] << 16) | ((u32)data[3] << 24);
+    return true;
+}
+
+/**
+ * \brief Reads a parameter block of consecutive words from guest memory.
+ */
+[[nodiscard]] static bool read_params(const Memory *const mem, const u32 addr, u32 *const out,
+                                      const size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (!read_word(mem, addr + (u32)(i * sizeof(u32)), &out[i]))
+            return false;
+    }
+
+    return true;
+}
+
+[[nodiscard]] static bool write_words(Memory *const mem, const u32 addr, const u32 *const words,
+                                      const size_t count)
+{
+    u8 *data = nullptr;
+
+    if (Memory_write_span(mem, addr, (u32)(count * sizeof(u32)), &data) != MemoryResult_Ok)
+        return false;
+
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t j = 0; j < sizeof(u32); ++j)
+            data[(i * sizeof(u32)) + j] = (u8)(words[i] >> (8 * j));
+    }
+
+    return true;
+}
+
+/**
+ * \brief Copies a file name given as an address and a length into a NUL-terminated buffer.
+ */
+[[nodiscard]] static bool read_name(const Memory *const mem, const u32 addr, const u32 len,
+                                    char *const out, const size_t size)
+{
+    const u8 *data = nullptr;
+
+    if (len >= size || Memory_read_span(mem, addr, len, &data) != MemoryResult_Ok)
+        return false;
+
+    memcpy(out, data, len);
+    out[len] = '\0';
+
+    return true;
+}
+
+[[nodiscard]] static int host_fd(const HostState *const host, const u32 handle)
+{
+    if (handle >= CPU_FD_TABLE_SIZE)
+        return -1;
+
+    return host->handles[handle] - 1;
+}
+
+/**
+ * \brief Returns a failure result, remembering errno for SYS_ERRNO.
+ */
+[[nodiscard]] static u32 fail(HostState *const host, const int error)
+{
+    host->last_errno = error;
+    return (u32)-1;
+}
+
+[[nodiscard]] static u32 semihost_open(HostState *const host, const Memory *const mem,
+                                       const u32 params_addr)
+{
+    static constexpr int open_flags[] = {
+        O_RDONLY,
+        O_RDONLY,
+        O_RDWR,
+        O_RDWR,
+        O_WRONLY | O_CREAT | O_TRUNC,
+        O_WRONLY | O_CREAT | O_TRUNC,
+        O_RDWR | O_CREAT | O_TRUNC,
+        O_RDWR | O_CREAT | O_TRUNC,
+        O_WRONLY | O_CREAT | O_APPEND,
+        O_WRONLY | O_CREAT | O_APPEND,
+        O_RDWR | O_CREAT | O_APPEND,
+        O_RDWR | O_CREAT | O_APPEND,
+    };
+
+    u32 params[3] = {};
+    char name[PATH_MAX] = {};
+
+    if (!read_params(mem, params_addr, params, 3) ||
+        !read_name(mem, params[0], params[2], name, sizeof(name)))
+        return fail(host, EFAULT);
+
+    const u32 mode = params[1];
+
+    if (mode >= sizeof(open_flags) / sizeof(open_flags[0]))
+        return fail(host, EINVAL);
+
+    // The special name ":tt" opens the console: stdin when reading, stdout when writing and
+    // stderr when appending
+    if (strcmp(name, ":tt") == 0)
+        return mode < 4 ? STDIN_FILENO : (mode < 8 ? STDOUT_FILENO : STDERR_FILENO);
+
+    u32 handle = 0;
+
+    while (handle < CPU_FD_TABLE_SIZE && host->handles[handle] != 0)
+        ++handle;
+
+    if (handle == CPU_FD_TABLE_SIZE)
+        return fail(host, EMFILE);
+
+    const int fd = open(name, open_flags[mode], 0644);
+
+    if (fd < 0)
+        return fail(host, errno);
+
+    host->handles[handle] = fd + 1;
+    return handle;
+}
+
+[[nodiscard]] static u32 semihost_close(HostState *const host, const Memory *const mem,
+                                        const u32 params_addr)
+{
+    u32 handle = 0;
+
+    if (!read_word(mem, params_addr, &handle))
+        return fail(host, EFAULT);
+
+    const int fd = host_fd(host, handle);
+
+    if (fd < 0)
+        return fail(host, EBADF);
+
+    if (fd <= STDERR_FILENO)
+        return 0;
+
+    host->handles[handle] = 0;
+    return close(fd) == 0 ? 0 : fail(host, errno);
+}
+
+/**
+ * \brief Replays the result of a call that is only made once, since it has host side effects.
+ *
+ * \return true if the result was replayed into out, false if the call has to be made.
+ */
+[[nodiscard]] static bool replay_result(const Cpu *const cpu, u32 *const out)
+{
+    size_t size = sizeof(*out);
+    return replay_next(ReplayEvent_Input, cpu->instret, out, &size);
+}
+
+static void record_result(const Cpu *const cpu, const u32 result)
+{
+    replay_record(ReplayEvent_Input, cpu->instret, &result, sizeof(result));
+}
+
+/**
+ * \brief Writes a block of guest memory to a handle.
+ *
+ * Like the Linux write syscall, only writes to the standard streams are made again when
+ * replaying, and those to stderr are muted while re-executing history.
+ *
+ * \return The number of bytes that were not written.
+ */
+[[nodiscard]] static u32 semihost_write(const Cpu *const cpu, const Memory *const mem,
+                                        const u32 params_addr)
+{
+    HostState *const host = cpu->host;
+    u32 params[3] = {};
+    const u8 *data = nullptr;
+
+    if (!read_params(mem, params_addr, params, 3) ||
+        Memory_read_span(mem, params[1], params[2], &data) != MemoryResult_Ok) {
+        host->last_errno = EFAULT;
+        return params[2];
+    }
+
+    const int fd = host_fd(host, params[0]);
+    const u32 len = params[2];
+
+    if (fd == STDOUT_FILENO) {
+        console_write((const char *)data, len);
+        return 0;
+    }
+
+    u32 result = 0;
+
+    if (fd != STDERR_FILENO && replay_result(cpu, &result))
+        return result;
+
+    if (fd == STDERR_FILENO) {
+        console_flush();
+
+        if (replay_mode() == ReplayMode_History && replay_replaying())
+            return 0;
+    }
+
+    const ssize_t written = fd < 0 ? -1 : write(fd, data, len);
+
+    if (written < 0)
+        host->last_errno = fd < 0 ? EBADF : errno;
+
+    result = written < 0 ? len : len - (u32)written;
+
+    if (fd != STDERR_FILENO)
+        record_result(cpu, result);
+
+    return result;
+}
+
+/**
+ * \brief Reads a block from a handle into guest memory.
+ *
+ * \return The number of bytes that were not read.
+ */
+[[nodiscard]] static u32 semihost_read(const Cpu *const cpu, Memory *const mem,
+                                       const u32 params_addr)
+{
+    HostState *const host = cpu->host;
+    u32 params[3] = {};
+    u8 *data = nullptr;
+
+    if (!read_params(mem, params_addr, params, 3) ||
+        Memory_write_span(mem, params[1], params[2], &data) != MemoryResult_Ok) {
+        host->last_errno = EFAULT;
+        return params[2];
+    }
+
+    const u32 len = params[2];
+
+    // Like the Linux read syscall, the count is logged first, followed by the data
+    u32 count = 0;
+    size_t size = sizeof(count);
+
+    if (replay_next(ReplayEvent_Input, cpu->instret, &count, &size)) {
+        size = count;
+
+        if (count > 0)
+            (void)replay_next(ReplayEvent_Input, cpu->instret, data, &size);
+
+        return len - count;
+    }
+
+    const int fd = host_fd(host, params[0]);
+
+    if (fd == STDIN_FILENO)
+        console_flush();
+
+    ssize_t result = -1;
+
+    if (fd < 0)
+        host->last_errno = EBADF;
+    else if ((result = fd == STDIN_FILENO && host->stdin_eof ? 0 : read(fd, data, len)) < 0)
+        host->last_errno = errno;
+
+    count = result > 0 ? (u32)result : 0;
+
+    replay_record(ReplayEvent_Input, cpu->instret, &count, sizeof(count));
+
+    if (count > 0)
+        replay_record(ReplayEvent_Input, cpu->instret, data, count);
+
+    return len - count;
+}
+
+[[nodiscard]] static u32 semihost_readc(const Cpu *const cpu)
+{
+    u32 ch = 0;
+    size_t size = sizeof(ch);
+
+    if (replay_next(ReplayEvent_Input, cpu->instret, &ch, &size))
+        return ch;
+
+    console_flush();
+    ch = cpu->host->stdin_eof ? (u32)EOF : (u32)getchar();
+
+    replay_record(ReplayEvent_Input, cpu->instret, &ch, sizeof(ch));
+    return ch;
+}
+
+[[nodiscard]] static u32 semihost_istty(HostState *const host, const Memory *const mem,
+                                        const u32 params_addr)
+{
+    u32 handle = 0;
+
+    if (!read_word(mem, params_addr, &handle))
+        return fail(host, EFAULT);
+
+    const int fd = host_fd(host, handle);
+
+    if (fd < 0)
+        return fail(host, EBADF);
+
+    return isatty(fd) ? 1 : 0;
+}
+
+[[nodiscard]] static u32 semihost_seek(HostState *const host, const Memory *const mem,
+                                       const u32 params_addr)
+{
+    u32 params[2] = {};
+
+    if (!read_params(mem, params_addr, params, 2))
+        return fail(host, EFAULT);
+
+    const int fd = host_fd(host, params[0]);
+
+    if (fd < 0)
+        return fail(host, EBADF);
+
+    return lseek(fd, params[1], SEEK_SET) >= 0 ? 0 : fail(host, errno);
+}
+
+[[nodiscard]] static u32 semihost_flen(HostState *const host, const Memory *const mem,
+                                       const u32 params_addr)
+{
+    u32 handle = 0;
+
+    if (!read_word(mem, params_addr, &handle))
+        return fail(host, EFAULT);
+
+    const int fd = host_fd(host, handle);
+    struct stat st = {};
+
+    if (fd < 0)
+        return fail(host, EBADF);
+
+    if (fstat(fd, &st) != 0)
+        return fail(host, errno);
+
+    return (u32)st.st_size;
+}
+
+[[nodiscard]] static u32 semihost_remove(HostState *const host, const Memory *const mem,
+                                         const u32 params_addr)
+{
+    u32 params[2] = {};
+    char name[PATH_MAX] = {};
+
+    if (!read_params(mem, params_addr, params, 2) ||
+        !read_name(mem, params[0], params[1], name, sizeof(name)))
+        return fail(host, EFAULT);
+
+    return remove(name) == 0 ? 0 : fail(host, errno);
+}
+
+[[nodiscard]] static u32 semihost_rename(HostState *const host, const Memory *const mem,
+                                         const u32 params_addr)
+{
+    u32 params[4] = {};
+    char old_name[PATH_MAX] = {};
+    char new_name[PATH_MAX] = {};
+
+    if (!read_params(mem, params_addr, params, 4) ||
+        !read_name(mem, params[0], params[1], old_name, sizeof(old_name)) ||
+        !read_name(mem, params[2], params[3], new_name, sizeof(new_name)))
+        return fail(host, EFAULT);
+
+    return rename(old_name, new_name) == 0 ? 0 : fail(host, errno);
+}
+
+/**
+ * \brief Returns the guest time in microseconds since the first clock query.
+ */
+[[nodiscard]] static u64 elapsed_us(Cpu *const cpu)
+{
+    HostState *const host = cpu->host;
+    const u64 now = guest_time_us(cpu);
+
+    if (!host->clock_started) {
+        host->clock_started = true;
+        host->clock_start_us = now;
+    }
+
+    return now - host->clock_start_us;
+}
+
+/**
+ * \brief Returns whether an operation changes or depends on host state, and is therefore only
+ * made once.
+ *
+ * When replaying, or re-executing from history, the result is replayed instead. Errno is replayed
+ * along with the rest, since failed calls are not made again to set it.
+ */
+[[nodiscard]] static bool changes_host(const u32 op)
+{
+    switch (op) {
+    case SemihostOp_Open:
+    case SemihostOp_Close:
+    case SemihostOp_IsTty:
+    case SemihostOp_Seek:
+    case SemihostOp_Flen:
+    case SemihostOp_Remove:
+    case SemihostOp_Rename:
+    case SemihostOp_Errno:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+bool semihost_is_call(const Memory *const mem, const u32 pc)
+{
+    u32 pre = 0;
+    u32 post = 0;
+
+    return pc >= 4 && read_word(mem, pc - 4, &pre) && pre == SEMIHOST_PRE &&
+           read_word(mem, pc + 4, &post) && post == SEMIHOST_POST;
+}
+
+CpuStepResult handle_semihost(Cpu *const cpu, Memory *const mem)
+{
+    const u32 op = cpu->regs[10];
+    const u32 param = cpu->regs[11];
+    HostState *const host = cpu->host;
+
+    u32 result = 0;
+
+    if (changes_host(op) && replay_result(cpu, &result)) {
+        cpu->regs[10] = result;
+        return CpuStepResult_None;
+    }
+
+    switch (op) {
+    case SemihostOp_Open:
+        result = semihost_open(host, mem, param);
+        break;
+
+    case SemihostOp_Close:
+        result = semihost_close(host, mem, param);
+        break;
+
+    case SemihostOp_WriteC:
+        console_putc((char)Memory_read(mem, param));
+        break;
+
+    case SemihostOp_Write0:
+        print_guest_string(mem, param);
+        break;
+
+    case SemihostOp_Write:
+        result = semihost_write(cpu, mem, param);
+        break;
+
+    case SemihostOp_Read:
+        result = semihost_read(cpu, mem, param);
+        break;
+
+    case SemihostOp_ReadC:
+        result = semihost_readc(cpu);
+        break;
+
+    case SemihostOp_IsError:
+        u32 status = 0;
+        result = read_word(mem, param, &status) && (i32)status < 0 ? 1 : 0;
+        break;
+
+    case SemihostOp_IsTty:
+        result = semihost_istty(host, mem, param);
+        break;
+
+    case SemihostOp_Seek:
+        result = semihost_seek(host, mem, param);
+        break;
+
+    case SemihostOp_Flen:
+        result = semihost_flen(host, mem, param);
+        break;
+
+    case SemihostOp_Remove:
+        result = semihost_remove(host, mem, param);
+        break;
+
+    case SemihostOp_Rename:
+        result = semihost_rename(host, mem, param);
+        break;
+
+    case SemihostOp_Clock:
+        result = (u32)(elapsed_us(cpu) / 10'000);
+        break;
+
+    case SemihostOp_Time:
+        result = (u32)(guest_time_us(cpu) / 1'000'000);
+        break;
+
+    case SemihostOp_Errno:
+        result = (u32)host->last_errno;
+        break;
+
+    case SemihostOp_GetCmdline:
+        u32 cmdline[2] = {};
+        u8 *buf = nullptr;
+
+        // There are no guest arguments, so return an empty command line
+        if (!read_params(mem, param, cmdline, 2) || cmdline[1] == 0 ||
+            Memory_write_span(mem, cmdline[0], 1, &buf) != MemoryResult_Ok) {
+            result = fail(host, EFAULT);
+            break;
+        }
+
+        buf[0] = '\0';
+        cmdline[1] = 0;
+        result = write_words(mem, param + 4, &cmdline[1], 1) ? 0 : fail(host, EFAULT);
+        break;
+
+    case SemihostOp_HeapInfo:
+        u32 block_addr = 0;
+        const u32 heap_info[4] = {};
+
+        // Zeroes tell the runtime to use its own defaults for the heap and stack
+        result = read_word(mem, param, &block_addr) && write_words(mem, block_addr, heap_info, 4)
+                     ? 0
+                     : fail(host, EFAULT);
+        break;
+
+    case SemihostOp_Exit:
+        cpu->exit_code = param == ADP_STOPPED_APPLICATION_EXIT ? 0 : 1;
+        return CpuStepResult_Exit;
+
+    case SemihostOp_ExitExtended:
+        u32 exit_params[2] = {};
+
+        if (!read_params(mem, param, exit_params, 2))
+            exit_params[1] = 1;
+
+        cpu->exit_code = exit_params[0] == ADP_STOPPED_APPLICATION_EXIT ? (i32)exit_params[1] : 1;
+        return CpuStepResult_Exit;
+
+    case SemihostOp_Elapsed:
+        const u64 ticks = elapsed_us(cpu);
+        const u32 ticks_words[2] = {(u32)ticks, (u32)(ticks >> 32)};
+
+        result = write_words(mem, param, ticks_words, 2) ? 0 : fail(host, EFAULT);
+        break;
+
+    case SemihostOp_TickFreq:
+        result = TICKS_PER_SECOND;
+        break;
+
+    case SemihostOp_System:
+    default:
+        result = fail(host, ENOSYS);
+    }
+
+    if (changes_host(op))
+        record_result(cpu, result);
+
+    cpu->regs[10] = result;
+    return CpuStepResult_None;
+}
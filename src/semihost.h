@@ -0,0 +1,62 @@
+#ifndef RV32_EMU_SEMIHOST_H
+#define RV32_EMU_SEMIHOST_H
+
+#include "cpu.h"
+#include "memory.h"
+#include "stdinc.h"
+
+/**
+ * \brief Semihosting operation numbers, shared with the ARM semihosting specification.
+ */
+typedef enum SemihostOp : u32 {
+    SemihostOp_Open = 0x01,
+    SemihostOp_Close = 0x02,
+    SemihostOp_WriteC = 0x03,
+    SemihostOp_Write0 = 0x04,
+    SemihostOp_Write = 0x05,
+    SemihostOp_Read = 0x06,
+    SemihostOp_ReadC = 0x07,
+    SemihostOp_IsError = 0x08,
+    SemihostOp_IsTty = 0x09,
+    SemihostOp_Seek = 0x0A,
+    SemihostOp_Flen = 0x0C,
+    SemihostOp_Remove = 0x0E,
+    SemihostOp_Rename = 0x0F,
+    SemihostOp_Clock = 0x10,
+    SemihostOp_Time = 0x11,
+    SemihostOp_System = 0x12,
+    SemihostOp_Errno = 0x13,
+    SemihostOp_GetCmdline = 0x15,
+    SemihostOp_HeapInfo = 0x16,
+    SemihostOp_Exit = 0x18,
+    SemihostOp_ExitExtended = 0x20,
+    SemihostOp_Elapsed = 0x30,
+    SemihostOp_TickFreq = 0x31,
+} SemihostOp;
+
+/**
+ * \brief Returns whether the ebreak at pc is part of a semihosting call.
+ *
+ * A semihosting call is an ebreak placed between `slli x0, x0, 0x1f` and `srai x0, x0, 7`.
+ *
+ * \param mem The guest memory.
+ * \param pc Address of the ebreak.
+ *
+ * \return true if the ebreak is surrounded by the semihosting sequence, false otherwise.
+ */
+[[nodiscard]] bool semihost_is_call(const Memory *mem, u32 pc);
+
+/**
+ * \brief Executes the semihosting call requested by the guest.
+ *
+ * The operation number is taken from a0 and its parameter (usually a pointer to a parameter
+ * block) from a1. The result is returned in a0.
+ *
+ * \param cpu The calling CPU.
+ * \param mem The guest memory.
+ *
+ * \return CpuStepResult_Exit if the guest asked to exit, CpuStepResult_None otherwise.
+ */
+[[nodiscard]] CpuStepResult handle_semihost(Cpu *cpu, Memory *mem);
+
+#endif
@@ -0,0 +1,112 @@
+#include "sha256.h"
+#include "stdinc.h"
+#include <stddef.h>
+#include <string.h>
+
+static constexpr size_t BLOCK_SIZE = 64;
+
+static constexpr u32 ROUND_CONSTANTS[64] = {
+    0x428A'2F98, 0x7137'4491, 0xB5C0'FBCF, 0xE9B5'DBA5, 0x3956'C25B, 0x59F1'11F1, 0x923F'82A4,
+    0xAB1C'5ED5, 0xD807'AA98, 0x1283'5B01, 0x2431'85BE, 0x550C'7DC3, 0x72BE'5D74, 0x80DE'B1FE,
+    0x9BDC'06A7, 0xC19B'F174, 0xE49B'69C1, 0xEFBE'4786, 0x0FC1'9DC6, 0x240C'A1CC, 0x2DE9'2C6F,
+    0x4A74'84AA, 0x5CB0'A9DC, 0x76F9'88DA, 0x983E'5152, 0xA831'C66D, 0xB003'27C8, 0xBF59'7FC7,
+    0xC6E0'0BF3, 0xD5A7'9147, 0x06CA'6351, 0x1429'2967, 0x27B7'0A85, 0x2E1B'2138, 0x4D2C'6DFC,
+    0x5338'0D13, 0x650A'7354, 0x766A'0ABB, 0x81C2'C92E, 0x9272'2C85, 0xA2BF'E8A1, 0xA81A'664B,
+    0xC24B'8B70, 0xC76C'51A3, 0xD192'E819, 0xD699'0624, 0xF40E'3585, 0x106A'A070, 0x19A4'C116,
+    0x1E37'6C08, 0x2748'774C, 0x34B0'BCB5, 0x391C'0CB3, 0x4ED8'AA4A, 0x5B9C'CA4F, 0x682E'6FF3,
+    0x748F'82EE, 0x78A5'636F, 0x84C8'7814, 0x8CC7'0208, 0x90BE'FFFA, 0xA450'6CEB, 0xBEF9'A3F7,
+    0xC671'78F2,
+};
+
+[[nodiscard]] static u32 rotr(const u32 x, const u32 n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static void compress(u32 state[8], const u8 block[BLOCK_SIZE])
+{
+    u32 w[64] = {};
+
+    for (size_t i = 0; i < 16; ++i) {
+        w[i] = ((u32)block[4 * i] << 24) | ((u32)block[(4 * i) + 1] << 16) |
+               ((u32)block[(4 * i) + 2] << 8) | (u32)block[(4 * i) + 3];
+    }
+
+    for (size_t i = 16; i < 64; ++i) {
+        const u32 s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const u32 s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    u32 a = state[0];
+    u32 b = state[1];
+    u32 c = state[2];
+    u32 d = state[3];
+    u32 e = state[4];
+    u32 f = state[5];
+    u32 g = state[6];
+    u32 h = state[7];
+
+    for (size_t i = 0; i < 64; ++i) {
+        const u32 s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        const u32 ch = (e & f) ^ (~e & g);
+        const u32 t1 = h + s1 + ch + ROUND_CONSTANTS[i] + w[i];
+        const u32 s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        const u32 maj = (a & b) ^ (a & c) ^ (b & c);
+        const u32 t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+void sha256_digest(const void *const data, const size_t size, u8 out[SHA256_SIZE])
+{
+    u32 state[8] = {
+        0x6A09'E667, 0xBB67'AE85, 0x3C6E'F372, 0xA54F'F53A,
+        0x510E'527F, 0x9B05'688C, 0x1F83'D9AB, 0x5BE0'CD19,
+    };
+
+    const u8 *const bytes = data;
+    size_t i = 0;
+
+    for (; i + BLOCK_SIZE <= size; i += BLOCK_SIZE)
+        compress(state, &bytes[i]);
+
+    // The message ends with a 1 bit, then zeroes up to the bit length in the last 8 bytes
+    u8 tail[2 * BLOCK_SIZE] = {};
+    const size_t rest = size - i;
+    const size_t tail_size = rest + 9 <= BLOCK_SIZE ? BLOCK_SIZE : 2 * BLOCK_SIZE;
+    const u64 bits = (u64)size * 8;
+
+    memcpy(tail, &bytes[i], rest);
+    tail[rest] = 0x80;
+
+    for (size_t j = 0; j < 8; ++j)
+        tail[tail_size - 1 - j] = (u8)(bits >> (8 * j));
+
+    for (size_t j = 0; j < tail_size; j += BLOCK_SIZE)
+        compress(state, &tail[j]);
+
+    for (size_t j = 0; j < 8; ++j) {
+        out[4 * j] = (u8)(state[j] >> 24);
+        out[(4 * j) + 1] = (u8)(state[j] >> 16);
+        out[(4 * j) + 2] = (u8)(state[j] >> 8);
+        out[(4 * j) + 3] = (u8)state[j];
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef RV32_EMU_SHA256_H
+#define RV32_EMU_SHA256_H
+
+#include "stdinc.h"
+#include <stddef.h>
+
+static constexpr size_t SHA256_SIZE = 32;
+
+/**
+ * \brief Computes the SHA-256 digest of some data.
+ *
+ * \param data The data to hash.
+ * \param size Size of data in bytes.
+ * \param out Will be set to the digest.
+ */
+void sha256_digest(const void *data, size_t size, u8 out[SHA256_SIZE]);
+
+#endif
@@ -0,0 +1,430 @@
+#include "snapshot.h"
+#include "console.h"
+#include "cpu.h"
+#include "log.h"
+#include "macros.h"
+#include "memory.h"
+#include "stdinc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static constexpr char SNAPSHOT_MAGIC[8] = "RV32SNAP";
+static constexpr u32 SNAPSHOT_VERSION = 3;
+
+typedef struct SnapshotHeader {
+    char magic[8];
+    u32 version;
+    u32 cpu_size;
+    u32 segments_size;
+    u32 runs_size;
+    u32 heap_start;
+    u32 heap_top;
+    u32 heap_limit;
+    SnapshotSource source;
+} SnapshotHeader;
+
+typedef struct SnapshotSegment {
+    u32 addr;
+    u32 size;
+    u32 perms;
+} SnapshotSegment;
+
+[[nodiscard]] static bool write_all(const int fd, const void *const buf, const size_t count,
+                                    const u64 offset)
+{
+    const u8 *ptr = buf;
+    size_t remaining = count;
+    off_t pos = (off_t)offset;
+
+    while (remaining > 0) {
+        const ssize_t written = pwrite(fd, ptr, remaining, pos);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        ptr += written;
+        pos += written;
+        remaining -= (size_t)written;
+    }
+
+    return true;
+}
+
+[[nodiscard]] static SnapshotResult read_all(const int fd, void *const buf, const size_t count,
+                                             const u64 offset)
+{
+    u8 *ptr = buf;
+    size_t remaining = count;
+    off_t pos = (off_t)offset;
+
+    while (remaining > 0) {
+        const ssize_t result = pread(fd, ptr, remaining, pos);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return SnapshotResult_ReadError;
+        }
+
+        if (result == 0)
+            return SnapshotResult_Truncated;
+
+        ptr += result;
+        pos += result;
+        remaining -= (size_t)result;
+    }
+
+    return SnapshotResult_Ok;
+}
+
+[[nodiscard]] static bool page_is_zero(const u8 *const page)
+{
+    const u64 *const words = (const u64 *)page;
+
+    for (size_t i = 0; i < MEMORY_PAGE_SIZE / sizeof(*words); ++i) {
+        if (words[i] != 0)
+            return false;
+    }
+
+    return true;
+}
+
+[[nodiscard]] static SnapshotResult write_snapshot(const int fd, const Cpu *const cpu,
+                                                   const SegmentedMemory *const mem,
+                                                   const SnapshotSource *const source)
+{
+    // Guest output still sitting in buffers is part of the state being saved
+    console_flush();
+
+    SnapshotRun *runs = nullptr;
+    size_t runs_size = 0;
+    size_t runs_capacity = 0;
+
+    for (size_t page = 0; page < MEMORY_PAGE_COUNT; ++page) {
+        if (!SegmentedMemory_page_is_touched(mem, page) ||
+            page_is_zero(&mem->data[page * MEMORY_PAGE_SIZE]))
+            continue;
+
+        if (runs_size != 0) {
+            SnapshotRun *const last = &runs[runs_size - 1];
+
+            if ((size_t)last->first_page + last->pages_size == page) {
+                ++last->pages_size;
+                continue;
+            }
+        }
+
+        if (runs_size == runs_capacity) {
+            runs_capacity = runs_capacity == 0 ? 16 : 2 * runs_capacity;
+            SnapshotRun *const new_runs = realloc(runs, runs_capacity * sizeof(*runs));
+
+            if (new_runs == nullptr)
+                BAIL("Could not reallocate memory for snapshot runs");
+
+            runs = new_runs;
+        }
+
+        runs[runs_size] = (SnapshotRun){
+            .first_page = (u32)page,
+            .pages_size = 1,
+            .offset = 0,
+        };
+        ++runs_size;
+    }
+
+    // Devices are host-side state, and have to be attached again after restoring
+    size_t segments_size = 0;
+
+    for (size_t i = 0; i < mem->segments_size; ++i) {
+        if (mem->segments[i].device == nullptr)
+            ++segments_size;
+    }
+
+    SnapshotHeader header = {
+        .magic = {},
+        .version = SNAPSHOT_VERSION,
+        .cpu_size = sizeof(Cpu),
+        .segments_size = (u32)segments_size,
+        .runs_size = (u32)runs_size,
+        .heap_start = mem->heap.start,
+        .heap_top = mem->heap.top,
+        .heap_limit = mem->heap.limit,
+        .source = source != nullptr ? *source : (SnapshotSource){},
+    };
+
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+
+    const size_t segments_offset = sizeof(header) + sizeof(Cpu);
+    const size_t runs_offset = segments_offset + (segments_size * sizeof(SnapshotSegment));
+    const size_t header_end = runs_offset + (runs_size * sizeof(SnapshotRun));
+
+    // Page data is kept page-aligned so that it can be mapped straight into guest memory
+    u64 data_offset = (header_end + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE * MEMORY_PAGE_SIZE;
+
+    for (size_t i = 0; i < runs_size; ++i) {
+        runs[i].offset = data_offset;
+        data_offset += (u64)runs[i].pages_size * MEMORY_PAGE_SIZE;
+    }
+
+    bool ok = write_all(fd, &header, sizeof(header), 0) &&
+              write_all(fd, cpu, sizeof(*cpu), sizeof(header)) &&
+              write_all(fd, runs, runs_size * sizeof(*runs), runs_offset);
+
+    for (size_t i = 0, n = 0; ok && i < mem->segments_size; ++i) {
+        if (mem->segments[i].device != nullptr)
+            continue;
+
+        const SnapshotSegment seg = {
+            .addr = mem->segments[i].addr,
+            .size = mem->segments[i].size,
+            .perms = mem->segments[i].perms,
+        };
+
+        ok = write_all(fd, &seg, sizeof(seg), segments_offset + (n * sizeof(seg)));
+        ++n;
+    }
+
+    for (size_t i = 0; ok && i < runs_size; ++i) {
+        ok = write_all(fd, &mem->data[(size_t)runs[i].first_page * MEMORY_PAGE_SIZE],
+                       (size_t)runs[i].pages_size * MEMORY_PAGE_SIZE, runs[i].offset);
+    }
+
+    ver_printf("snapshot: %zu segments, %zu page runs\n", segments_size, runs_size);
+
+    free(runs);
+    return ok ? SnapshotResult_Ok : SnapshotResult_WriteError;
+}
+
+[[nodiscard]] static SnapshotResult read_snapshot(const int fd, Snapshot *const out)
+{
+    SnapshotHeader header = {};
+    SnapshotResult result = read_all(fd, &header, sizeof(header), 0);
+
+    if (result != SnapshotResult_Ok)
+        return result;
+
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+        return SnapshotResult_InvalidMagicNumber;
+
+    if (header.version != SNAPSHOT_VERSION || header.cpu_size != sizeof(Cpu))
+        return SnapshotResult_UnsupportedVersion;
+
+    struct stat st = {};
+
+    if (fstat(fd, &st) < 0)
+        return SnapshotResult_ReadError;
+
+    Snapshot snapshot = {
+        .fd = fd,
+        .cpu = {},
+        .heap =
+            {
+                .start = header.heap_start,
+                .top = header.heap_top,
+                .limit = header.heap_limit,
+            },
+        .segments = calloc(header.segments_size + 1, sizeof(*snapshot.segments)),
+        .segments_size = header.segments_size,
+        .runs = calloc(header.runs_size + 1, sizeof(*snapshot.runs)),
+        .runs_size = header.runs_size,
+        .source = header.source,
+    };
+
+    if (snapshot.segments == nullptr || snapshot.runs == nullptr)
+        BAIL("Could not allocate snapshot tables");
+
+    const size_t segments_offset = sizeof(header) + sizeof(Cpu);
+    const size_t runs_offset = segments_offset + (header.segments_size * sizeof(SnapshotSegment));
+
+    result = read_all(fd, &snapshot.cpu, sizeof(Cpu), sizeof(header));
+
+    for (size_t i = 0; result == SnapshotResult_Ok && i < snapshot.segments_size; ++i) {
+        SnapshotSegment seg = {};
+        result = read_all(fd, &seg, sizeof(seg), segments_offset + (i * sizeof(seg)));
+
+        snapshot.segments[i] = (Segment){
+            .addr = seg.addr,
+            .size = seg.size,
+            .perms = (u8)seg.perms,
+            .device = nullptr,
+        };
+    }
+
+    if (result == SnapshotResult_Ok)
+        result = read_all(fd, snapshot.runs, snapshot.runs_size * sizeof(SnapshotRun), runs_offset);
+
+    for (size_t i = 0; result == SnapshotResult_Ok && i < snapshot.runs_size; ++i) {
+        const SnapshotRun *const run = &snapshot.runs[i];
+        const u64 run_end = run->offset + ((u64)run->pages_size * MEMORY_PAGE_SIZE);
+
+        if ((run->offset % MEMORY_PAGE_SIZE) != 0 || run_end > (u64)st.st_size ||
+            (u64)run->first_page + run->pages_size > MEMORY_PAGE_COUNT)
+            result = SnapshotResult_Truncated;
+    }
+
+    if (result != SnapshotResult_Ok) {
+        free(snapshot.segments);
+        free(snapshot.runs);
+        return result;
+    }
+
+    *out = snapshot;
+    return SnapshotResult_Ok;
+}
+
+const char *SnapshotResult_display(const SnapshotResult result)
+{
+    switch (result) {
+    case SnapshotResult_Ok:
+        return "Ok.";
+    case SnapshotResult_OpenError:
+        return "Could not open snapshot file.";
+    case SnapshotResult_ReadError:
+        return "Error reading snapshot file.";
+    case SnapshotResult_WriteError:
+        return "Error writing snapshot file.";
+    case SnapshotResult_InvalidMagicNumber:
+        return "Not a snapshot file.";
+    case SnapshotResult_UnsupportedVersion:
+        return "Snapshot was saved by an incompatible emulator version.";
+    case SnapshotResult_Truncated:
+        return "Snapshot file is truncated.";
+    case SnapshotResult_MapError:
+        return "Could not map snapshot into guest memory.";
+    default:
+        BAIL("Invalid SnapshotResult.");
+    }
+}
+
+SnapshotResult Snapshot_save(const char *const filename, const Cpu *const cpu,
+                             const SegmentedMemory *const mem, const SnapshotSource *const source)
+{
+    const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+        return SnapshotResult_OpenError;
+
+    const SnapshotResult result = write_snapshot(fd, cpu, mem, source);
+
+    if (close(fd) < 0 && result == SnapshotResult_Ok)
+        return SnapshotResult_WriteError;
+
+    return result;
+}
+
+SnapshotResult Snapshot_open(const char *const filename, Snapshot *const out)
+{
+    const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return SnapshotResult_OpenError;
+
+    const SnapshotResult result = read_snapshot(fd, out);
+
+    if (result != SnapshotResult_Ok)
+        close(fd);
+
+    return result;
+}
+
+SnapshotResult Snapshot_capture(const Cpu *const cpu, const SegmentedMemory *const mem,
+                                Snapshot *const out)
+{
+    // tmpfile() unlinks the file right away, so it goes away once the last mapping is gone
+    FILE *const file = tmpfile();
+
+    if (file == nullptr)
+        return SnapshotResult_OpenError;
+
+    const int fd = dup(fileno(file));
+    fclose(file);
+
+    if (fd < 0)
+        return SnapshotResult_OpenError;
+
+    SnapshotResult result = write_snapshot(fd, cpu, mem, nullptr);
+
+    if (result == SnapshotResult_Ok)
+        result = read_snapshot(fd, out);
+
+    if (result != SnapshotResult_Ok)
+        close(fd);
+
+    return result;
+}
+
+SnapshotResult Snapshot_instantiate(const Snapshot *const snapshot, Cpu *const cpu,
+                                    SegmentedMemory *const mem)
+{
+    SegmentedMemory new_mem = SegmentedMemory_new();
+
+    for (size_t i = 0; i < snapshot->runs_size; ++i) {
+        const SnapshotRun *const run = &snapshot->runs[i];
+        u8 *const dest = &new_mem.data[(size_t)run->first_page * MEMORY_PAGE_SIZE];
+        const size_t size = (size_t)run->pages_size * MEMORY_PAGE_SIZE;
+
+        if (mmap(dest, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, snapshot->fd,
+                 (off_t)run->offset) == MAP_FAILED) {
+            SegmentedMemory_destroy(&new_mem);
+            return SnapshotResult_MapError;
+        }
+
+        for (size_t page = run->first_page; page < (size_t)run->first_page + run->pages_size;
+             ++page)
+            new_mem.touched_pages[page / 64] |= 1ULL << (page % 64);
+    }
+
+    for (size_t i = 0; i < snapshot->segments_size; ++i)
+        SegmentedMemory_add_segment(&new_mem, snapshot->segments[i]);
+
+    SegmentedMemory_set_heap(&new_mem, snapshot->heap);
+
+    HostState *const host = cpu->host;
+    *cpu = snapshot->cpu;
+    cpu->host = host;
+    *mem = new_mem;
+
+    return SnapshotResult_Ok;
+}
+
+SnapshotResult Snapshot_fork(const Cpu *const cpu, const SegmentedMemory *const mem,
+                             Cpu *const child_cpu, SegmentedMemory *const child_mem)
+{
+    Snapshot snapshot = {};
+    SnapshotResult result = Snapshot_capture(cpu, mem, &snapshot);
+
+    if (result != SnapshotResult_Ok)
+        return result;
+
+    result = Snapshot_instantiate(&snapshot, child_cpu, child_mem);
+    child_cpu->host = cpu->host;
+    Snapshot_destroy(&snapshot);
+
+    return result;
+}
+
+void Snapshot_destroy(Snapshot *const snapshot)
+{
+    if (snapshot->fd >= 0)
+        close(snapshot->fd);
+
+    free(snapshot->segments);
+    free(snapshot->runs);
+
+    snapshot->fd = -1;
+    snapshot->segments = nullptr;
+    snapshot->segments_size = 0;
+    snapshot->runs = nullptr;
+    snapshot->runs_size = 0;
+}
@@ -0,0 +1,140 @@
+#ifndef RV32_EMU_SNAPSHOT_H
+#define RV32_EMU_SNAPSHOT_H
+
+#include "cpu.h"
+#include "memory.h"
+#include "sha256.h"
+#include "stdinc.h"
+#include <stddef.h>
+
+typedef enum SnapshotResult : u8 {
+    SnapshotResult_Ok = 0,
+    SnapshotResult_OpenError,
+    SnapshotResult_ReadError,
+    SnapshotResult_WriteError,
+    SnapshotResult_InvalidMagicNumber,
+    SnapshotResult_UnsupportedVersion,
+    SnapshotResult_Truncated,
+    SnapshotResult_MapError,
+} SnapshotResult;
+
+/**
+ * \brief A run of consecutive non-zero pages stored in a snapshot file.
+ */
+typedef struct SnapshotRun {
+    u32 first_page;
+    u32 pages_size;
+    u64 offset;
+} SnapshotRun;
+
+/**
+ * \brief Identifies the file a snapshot was made from, such as the ELF behind a cached image.
+ *
+ * All zeroes for snapshots that were not made from a file.
+ */
+typedef struct SnapshotSource {
+    u64 size;
+    u8 sha256[SHA256_SIZE];
+} SnapshotSource;
+
+/**
+ * \brief An opened snapshot, ready to be instantiated any number of times.
+ *
+ * Page data is stored page-aligned in the backing file, so instantiating a snapshot maps it
+ * copy-on-write instead of reading it.
+ */
+typedef struct Snapshot {
+    int fd;
+    Cpu cpu;
+    Heap heap;
+    Segment *segments;
+    size_t segments_size;
+    SnapshotRun *runs;
+    size_t runs_size;
+    SnapshotSource source;
+} Snapshot;
+
+/**
+ * \brief Returns a textual message for a SnapshotResult.
+ *
+ * \param result The SnapshotResult to return as a message.
+ *
+ * \return Textual message for result.
+ */
+[[nodiscard]] const char *SnapshotResult_display(SnapshotResult result);
+
+/**
+ * \brief Saves the complete machine state to a file.
+ *
+ * Only pages that may hold non-zero data are considered, and all-zero pages among them are skipped.
+ * Pending guest output is flushed beforehand.
+ *
+ * \param filename Path of the file to write.
+ * \param cpu The CPU state to save.
+ * \param mem The memory to save.
+ * \param source The file the state was made from, or nullptr if none.
+ *
+ * \return The result of the operation.
+ */
+[[nodiscard]] SnapshotResult Snapshot_save(const char *filename, const Cpu *cpu,
+                                           const SegmentedMemory *mem,
+                                           const SnapshotSource *source);
+
+/**
+ * \brief Opens and validates a snapshot file.
+ *
+ * \param filename Path of the file to open.
+ * \param out The opened snapshot. Must be destroyed with Snapshot_destroy().
+ *
+ * \return The result of the operation.
+ */
+[[nodiscard]] SnapshotResult Snapshot_open(const char *filename, Snapshot *out);
+
+/**
+ * \brief Captures the machine state into an anonymous snapshot.
+ *
+ * \param cpu The CPU state to capture.
+ * \param mem The memory to capture.
+ * \param out The captured snapshot. Must be destroyed with Snapshot_destroy().
+ *
+ * \return The result of the operation.
+ */
+[[nodiscard]] SnapshotResult Snapshot_capture(const Cpu *cpu, const SegmentedMemory *mem,
+                                              Snapshot *out);
+
+/**
+ * \brief Creates a new machine from a snapshot.
+ *
+ * Snapshot pages are mapped copy-on-write, so this takes time proportional to the number of page
+ * runs rather than to the amount of memory. The new memory stays valid after the snapshot is
+ * destroyed.
+ *
+ * \param snapshot The snapshot to instantiate.
+ * \param cpu Will be set to the saved CPU state. Its host state is kept, since host files cannot
+ * be saved.
+ * \param mem Will be set to a new SegmentedMemory. Must be destroyed with SegmentedMemory_destroy().
+ *
+ * \return The result of the operation.
+ */
+[[nodiscard]] SnapshotResult Snapshot_instantiate(const Snapshot *snapshot, Cpu *cpu,
+                                                  SegmentedMemory *mem);
+
+/**
+ * \brief Forks a running machine in-process.
+ *
+ * The child starts from the current state of the parent, and the two evolve independently
+ * afterwards. Child memory is copy-on-write, while host state such as open files stays shared.
+ *
+ * \param cpu The parent CPU.
+ * \param mem The parent memory.
+ * \param child_cpu Will be set to the child CPU.
+ * \param child_mem Will be set to the child memory.
+ *
+ * \return The result of the operation.
+ */
+[[nodiscard]] SnapshotResult Snapshot_fork(const Cpu *cpu, const SegmentedMemory *mem,
+                                           Cpu *child_cpu, SegmentedMemory *child_mem);
+
+void Snapshot_destroy(Snapshot *snapshot);
+
+#endif
@@ -3,7 +3,6 @@
 #include "numeric.h"
 #include "stdinc.h"
 #include <stddef.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -96,11 +95,32 @@ void String_push_raw(String *const str, const char *const other)
     str->data[str->size] = '\0';
 }
 
+static constexpr char HEX_DIGITS[16] = "0123456789abcdef";
+
 void String_push_hex(String *const str, const u8 byte)
 {
-    char buf[3] = {};
-    snprintf(buf, sizeof(buf), "%02x", byte);
-    String_push_raw(str, buf);
+    String_push_hex_bytes(str, &byte, 1);
+}
+
+void String_push_hex_bytes(String *const str, const u8 *const data, const size_t size)
+{
+    String_reserve(str, 2 * size);
+
+    char *dest = str->data + str->size;
+
+    for (size_t i = 0; i < size; ++i) {
+        *dest++ = HEX_DIGITS[data[i] >> 4];
+        *dest++ = HEX_DIGITS[data[i] & 0xF];
+    }
+
+    str->size += 2 * size;
+    str->data[str->size] = '\0';
+}
+
+void String_reserve(String *const str, const size_t additional)
+{
+    if (str->size + additional > str->capacity)
+        String_reallocate(str, sz_max(2 * str->capacity, str->size + additional));
 }
 
 String String_clone(const String str)
@@ -120,6 +140,15 @@ void String_clear(String *const str)
     str->capacity = 0;
 }
 
+void String_truncate(String *const str, const size_t size)
+{
+    if (size >= str->size)
+        return;
+
+    str->size = size;
+    str->data[size] = '\0';
+}
+
 void String_destroy(String *const str)
 {
     free(str->data);
@@ -11,6 +11,14 @@ typedef struct String {
     size_t capacity;
 } String;
 
+/**
+ * \brief A borrowed, non-owning view of a string.
+ */
+typedef struct StrView {
+    const char *data;
+    size_t size;
+} StrView;
+
 [[nodiscard]] String String_new(void);
 
 [[nodiscard]] String String_with_capacity(size_t initial_capacity);
@@ -25,10 +33,29 @@ void String_push_raw(String *str, const char *other);
 
 void String_push_hex(String *str, u8 byte);
 
+/**
+ * \brief Appends bytes as pairs of lowercase hex digits.
+ *
+ * \param str The String to append to.
+ * \param data The bytes to append.
+ * \param size Number of bytes to append.
+ */
+void String_push_hex_bytes(String *str, const u8 *data, size_t size);
+
+/**
+ * \brief Makes sure a String can grow by additional bytes without reallocating.
+ */
+void String_reserve(String *str, size_t additional);
+
 String String_clone(String str);
 
 void String_clear(String *str);
 
+/**
+ * \brief Shortens a String to size bytes, keeping its capacity.
+ */
+void String_truncate(String *str, size_t size);
+
 void String_destroy(String *str);
 
 #endif
@@ -0,0 +1,315 @@
+#include "symbols.h"
+#include "elf_util.h"
+#include "macros.h"
+#include "numeric.h"
+#include "stdinc.h"
+#include <elf.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct SymbolEntry {
+    u32 addr;
+    u32 size;
+    u32 name;
+    u32 order;
+} SymbolEntry;
+
+static int SymbolEntry_compare(const void *const a_raw, const void *const b_raw)
+{
+    const SymbolEntry *const a = a_raw;
+    const SymbolEntry *const b = b_raw;
+
+    if (a->addr != b->addr)
+        return a->addr < b->addr ? -1 : 1;
+
+    return a->order < b->order ? -1 : (a->order > b->order);
+}
+
+static int SymbolName_compare(const void *const a_raw, const void *const b_raw)
+{
+    const SymbolName *const a = a_raw;
+    const SymbolName *const b = b_raw;
+    const int cmp = strcmp(a->name, b->name);
+
+    if (cmp != 0)
+        return cmp;
+
+    // Names are appended to the pool in push order
+    return a->name < b->name ? -1 : (a->name > b->name);
+}
+
+[[nodiscard]] static bool is_indexed_symbol(const Elf32_Sym *const sym, const char *const name)
+{
+    const u8 type = ELF32_ST_TYPE(sym->st_info);
+
+    if (type != STT_NOTYPE && type != STT_FUNC && type != STT_OBJECT)
+        return false;
+
+    if (sym->st_shndx == SHN_UNDEF || sym->st_shndx >= SHN_LORESERVE)
+        return false;
+
+    // Skip mapping symbols ($x, $d) and assembler-local labels
+    return name[0] != '\0' && name[0] != '$' && strncmp(name, ".L", 2) != 0;
+}
+
+SymbolTable SymbolTable_new(void)
+{
+    return (SymbolTable){
+        .addrs = nullptr,
+        .sizes = nullptr,
+        .names = nullptr,
+        .symbols_size = 0,
+        .symbols_capacity = 0,
+        .name_pool = nullptr,
+        .name_pool_size = 0,
+        .name_pool_capacity = 0,
+        .by_name = nullptr,
+        .by_name_size = 0,
+    };
+}
+
+ElfResult SymbolTable_from_elf(const u8 *const elf_data, const size_t elf_data_size,
+                               const Elf32_Ehdr *const ehdr, SymbolTable *const out)
+{
+    SymbolTable table = SymbolTable_new();
+
+    if (ehdr->e_shoff == 0 || ehdr->e_shnum == 0) {
+        *out = table;
+        return ElfResult_Ok;
+    }
+
+    if ((size_t)ehdr->e_shoff + ((size_t)ehdr->e_shnum * sizeof(Elf32_Shdr)) > elf_data_size)
+        return ElfResult_FileTooSmall;
+
+    const Elf32_Shdr *const shdrs = (const Elf32_Shdr *)&elf_data[ehdr->e_shoff];
+
+    for (size_t i = 0; i < ehdr->e_shnum; ++i) {
+        const Elf32_Shdr *const symtab = &shdrs[i];
+
+        if (symtab->sh_type != SHT_SYMTAB)
+            continue;
+
+        if (symtab->sh_link >= ehdr->e_shnum || symtab->sh_entsize != sizeof(Elf32_Sym))
+            return ElfResult_InvalidSectionHeaderSize;
+
+        const Elf32_Shdr *const strtab = &shdrs[symtab->sh_link];
+
+        if ((size_t)symtab->sh_offset + symtab->sh_size > elf_data_size ||
+            (size_t)strtab->sh_offset + strtab->sh_size > elf_data_size)
+            return ElfResult_SectionDataFileOutOfBounds;
+
+        const Elf32_Sym *const syms = (const Elf32_Sym *)&elf_data[symtab->sh_offset];
+        const char *const strs = (const char *)&elf_data[strtab->sh_offset];
+        const size_t syms_size = symtab->sh_size / sizeof(Elf32_Sym);
+
+        // Global symbols go first so that they win over local labels at the same address
+        for (size_t pass = 0; pass < 2; ++pass) {
+            for (size_t j = 0; j < syms_size; ++j) {
+                const Elf32_Sym *const sym = &syms[j];
+                const bool global = ELF32_ST_BIND(sym->st_info) != STB_LOCAL;
+
+                if (global != (pass == 0) || sym->st_name >= strtab->sh_size)
+                    continue;
+
+                const char *const name = &strs[sym->st_name];
+
+                if (memchr(name, '\0', strtab->sh_size - sym->st_name) == nullptr)
+                    continue;
+
+                if (is_indexed_symbol(sym, name))
+                    SymbolTable_push(&table, sym->st_value, sym->st_size, name);
+            }
+        }
+    }
+
+    SymbolTable_finish(&table);
+
+    *out = table;
+    return ElfResult_Ok;
+}
+
+void SymbolTable_push(SymbolTable *const table, const u32 addr, const u32 size,
+                      const char *const name)
+{
+    if (table->symbols_size == table->symbols_capacity) {
+        const size_t new_capacity = table->symbols_capacity == 0 ? 64 : 2 * table->symbols_capacity;
+
+        u32 *const new_addrs = realloc(table->addrs, new_capacity * sizeof(*new_addrs));
+        if (new_addrs != nullptr)
+            table->addrs = new_addrs;
+
+        u32 *const new_sizes = realloc(table->sizes, new_capacity * sizeof(*new_sizes));
+        if (new_sizes != nullptr)
+            table->sizes = new_sizes;
+
+        u32 *const new_names = realloc(table->names, new_capacity * sizeof(*new_names));
+        if (new_names != nullptr)
+            table->names = new_names;
+
+        if (new_addrs == nullptr || new_sizes == nullptr || new_names == nullptr)
+            BAIL("Could not reallocate memory for symbols");
+
+        table->symbols_capacity = new_capacity;
+    }
+
+    const size_t name_size = strlen(name) + 1;
+
+    if (table->name_pool_size + name_size > table->name_pool_capacity) {
+        const size_t new_capacity =
+            sz_max(2 * table->name_pool_capacity, table->name_pool_size + name_size);
+        char *const new_pool = realloc(table->name_pool, new_capacity);
+
+        if (new_pool == nullptr)
+            BAIL("Could not reallocate memory for symbol names");
+
+        table->name_pool = new_pool;
+        table->name_pool_capacity = new_capacity;
+    }
+
+    memcpy(&table->name_pool[table->name_pool_size], name, name_size);
+
+    table->addrs[table->symbols_size] = addr;
+    table->sizes[table->symbols_size] = size;
+    table->names[table->symbols_size] = (u32)table->name_pool_size;
+
+    table->name_pool_size += name_size;
+    ++table->symbols_size;
+}
+
+void SymbolTable_finish(SymbolTable *const table)
+{
+    if (table->symbols_size == 0)
+        return;
+
+    SymbolEntry *const entries = malloc(table->symbols_size * sizeof(*entries));
+
+    if (entries == nullptr)
+        BAIL("Could not allocate memory for symbols");
+
+    for (size_t i = 0; i < table->symbols_size; ++i) {
+        entries[i] = (SymbolEntry){
+            .addr = table->addrs[i],
+            .size = table->sizes[i],
+            .name = table->names[i],
+            .order = (u32)i,
+        };
+    }
+
+    SymbolName *const by_name = realloc(table->by_name, table->symbols_size * sizeof(*by_name));
+
+    if (by_name == nullptr)
+        BAIL("Could not allocate memory for symbol names");
+
+    for (size_t i = 0; i < table->symbols_size; ++i) {
+        by_name[i] = (SymbolName){
+            .name = &table->name_pool[table->names[i]],
+            .addr = table->addrs[i],
+        };
+    }
+
+    qsort(by_name, table->symbols_size, sizeof(*by_name), SymbolName_compare);
+
+    table->by_name = by_name;
+    table->by_name_size = table->symbols_size;
+
+    qsort(entries, table->symbols_size, sizeof(*entries), SymbolEntry_compare);
+
+    size_t n = 0;
+
+    for (size_t i = 0; i < table->symbols_size; ++i) {
+        if (n != 0 && table->addrs[n - 1] == entries[i].addr)
+            continue;
+
+        table->addrs[n] = entries[i].addr;
+        table->sizes[n] = entries[i].size;
+        table->names[n] = entries[i].name;
+        ++n;
+    }
+
+    table->symbols_size = n;
+    free(entries);
+}
+
+ptrdiff_t SymbolTable_lookup(const SymbolTable *const table, const u32 addr)
+{
+    if (table->symbols_size == 0 || addr < table->addrs[0])
+        return -1;
+
+    // Branchless lower bound over the address array
+    const u32 *base = table->addrs;
+    size_t n = table->symbols_size;
+
+    while (n > 1) {
+        const size_t half = n / 2;
+        base = (base[half] <= addr) ? base + half : base;
+        n -= half;
+    }
+
+    const ptrdiff_t index = base - table->addrs;
+    const u32 size = table->sizes[index];
+
+    if (size != 0 && addr - *base >= size)
+        return -1;
+
+    return index;
+}
+
+bool SymbolTable_find(const SymbolTable *const table, const char *const name, u32 *const out_addr)
+{
+    // Lower bound over the name index, so that the first of several equal names is found
+    size_t lo = 0;
+    size_t hi = table->by_name_size;
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (strcmp(table->by_name[mid].name, name) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == table->by_name_size || strcmp(table->by_name[lo].name, name) != 0)
+        return false;
+
+    *out_addr = table->by_name[lo].addr;
+    return true;
+}
+
+const char *SymbolTable_name(const SymbolTable *const table, const size_t index)
+{
+    return &table->name_pool[table->names[index]];
+}
+
+void SymbolTable_format(const SymbolTable *const table, const u32 addr, char *const buf,
+                        const size_t buf_size)
+{
+    const ptrdiff_t index = SymbolTable_lookup(table, addr);
+
+    if (index < 0) {
+        if (buf_size != 0)
+            buf[0] = '\0';
+
+        return;
+    }
+
+    const u32 offset = addr - table->addrs[index];
+
+    if (offset == 0)
+        snprintf(buf, buf_size, "%s", SymbolTable_name(table, (size_t)index));
+    else
+        snprintf(buf, buf_size, "%s+0x%X", SymbolTable_name(table, (size_t)index), offset);
+}
+
+void SymbolTable_destroy(SymbolTable *const table)
+{
+    free(table->addrs);
+    free(table->sizes);
+    free(table->names);
+    free(table->name_pool);
+    free(table->by_name);
+
+    *table = SymbolTable_new();
+}
@@ -0,0 +1,122 @@
+#ifndef RV32_EMU_SYMBOLS_H
+#define RV32_EMU_SYMBOLS_H
+
+#include "elf_util.h"
+#include "stdinc.h"
+#include <elf.h>
+#include <stddef.h>
+
+/**
+ * \brief Entry of the name index of a SymbolTable.
+ */
+typedef struct SymbolName {
+    const char *name; // Points into the table's name pool
+    u32 addr;
+} SymbolName;
+
+/**
+ * \brief Address-to-symbol index built from an ELF symbol table.
+ *
+ * Symbol start addresses are kept in their own sorted array so that lookups only touch a dense
+ * run of u32's. sizes[i] and names[i] belong to the symbol starting at addrs[i].
+ *
+ * Only one symbol is kept per address, so names are also indexed on their own, aliases included.
+ */
+typedef struct SymbolTable {
+    u32 *addrs;
+    u32 *sizes;
+    u32 *names;
+    size_t symbols_size;
+    size_t symbols_capacity;
+    char *name_pool;
+    size_t name_pool_size;
+    size_t name_pool_capacity;
+    SymbolName *by_name; // Sorted by name, built by SymbolTable_finish()
+    size_t by_name_size;
+} SymbolTable;
+
+[[nodiscard]] SymbolTable SymbolTable_new(void);
+
+/**
+ * \brief Loads every function, object and label symbol from an ELF file.
+ *
+ * \param elf_data ELF binary data, as validated by parse_elf().
+ * \param elf_data_size Size of elf_data.
+ * \param ehdr The ELF header returned by parse_elf().
+ * \param out The resulting table. Will be empty if the file has no symbol table.
+ *
+ * \return The result of the operation.
+ */
+[[nodiscard]] ElfResult SymbolTable_from_elf(const u8 *elf_data, size_t elf_data_size,
+                                             const Elf32_Ehdr *ehdr, SymbolTable *out);
+
+/**
+ * \brief Adds a symbol to a table.
+ *
+ * SymbolTable_finish() must be called after the last symbol is added and before any lookup.
+ *
+ * \param table The table to add to.
+ * \param addr Start address of the symbol.
+ * \param size Size of the symbol, or 0 if unknown.
+ * \param name Name of the symbol. Will be copied.
+ */
+void SymbolTable_push(SymbolTable *table, u32 addr, u32 size, const char *name);
+
+/**
+ * \brief Sorts a table by address, keeping only the first symbol pushed for each address.
+ *
+ * Every symbol pushed, including the ones dropped here, can still be found by name.
+ *
+ * \param table The table to sort.
+ */
+void SymbolTable_finish(SymbolTable *table);
+
+/**
+ * \brief Finds the symbol an address belongs to.
+ *
+ * This is the symbol with the greatest start address not above addr, as long as addr falls within
+ * its size (symbols of unknown size extend up to the next one).
+ *
+ * \param table The table to search.
+ * \param addr The address to look up.
+ *
+ * \return Index of the symbol, or -1 if there is none.
+ */
+[[nodiscard]] ptrdiff_t SymbolTable_lookup(const SymbolTable *table, u32 addr);
+
+/**
+ * \brief Finds a symbol by name.
+ *
+ * If several symbols share the name, the first one pushed is returned.
+ *
+ * \param table The table to search.
+ * \param name Name of the symbol.
+ * \param out_addr Will be set to the symbol's start address.
+ *
+ * \return true if the symbol exists, false otherwise.
+ */
+[[nodiscard]] bool SymbolTable_find(const SymbolTable *table, const char *name, u32 *out_addr);
+
+/**
+ * \brief Returns the name of a symbol.
+ *
+ * \param table The table holding the symbol.
+ * \param index Index of the symbol, as returned by SymbolTable_lookup().
+ *
+ * \return The symbol's name.
+ */
+[[nodiscard]] const char *SymbolTable_name(const SymbolTable *table, size_t index);
+
+/**
+ * \brief Formats an address as "symbol+offset".
+ *
+ * \param table The table to search.
+ * \param addr The address to format.
+ * \param buf Where to write the result. Will be set to an empty string if no symbol is found.
+ * \param buf_size Size of buf.
+ */
+void SymbolTable_format(const SymbolTable *table, u32 addr, char *buf, size_t buf_size);
+
+void SymbolTable_destroy(SymbolTable *table);
+
+#endif
@@ -0,0 +1,848 @@
+#include "syscall.h"
+#include "console.h"
+#include "cpu.h"
+#include "macros.h"
+#include "memory.h"
+#include "replay.h"
+#include "stdinc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+static constexpr i32 GUEST_AT_FDCWD = -100;
+
+// Open flags as defined by the generic Linux ABI, which RV32 uses
+static constexpr u32 GUEST_O_ACCMODE = 0x3;
+static constexpr u32 GUEST_O_CREAT = 0100;
+static constexpr u32 GUEST_O_EXCL = 0200;
+static constexpr u32 GUEST_O_NOCTTY = 0400;
+static constexpr u32 GUEST_O_TRUNC = 01000;
+static constexpr u32 GUEST_O_APPEND = 02000;
+static constexpr u32 GUEST_O_NONBLOCK = 04000;
+static constexpr u32 GUEST_O_DIRECTORY = 0200000;
+static constexpr u32 GUEST_O_CLOEXEC = 02000000;
+
+/**
+ * \brief The stat structure filled in by fstat, as laid out by the RV32 Linux ABI.
+ */
+typedef struct GuestStat {
+    u64 dev;
+    u64 ino;
+    u32 mode;
+    u32 nlink;
+    u32 uid;
+    u32 gid;
+    u64 rdev;
+    u64 pad_1;
+    i64 size;
+    i32 blksize;
+    i32 pad_2;
+    i64 blocks;
+    i32 atime;
+    i32 atime_nsec;
+    i32 mtime;
+    i32 mtime_nsec;
+    i32 ctime;
+    i32 ctime_nsec;
+    i32 reserved[2];
+} GuestStat;
+
+static_assert(sizeof(GuestStat) == 104);
+
+// A time query within this many instructions of the previous one counts towards a polling loop
+static constexpr u64 POLL_WINDOW = 1000;
+static constexpr u32 POLL_STREAK_MIN = 4;
+static constexpr u32 POLL_SKIP_MAX_SHIFT = 6;
+static constexpr u64 POLL_SKIP_US = 1000;
+
+static SyscallAbi syscall_abi = SyscallAbi_Spim;
+static u32 virtual_time_mhz = 0;
+
+bool SyscallAbi_parse(const char *const name, SyscallAbi *const out)
+{
+    if (strcmp(name, "spim") == 0) {
+        *out = SyscallAbi_Spim;
+        return true;
+    }
+
+    if (strcmp(name, "linux") == 0) {
+        *out = SyscallAbi_Linux;
+        return true;
+    }
+
+    return false;
+}
+
+void set_syscall_abi(const SyscallAbi abi)
+{
+    syscall_abi = abi;
+}
+
+void set_virtual_time(const u32 mhz)
+{
+    virtual_time_mhz = mhz;
+}
+
+/**
+ * \brief Returns the virtual guest time in microseconds since the epoch.
+ *
+ * The clock starts at the epoch and advances with retired instructions. A run
+ * of queries in quick succession is taken as a polling loop, and skips the clock ahead by
+ * increasingly large steps until the guest does something else.
+ */
+[[nodiscard]] static u64 virtual_time_us(Cpu *const cpu)
+{
+    VirtualClock *const clock = &cpu->clock;
+
+    if (cpu->instret - clock->last_query < POLL_WINDOW) {
+        ++clock->poll_streak;
+
+        if (clock->poll_streak >= POLL_STREAK_MIN) {
+            const u32 shift = clock->poll_streak - POLL_STREAK_MIN;
+            clock->skipped_us += POLL_SKIP_US << (shift < POLL_SKIP_MAX_SHIFT ? shift
+                                                                               : POLL_SKIP_MAX_SHIFT);
+        }
+    } else {
+        clock->poll_streak = 0;
+    }
+
+    clock->last_query = cpu->instret;
+
+    return (cpu->instret / virtual_time_mhz) + clock->skipped_us;
+}
+
+u64 guest_time_us(Cpu *const cpu)
+{
+    u64 us = 0;
+
+    if (virtual_time_mhz != 0) {
+        us = virtual_time_us(cpu);
+    } else {
+        struct timeval time = {};
+        gettimeofday(&time, nullptr);
+
+        us = (time.tv_sec * 1'000'000ULL) + time.tv_usec;
+    }
+
+    size_t size = sizeof(us);
+
+    if (!replay_next(ReplayEvent_Time, cpu->instret, &us, &size))
+        replay_record(ReplayEvent_Time, cpu->instret, &us, sizeof(us));
+
+    return us;
+}
+
+static void guest_sleep_us(Cpu *const cpu, const u64 us)
+{
+    // Replayed time does not depend on how long the host actually slept
+    if (virtual_time_mhz == 0 && replay_replaying())
+        return;
+
+    if (virtual_time_mhz == 0) {
+        usleep(us);
+        return;
+    }
+
+    cpu->clock.skipped_us += us;
+    cpu->clock.poll_streak = 0;
+}
+
+void print_guest_string(const Memory *const mem, u32 addr)
+{
+    while (true) {
+        const u32 chunk_size = MEMORY_PAGE_SIZE - (addr % MEMORY_PAGE_SIZE);
+        const u8 *chunk = nullptr;
+
+        if (Memory_read_span(mem, addr, chunk_size, &chunk) != MemoryResult_Ok) {
+            // The string may still end before the faulting byte, so fall back to the slow path
+            char buf[256] = {};
+            size_t size = 0;
+
+            while ((buf[size] = (char)Memory_read(mem, addr)) != '\0') {
+                ++addr;
+
+                if (++size == sizeof(buf)) {
+                    console_write(buf, size);
+                    size = 0;
+                }
+            }
+
+            console_write(buf, size);
+            return;
+        }
+
+        const u8 *const end = memchr(chunk, '\0', chunk_size);
+        const size_t size = end != nullptr ? (size_t)(end - chunk) : chunk_size;
+
+        console_write((const char *)chunk, size);
+
+        if (end != nullptr)
+            return;
+
+        addr += chunk_size;
+    }
+}
+
+/**
+ * \brief Reads a line from stdin into guest memory, without its trailing newline.
+ *
+ * At most size - 1 characters are read, and the result is always NUL-terminated.
+ */
+static void read_guest_string(const Cpu *const cpu, Memory *const mem, const u32 addr,
+                              const u32 size)
+{
+    if (size == 0)
+        return;
+
+    u8 *dest = nullptr;
+    char *buf = nullptr;
+
+    if (Memory_write_span(mem, addr, size, &dest) != MemoryResult_Ok) {
+        // Let Memory_write report the exact faulting address
+        buf = malloc(size);
+        dest = (u8 *)buf;
+    }
+
+    size_t written = size;
+
+    if (!replay_next(ReplayEvent_Input, cpu->instret, dest, &written)) {
+        console_flush();
+        written = 0;
+
+        if (!cpu->host->stdin_eof && fgets((char *)dest, (int)size, stdin) != nullptr) {
+            const size_t len = strlen((char *)dest);
+
+            if (len != 0 && dest[len - 1] == '\n')
+                dest[len - 1] = '\0';
+
+            written = strlen((char *)dest) + 1;
+        }
+
+        replay_record(ReplayEvent_Input, cpu->instret, dest, written);
+    }
+
+    if (buf != nullptr) {
+        for (size_t i = 0; i < written; ++i)
+            Memory_write(mem, addr + i, (u8)buf[i]);
+
+        free(buf);
+    }
+}
+
+/**
+ * \brief Replays a recorded input value into out.
+ *
+ * \return true if the value was replayed, false if it has to be read live.
+ */
+[[nodiscard]] static bool replay_input(const Cpu *const cpu, void *const out, size_t size)
+{
+    return replay_next(ReplayEvent_Input, cpu->instret, out, &size);
+}
+
+static void record_input(const Cpu *const cpu, const void *const data, const size_t size)
+{
+    replay_record(ReplayEvent_Input, cpu->instret, data, size);
+}
+
+/**
+ * \brief Handles an ecall under the SPIM ABI.
+ */
+[[nodiscard]] static CpuStepResult handle_spim_ecall(Cpu *const cpu, Memory *const mem)
+{
+    const u32 a7 = cpu->regs[17];
+    const u32 a0 = cpu->regs[10];
+    const u32 a1 = cpu->regs[11];
+
+    const float fa0 = cpu->float_regs[10];
+
+    switch (a7) {
+    case Syscall_PrintInteger:
+        console_printf("%i", (i32)a0);
+        break;
+
+    case Syscall_PrintFloat:
+        console_printf("%f", fa0);
+        break;
+
+    case Syscall_PrintString:
+        print_guest_string(mem, a0);
+        break;
+
+    case Syscall_ReadInteger:
+        if (replay_input(cpu, &cpu->regs[10], sizeof(cpu->regs[10])))
+            break;
+
+        console_flush();
+        int n = 0;
+
+        if (!cpu->host->stdin_eof && scanf("%d", &n) == 1)
+            cpu->regs[10] = n;
+
+        record_input(cpu, &cpu->regs[10], sizeof(cpu->regs[10]));
+        break;
+
+    case Syscall_ReadFloat:
+        if (replay_input(cpu, &cpu->float_regs[10], sizeof(cpu->float_regs[10])))
+            break;
+
+        console_flush();
+        float f = 0;
+
+        if (!cpu->host->stdin_eof && scanf("%f", &f) == 1)
+            cpu->float_regs[10] = f;
+
+        record_input(cpu, &cpu->float_regs[10], sizeof(cpu->float_regs[10]));
+        break;
+
+    case Syscall_ReadString:
+        read_guest_string(cpu, mem, a0, a1);
+        break;
+
+    case Syscall_Sbrk:
+        u32 old_top = 0;
+
+        if (Memory_sbrk(mem, (i32)a0, &old_top) == MemoryResult_Ok)
+            cpu->regs[10] = old_top;
+        else
+            cpu->regs[10] = (u32)-1;
+
+        break;
+
+    case Syscall_Exit:
+        return CpuStepResult_Exit;
+
+    case Syscall_Exit2:
+        cpu->exit_code = (i32)a0;
+        return CpuStepResult_Exit;
+
+    case Syscall_PrintChar:
+        console_putc((char)a0);
+        break;
+
+    case Syscall_ReadChar:
+        if (replay_input(cpu, &cpu->regs[10], sizeof(cpu->regs[10])))
+            break;
+
+        console_flush();
+        char ch = '\0';
+
+        if (!cpu->host->stdin_eof && scanf(" %c", &ch) == 1)
+            cpu->regs[10] = (u32)ch;
+
+        record_input(cpu, &cpu->regs[10], sizeof(cpu->regs[10]));
+        break;
+
+    case Syscall_Time:
+        const u64 ms = guest_time_us(cpu) / 1000;
+
+        cpu->regs[10] = ms & 0xFFFF'FFFF;
+        cpu->regs[11] = (ms >> 32) & 0xFFFF'FFFF;
+        break;
+
+    case Syscall_Sleep:
+        guest_sleep_us(cpu, 1000ULL * a0);
+        break;
+
+    case Syscall_PrintHex:
+        console_printf("%08X", a0);
+        break;
+
+    case Syscall_PrintBinary:
+        console_printf("%032B", a0);
+        break;
+
+    case Syscall_PrintUnsigned:
+        console_printf("%u", a0);
+        break;
+
+    default:
+        BAIL("Illegal ecall number (%u)", a7);
+    }
+
+    return CpuStepResult_None;
+}
+
+/**
+ * \brief Copies a NUL-terminated string from guest memory into a host buffer.
+ *
+ * \return 0 on success, or a negated errno value.
+ */
+[[nodiscard]] static i32 copy_guest_string(const Memory *const mem, u32 addr, char *const out,
+                                           const size_t size)
+{
+    size_t len = 0;
+
+    while (len < size) {
+        const u32 chunk_size = MEMORY_PAGE_SIZE - (addr % MEMORY_PAGE_SIZE);
+        const u8 *chunk = nullptr;
+
+        if (Memory_read_span(mem, addr, chunk_size, &chunk) != MemoryResult_Ok)
+            return -EFAULT;
+
+        const size_t copy_size = chunk_size < size - len ? chunk_size : size - len;
+        const u8 *const end = memchr(chunk, '\0', copy_size);
+
+        if (end != nullptr) {
+            memcpy(out + len, chunk, end - chunk + 1);
+            return 0;
+        }
+
+        memcpy(out + len, chunk, copy_size);
+        len += copy_size;
+        addr += chunk_size;
+    }
+
+    return -ENAMETOOLONG;
+}
+
+/**
+ * \brief Returns the host file descriptor backing a guest file descriptor, or -1 if there is none.
+ */
+[[nodiscard]] static int host_fd(const HostState *const host, const u32 guest_fd)
+{
+    if (guest_fd >= CPU_FD_TABLE_SIZE)
+        return -1;
+
+    return host->fds[guest_fd] - 1;
+}
+
+[[nodiscard]] static int host_open_flags(const u32 flags)
+{
+    static constexpr struct {
+        u32 guest;
+        int host;
+    } flag_map[] = {
+        {GUEST_O_CREAT, O_CREAT},
+        {GUEST_O_EXCL, O_EXCL},
+        {GUEST_O_NOCTTY, O_NOCTTY},
+        {GUEST_O_TRUNC, O_TRUNC},
+        {GUEST_O_APPEND, O_APPEND},
+        {GUEST_O_NONBLOCK, O_NONBLOCK},
+        {GUEST_O_DIRECTORY, O_DIRECTORY},
+        {GUEST_O_CLOEXEC, O_CLOEXEC},
+    };
+
+    static constexpr int access_modes[] = {O_RDONLY, O_WRONLY, O_RDWR, O_RDWR};
+
+    int out = access_modes[flags & GUEST_O_ACCMODE];
+
+    for (size_t i = 0; i < sizeof(flag_map) / sizeof(flag_map[0]); ++i) {
+        if ((flags & flag_map[i].guest) != 0)
+            out |= flag_map[i].host;
+    }
+
+    return out;
+}
+
+[[nodiscard]] static i32 linux_openat(HostState *const host, const Memory *const mem,
+                                      const i32 dir_fd, const u32 path_addr, const u32 flags,
+                                      const u32 mode)
+{
+    char path[PATH_MAX] = {};
+    const i32 path_result = copy_guest_string(mem, path_addr, path, sizeof(path));
+
+    if (path_result != 0)
+        return path_result;
+
+    int host_dir_fd = AT_FDCWD;
+
+    if (dir_fd != GUEST_AT_FDCWD && (host_dir_fd = host_fd(host, (u32)dir_fd)) < 0)
+        return -EBADF;
+
+    size_t guest_fd = 0;
+
+    while (guest_fd < CPU_FD_TABLE_SIZE && host->fds[guest_fd] != 0)
+        ++guest_fd;
+
+    if (guest_fd == CPU_FD_TABLE_SIZE)
+        return -EMFILE;
+
+    const int fd = openat(host_dir_fd, path, host_open_flags(flags), (mode_t)mode);
+
+    if (fd < 0)
+        return -errno;
+
+    host->fds[guest_fd] = fd + 1;
+    return (i32)guest_fd;
+}
+
+[[nodiscard]] static i32 linux_close(HostState *const host, const u32 guest_fd)
+{
+    const int fd = host_fd(host, guest_fd);
+
+    if (fd < 0)
+        return -EBADF;
+
+    host->fds[guest_fd] = 0;
+
+    if (fd <= STDERR_FILENO)
+        return 0;
+
+    return close(fd) == 0 ? 0 : -errno;
+}
+
+[[nodiscard]] static i32 linux_read(const Cpu *const cpu, Memory *const mem, const u32 guest_fd,
+                                    const u32 addr, const u32 size)
+{
+    u8 *data = nullptr;
+
+    if (Memory_write_span(mem, addr, size, &data) != MemoryResult_Ok)
+        return -EFAULT;
+
+    // The result is logged first, followed by the data if anything was read. Replayed descriptors
+    // may not be open on the host at all.
+    i32 result = 0;
+
+    if (replay_input(cpu, &result, sizeof(result))) {
+        if (result > 0)
+            (void)replay_input(cpu, data, (size_t)result);
+
+        return result;
+    }
+
+    const int fd = host_fd(cpu->host, guest_fd);
+
+    if (fd == STDIN_FILENO)
+        console_flush();
+
+    if (fd < 0) {
+        result = -EBADF;
+    } else {
+        const ssize_t count = fd == STDIN_FILENO && cpu->host->stdin_eof ? 0 : read(fd, data, size);
+        result = count >= 0 ? (i32)count : -errno;
+    }
+
+    record_input(cpu, &result, sizeof(result));
+
+    if (result > 0)
+        record_input(cpu, data, (size_t)result);
+
+    return result;
+}
+
+/**
+ * \brief Writes to a guest file descriptor.
+ *
+ * The standard streams are output again when replaying a log, and muted like the console while
+ * re-executing history. Writes to anything else are made once, and only their result is replayed.
+ */
+[[nodiscard]] static i32 linux_write(const Cpu *const cpu, const Memory *const mem,
+                                     const u32 guest_fd, const u32 addr, const u32 size)
+{
+    const u8 *data = nullptr;
+
+    if (Memory_read_span(mem, addr, size, &data) != MemoryResult_Ok)
+        return -EFAULT;
+
+    const int fd = host_fd(cpu->host, guest_fd);
+
+    if (fd == STDOUT_FILENO) {
+        console_write((const char *)data, size);
+        return (i32)size;
+    }
+
+    if (fd == STDERR_FILENO) {
+        // Keep stderr ordered after whatever the guest already printed to stdout
+        console_flush();
+
+        if (replay_mode() == ReplayMode_History && replay_replaying())
+            return (i32)size;
+
+        const ssize_t result = write(fd, data, size);
+        return result >= 0 ? (i32)result : -errno;
+    }
+
+    i32 result = 0;
+
+    if (replay_input(cpu, &result, sizeof(result)))
+        return result;
+
+    if (fd < 0) {
+        result = -EBADF;
+    } else {
+        const ssize_t written = write(fd, data, size);
+        result = written >= 0 ? (i32)written : -errno;
+    }
+
+    record_input(cpu, &result, sizeof(result));
+    return result;
+}
+
+[[nodiscard]] static i32 linux_lseek(const HostState *const host, const u32 guest_fd,
+                                     const i32 offset, const u32 whence)
+{
+    const int fd = host_fd(host, guest_fd);
+
+    if (fd < 0)
+        return -EBADF;
+
+    const off_t result = lseek(fd, offset, (int)whence);
+
+    if (result < 0)
+        return -errno;
+
+    if (result > INT32_MAX)
+        return -EOVERFLOW;
+
+    return (i32)result;
+}
+
+[[nodiscard]] static i32 linux_fstat(const Cpu *const cpu, Memory *const mem, const u32 guest_fd,
+                                     const u32 addr)
+{
+    u8 *data = nullptr;
+
+    if (Memory_write_span(mem, addr, sizeof(GuestStat), &data) != MemoryResult_Ok)
+        return -EFAULT;
+
+    // The result is logged first, followed by the stat buffer on success
+    i32 result = 0;
+
+    if (replay_input(cpu, &result, sizeof(result))) {
+        if (result == 0)
+            (void)replay_input(cpu, data, sizeof(GuestStat));
+
+        return result;
+    }
+
+    const int fd = host_fd(cpu->host, guest_fd);
+    struct stat st = {};
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        result = fd < 0 ? -EBADF : -errno;
+        record_input(cpu, &result, sizeof(result));
+        return result;
+    }
+
+    const GuestStat guest_st = {
+        .dev = st.st_dev,
+        .ino = st.st_ino,
+        .mode = st.st_mode,
+        .nlink = st.st_nlink,
+        .uid = st.st_uid,
+        .gid = st.st_gid,
+        .rdev = st.st_rdev,
+        .size = st.st_size,
+        .blksize = (i32)st.st_blksize,
+        .blocks = st.st_blocks,
+        .atime = (i32)st.st_atim.tv_sec,
+        .atime_nsec = (i32)st.st_atim.tv_nsec,
+        .mtime = (i32)st.st_mtim.tv_sec,
+        .mtime_nsec = (i32)st.st_mtim.tv_nsec,
+        .ctime = (i32)st.st_ctim.tv_sec,
+        .ctime_nsec = (i32)st.st_ctim.tv_nsec,
+    };
+
+    // Guest memory is little-endian, as is every host we build for
+    memcpy(data, &guest_st, sizeof(guest_st));
+
+    record_input(cpu, &result, sizeof(result));
+    record_input(cpu, data, sizeof(guest_st));
+    return 0;
+}
+
+/**
+ * \brief Writes a time value with 32-bit seconds and a 32-bit fraction to guest memory.
+ */
+[[nodiscard]] static i32 write_guest_time32(Memory *const mem, const u32 addr, const i64 sec,
+                                            const i64 frac)
+{
+    const i32 value[2] = {(i32)sec, (i32)frac};
+    u8 *data = nullptr;
+
+    if (Memory_write_span(mem, addr, sizeof(value), &data) != MemoryResult_Ok)
+        return -EFAULT;
+
+    memcpy(data, value, sizeof(value));
+    return 0;
+}
+
+[[nodiscard]] static i32 linux_clock_gettime(Cpu *const cpu, Memory *const mem,
+                                             const u32 clock_id, const u32 addr,
+                                             const bool time64)
+{
+    struct timespec ts = {};
+
+    if (virtual_time_mhz != 0) {
+        // Every clock reads the same virtual time
+        const u64 us = guest_time_us(cpu);
+        ts.tv_sec = (time_t)(us / 1'000'000);
+        ts.tv_nsec = (long)(us % 1'000'000) * 1000;
+    } else {
+        // Host clocks differ from each other, so the whole result is recorded: error, seconds
+        // and nanoseconds
+        i64 value[3] = {};
+        size_t size = sizeof(value);
+
+        if (!replay_next(ReplayEvent_Time, cpu->instret, value, &size)) {
+            value[0] = clock_gettime((clockid_t)clock_id, &ts) != 0 ? -errno : 0;
+            value[1] = ts.tv_sec;
+            value[2] = ts.tv_nsec;
+
+            replay_record(ReplayEvent_Time, cpu->instret, value, sizeof(value));
+        }
+
+        if (value[0] != 0)
+            return (i32)value[0];
+
+        ts.tv_sec = (time_t)value[1];
+        ts.tv_nsec = (long)value[2];
+    }
+
+    if (!time64)
+        return write_guest_time32(mem, addr, ts.tv_sec, ts.tv_nsec);
+
+    // struct __kernel_timespec: 64-bit seconds followed by a padded 32-bit nanosecond count
+    const i64 value[2] = {ts.tv_sec, ts.tv_nsec};
+    u8 *data = nullptr;
+
+    if (Memory_write_span(mem, addr, sizeof(value), &data) != MemoryResult_Ok)
+        return -EFAULT;
+
+    memcpy(data, value, sizeof(value));
+    return 0;
+}
+
+[[nodiscard]] static i32 linux_gettimeofday(Cpu *const cpu, Memory *const mem, const u32 addr)
+{
+    const u64 us = guest_time_us(cpu);
+
+    if (addr == 0)
+        return 0;
+
+    return write_guest_time32(mem, addr, (i64)(us / 1'000'000), (i64)(us % 1'000'000));
+}
+
+/**
+ * \brief Moves the end of the heap to addr, returning the resulting end.
+ *
+ * Like the kernel, the current end is returned unchanged when addr is 0 or cannot be honored.
+ */
+[[nodiscard]] static u32 linux_brk(Memory *const mem, const u32 addr)
+{
+    u32 top = 0;
+
+    if (Memory_sbrk(mem, 0, &top) != MemoryResult_Ok || addr == 0)
+        return top;
+
+    const i64 increment = (i64)addr - top;
+
+    if (increment < INT32_MIN || increment > INT32_MAX ||
+        Memory_sbrk(mem, (i32)increment, &top) != MemoryResult_Ok)
+        return top;
+
+    return addr;
+}
+
+/**
+ * \brief Returns whether a syscall changes host state, and is therefore only made once.
+ *
+ * When replaying, or re-executing from history, the result is replayed instead. Reads, writes
+ * and fstat replay their data too, and take care of it themselves.
+ */
+[[nodiscard]] static bool changes_host(const u32 number)
+{
+    switch (number) {
+    case LinuxSyscall_Openat:
+    case LinuxSyscall_Close:
+    case LinuxSyscall_Lseek:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/**
+ * \brief Handles an ecall under the Linux ABI.
+ *
+ * The syscall number is taken from a7 and arguments from a0 through a5. The result is returned in
+ * a0, with failures reported as negated errno values.
+ */
+[[nodiscard]] static CpuStepResult handle_linux_ecall(Cpu *const cpu, Memory *const mem)
+{
+    const u32 a7 = cpu->regs[17];
+    const u32 a0 = cpu->regs[10];
+    const u32 a1 = cpu->regs[11];
+    const u32 a2 = cpu->regs[12];
+    const u32 a3 = cpu->regs[13];
+
+    i32 result = 0;
+
+    if (changes_host(a7) && replay_input(cpu, &result, sizeof(result))) {
+        cpu->regs[10] = (u32)result;
+        return CpuStepResult_None;
+    }
+
+    switch (a7) {
+    case LinuxSyscall_Openat:
+        result = linux_openat(cpu->host, mem, (i32)a0, a1, a2, a3);
+        break;
+
+    case LinuxSyscall_Close:
+        result = linux_close(cpu->host, a0);
+        break;
+
+    case LinuxSyscall_Lseek:
+        result = linux_lseek(cpu->host, a0, (i32)a1, a2);
+        break;
+
+    case LinuxSyscall_Read:
+        result = linux_read(cpu, mem, a0, a1, a2);
+        break;
+
+    case LinuxSyscall_Write:
+        result = linux_write(cpu, mem, a0, a1, a2);
+        break;
+
+    case LinuxSyscall_Fstat:
+        result = linux_fstat(cpu, mem, a0, a1);
+        break;
+
+    case LinuxSyscall_Exit:
+    case LinuxSyscall_ExitGroup:
+        cpu->exit_code = (i32)a0;
+        return CpuStepResult_Exit;
+
+    case LinuxSyscall_ClockGettime:
+        result = linux_clock_gettime(cpu, mem, a0, a1, false);
+        break;
+
+    case LinuxSyscall_ClockGettime64:
+        result = linux_clock_gettime(cpu, mem, a0, a1, true);
+        break;
+
+    case LinuxSyscall_Gettimeofday:
+        result = linux_gettimeofday(cpu, mem, a0);
+        break;
+
+    case LinuxSyscall_Brk:
+        result = (i32)linux_brk(mem, a0);
+        break;
+
+    default:
+        result = -ENOSYS;
+    }
+
+    if (changes_host(a7))
+        record_input(cpu, &result, sizeof(result));
+
+    cpu->regs[10] = (u32)result;
+    return CpuStepResult_None;
+}
+
+CpuStepResult handle_ecall(Cpu *const cpu, Memory *const mem)
+{
+    if (syscall_abi == SyscallAbi_Linux)
+        return handle_linux_ecall(cpu, mem);
+
+    return handle_spim_ecall(cpu, mem);
+}
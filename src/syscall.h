@@ -0,0 +1,111 @@
+#ifndef RV32_EMU_SYSCALL_H
+#define RV32_EMU_SYSCALL_H
+
+#include "cpu.h"
+#include "memory.h"
+#include "stdinc.h"
+
+typedef enum SyscallAbi : u8 {
+    SyscallAbi_Spim,
+    SyscallAbi_Linux,
+} SyscallAbi;
+
+typedef enum Syscall : u32 {
+    Syscall_PrintInteger = 1,
+    Syscall_PrintFloat = 2,
+    Syscall_PrintString = 4,
+    Syscall_ReadInteger = 5,
+    Syscall_ReadFloat = 6,
+    Syscall_ReadString = 8,
+    Syscall_Sbrk = 9,
+    Syscall_Exit = 10,
+    Syscall_PrintChar = 11,
+    Syscall_ReadChar = 12,
+    Syscall_Exit2 = 17,
+    Syscall_Time = 30,
+    Syscall_Sleep = 32,
+    Syscall_PrintHex = 34,
+    Syscall_PrintBinary = 35,
+    Syscall_PrintUnsigned = 36,
+} Syscall;
+
+typedef enum LinuxSyscall : u32 {
+    LinuxSyscall_Openat = 56,
+    LinuxSyscall_Close = 57,
+    LinuxSyscall_Lseek = 62,
+    LinuxSyscall_Read = 63,
+    LinuxSyscall_Write = 64,
+    LinuxSyscall_Fstat = 80,
+    LinuxSyscall_Exit = 93,
+    LinuxSyscall_ExitGroup = 94,
+    LinuxSyscall_ClockGettime = 113,
+    LinuxSyscall_Gettimeofday = 169,
+    LinuxSyscall_Brk = 214,
+    LinuxSyscall_ClockGettime64 = 403,
+} LinuxSyscall;
+
+/**
+ * \brief Parses a syscall ABI name ("spim" or "linux").
+ *
+ * \param name The name to parse.
+ * \param out Will be set to the parsed ABI.
+ *
+ * \return true if name is a valid ABI, false otherwise.
+ */
+[[nodiscard]] bool SyscallAbi_parse(const char *name, SyscallAbi *out);
+
+/**
+ * \brief Sets the ABI used to interpret ecalls.
+ *
+ * The SPIM ABI is the default. The Linux ABI follows the RV32 Linux syscall numbers and calling
+ * convention as used by newlib and picolibc, with file descriptors backed by host files.
+ *
+ * \param abi The new ABI.
+ */
+void set_syscall_abi(SyscallAbi abi);
+
+/**
+ * \brief Sets whether guest time comes from the host clock or from retired instructions.
+ *
+ * Under virtual time, sleeps return immediately after advancing the guest clock, and polling
+ * loops on the clock are skipped ahead. Runs then take the same time regardless of how long the
+ * guest waits, and see the same clock values every time.
+ *
+ * \param mhz Simulated clock speed in millions of instructions per second, or 0 to use the host
+ * clock.
+ */
+void set_virtual_time(u32 mhz);
+
+/**
+ * \brief Returns the current guest time in microseconds since the epoch.
+ *
+ * Virtual time is used if enabled, and the value is recorded or replayed like any other input.
+ *
+ * \param cpu The CPU asking for the time.
+ *
+ * \return The current guest time.
+ */
+[[nodiscard]] u64 guest_time_us(Cpu *cpu);
+
+/**
+ * \brief Prints a NUL-terminated string from guest memory.
+ *
+ * Memory is validated a page at a time and printed straight from host memory, so each byte is
+ * read once and each page takes a single console write.
+ *
+ * \param mem The guest memory.
+ * \param addr Address of the string.
+ */
+void print_guest_string(const Memory *mem, u32 addr);
+
+/**
+ * \brief Executes the ecall requested by the guest.
+ *
+ * \param cpu The calling CPU. Arguments are read from and results are written to its registers.
+ * \param mem The guest memory.
+ *
+ * \return CpuStepResult_Exit if the guest asked to exit, CpuStepResult_None otherwise.
+ */
+[[nodiscard]] CpuStepResult handle_ecall(Cpu *cpu, Memory *mem);
+
+#endif
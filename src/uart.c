@@ -0,0 +1,221 @@
+#include "uart.h"
+#include "console.h"
+#include "log.h"
+#include "macros.h"
+#include "memory.h"
+#include "stdinc.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+
+static constexpr size_t RX_RING_CAPACITY = 4096;
+
+static constexpr u8 LCR_DLAB = 1 << 7;
+static constexpr u8 FCR_FIFO_ENABLE = 1 << 0;
+static constexpr u8 IIR_NO_INTERRUPT = 1 << 0;
+static constexpr u8 IIR_FIFO_ENABLED = 0b1100'0000;
+static constexpr u8 LSR_DATA_READY = 1 << 0;
+static constexpr u8 LSR_THR_EMPTY = 1 << 5;
+static constexpr u8 LSR_TX_EMPTY = 1 << 6;
+static constexpr u8 MSR_CONNECTED = 0b1011'0000; // CTS, DSR and DCD
+
+typedef struct Uart {
+    Device device;
+    u8 ier;
+    u8 fcr;
+    u8 lcr;
+    u8 mcr;
+    u8 scr;
+    u16 divisor;
+} Uart;
+
+static Uart uart = {};
+
+// Single-producer single-consumer ring. The reader thread only advances rx_head, and the
+// emulator thread only advances rx_tail.
+static u8 rx_ring[RX_RING_CAPACITY];
+static atomic_size_t rx_head = 0;
+static atomic_size_t rx_tail = 0;
+static bool reader_started = false;
+static pthread_t reader_thread;
+
+static void *reader_main([[maybe_unused]] void *const arg)
+{
+    size_t head = atomic_load_explicit(&rx_head, memory_order_relaxed);
+
+    while (true) {
+        const size_t tail = atomic_load_explicit(&rx_tail, memory_order_acquire);
+        const size_t free_size = RX_RING_CAPACITY - (head - tail);
+
+        if (free_size == 0) {
+            // The guest is not keeping up, give it some time to drain the ring
+            nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 1'000'000}, nullptr);
+            continue;
+        }
+
+        const size_t start = head % RX_RING_CAPACITY;
+        size_t chunk = RX_RING_CAPACITY - start;
+
+        if (chunk > free_size)
+            chunk = free_size;
+
+        const ssize_t received = read(STDIN_FILENO, &rx_ring[start], chunk);
+
+        if (received < 0 && errno == EINTR)
+            continue;
+
+        if (received <= 0)
+            return nullptr;
+
+        head += (size_t)received;
+        atomic_store_explicit(&rx_head, head, memory_order_release);
+    }
+}
+
+/**
+ * \brief Starts reading stdin in the background, if not done already.
+ */
+static void start_reader(void)
+{
+    if (reader_started)
+        return;
+
+    // The thread spends most of its life blocked in read(2), so it is never joined
+    if (pthread_create(&reader_thread, nullptr, reader_main, nullptr) != 0)
+        BAIL("Could not start UART reader thread");
+
+    pthread_detach(reader_thread);
+    reader_started = true;
+}
+
+[[nodiscard]] static bool rx_ready(void)
+{
+    return atomic_load_explicit(&rx_head, memory_order_acquire) !=
+           atomic_load_explicit(&rx_tail, memory_order_relaxed);
+}
+
+[[nodiscard]] static u8 rx_pop(void)
+{
+    if (!rx_ready())
+        return 0;
+
+    const size_t tail = atomic_load_explicit(&rx_tail, memory_order_relaxed);
+    const u8 value = rx_ring[tail % RX_RING_CAPACITY];
+
+    atomic_store_explicit(&rx_tail, tail + 1, memory_order_release);
+    return value;
+}
+
+[[nodiscard]] static u8 Uart_read(Device *const dev, const u32 offset)
+{
+    Uart *const self = CONTAINER_OF(dev, Uart, device);
+    const bool dlab = (self->lcr & LCR_DLAB) != 0;
+
+    switch ((UartReg)offset) {
+    case UartReg_Data:
+        if (dlab)
+            return (u8)self->divisor;
+
+        start_reader();
+        return rx_pop();
+
+    case UartReg_Ier:
+        return dlab ? (u8)(self->divisor >> 8) : self->ier;
+
+    case UartReg_Iir:
+        return IIR_NO_INTERRUPT | ((self->fcr & FCR_FIFO_ENABLE) != 0 ? IIR_FIFO_ENABLED : 0);
+
+    case UartReg_Lcr:
+        return self->lcr;
+
+    case UartReg_Mcr:
+        return self->mcr;
+
+    case UartReg_Lsr:
+        start_reader();
+        return LSR_THR_EMPTY | LSR_TX_EMPTY | (rx_ready() ? LSR_DATA_READY : 0);
+
+    case UartReg_Msr:
+        return MSR_CONNECTED;
+
+    case UartReg_Scr:
+        return self->scr;
+
+    default:
+        return 0;
+    }
+}
+
+static void Uart_write(Device *const dev, const u32 offset, const u8 value)
+{
+    Uart *const self = CONTAINER_OF(dev, Uart, device);
+    const bool dlab = (self->lcr & LCR_DLAB) != 0;
+
+    switch ((UartReg)offset) {
+    case UartReg_Data:
+        if (dlab)
+            self->divisor = (self->divisor & 0xFF00) | value;
+        else
+            console_putc((char)value);
+        break;
+
+    case UartReg_Ier:
+        // There are no traps to deliver interrupts with, so IER is only kept for reading back
+        if (dlab)
+            self->divisor = (u16)((self->divisor & 0x00FF) | (value << 8));
+        else
+            self->ier = value & 0x0F;
+        break;
+
+    case UartReg_Iir:
+        self->fcr = value;
+        break;
+
+    case UartReg_Lcr:
+        self->lcr = value;
+        break;
+
+    case UartReg_Mcr:
+        self->mcr = value & 0x1F;
+        break;
+
+    case UartReg_Scr:
+        self->scr = value;
+        break;
+
+    default:
+    }
+}
+
+bool uart_attach(SegmentedMemory *const mem, const u32 base)
+{
+    if (!SegmentedMemory_range_is_free(mem, base, UART_SIZE))
+        return false;
+
+    uart = (Uart){
+        .device =
+            {
+                .read = Uart_read,
+                .write = Uart_write,
+            },
+        .ier = 0,
+        .fcr = 0,
+        .lcr = 0,
+        .mcr = 0,
+        .scr = 0,
+        .divisor = 0,
+    };
+
+    SegmentedMemory_add_segment(mem, (Segment){
+                                         .addr = base,
+                                         .size = UART_SIZE,
+                                         .perms = SegPerms_Read | SegPerms_Write,
+                                         .device = &uart.device,
+                                     });
+
+    ver_printf("uart: 0x%08X\n", base);
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef RV32_EMU_UART_H
+#define RV32_EMU_UART_H
+
+#include "memory.h"
+#include "stdinc.h"
+
+/**
+ * \brief Offsets of the 16550 registers, one byte apart.
+ *
+ * Offsets 0 and 1 address the divisor latch instead while LCR.DLAB is set.
+ */
+typedef enum UartReg : u8 {
+    UartReg_Data = 0, // RBR on reads, THR on writes
+    UartReg_Ier = 1,
+    UartReg_Iir = 2, // FCR on writes
+    UartReg_Lcr = 3,
+    UartReg_Mcr = 4,
+    UartReg_Lsr = 5,
+    UartReg_Msr = 6,
+    UartReg_Scr = 7,
+} UartReg;
+
+static constexpr u32 UART_SIZE = 8;
+static constexpr u32 UART_DEFAULT_BASE = 0x1000'0000;
+
+/**
+ * \brief Maps a 16550-compatible UART at base.
+ *
+ * Transmitted bytes go to the guest console. Received bytes are read from stdin by a background
+ * thread, which is only started once the guest first reads RBR or LSR, so that programs using
+ * ecalls for input are left alone. Polling LSR never blocks nor makes a system call.
+ *
+ * \param mem The memory to map the UART into.
+ * \param base Address of the first register.
+ *
+ * \return true on success, false if the registers would overlap an existing segment or the heap.
+ */
+[[nodiscard]] bool uart_attach(SegmentedMemory *mem, u32 base);
+
+#endif
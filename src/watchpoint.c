@@ -0,0 +1,205 @@
+#include "watchpoint.h"
+#include "macros.h"
+#include "memory.h"
+#include "stdinc.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+static constexpr size_t PAGE_BITMAP_SIZE = MEMORY_PAGE_COUNT / 64;
+static constexpr u64 ADDRESS_SPACE_SIZE = (u64)MEMORY_PAGE_COUNT * MEMORY_PAGE_SIZE;
+
+[[nodiscard]] static bool page_is_watched(const WatchpointSet *const set, const u32 page)
+{
+    return (set->pages[page / 64] & (1ULL << (page % 64))) != 0;
+}
+
+/**
+ * \brief Recomputes the page bits of a range from the remaining watchpoints.
+ */
+static void update_pages(WatchpointSet *const set, const u32 addr, const u32 size)
+{
+    const u32 first = addr / MEMORY_PAGE_SIZE;
+    const u64 end = (u64)addr + size < ADDRESS_SPACE_SIZE ? (u64)addr + size : ADDRESS_SPACE_SIZE;
+    const u32 last = (u32)((end - 1) / MEMORY_PAGE_SIZE);
+
+    for (u32 page = first; page <= last; ++page)
+        set->pages[page / 64] &= ~(1ULL << (page % 64));
+
+    for (size_t i = 0; i < set->size; ++i) {
+        const Watchpoint *const wp = &set->watchpoints[i];
+        const u32 wp_first = wp->addr / MEMORY_PAGE_SIZE;
+        const u32 wp_last = (u32)(((u64)wp->addr + wp->size - 1) / MEMORY_PAGE_SIZE);
+
+        for (u32 page = wp_first; page <= wp_last; ++page) {
+            if (page >= first && page <= last)
+                set->pages[page / 64] |= 1ULL << (page % 64);
+        }
+    }
+}
+
+WatchpointSet WatchpointSet_new(void)
+{
+    u64 *const pages = calloc(PAGE_BITMAP_SIZE, sizeof(*pages));
+
+    if (pages == nullptr)
+        BAIL("Could not allocate watchpoint bitmap");
+
+    return (WatchpointSet){
+        .pages = pages,
+        .watchpoints = nullptr,
+        .size = 0,
+        .capacity = 0,
+        .hit = false,
+        .hit_watchpoint = {},
+        .hit_addr = 0,
+    };
+}
+
+bool WatchpointSet_insert(WatchpointSet *const set, const Watchpoint watchpoint)
+{
+    if (watchpoint.size == 0 || (u64)watchpoint.addr + watchpoint.size > ADDRESS_SPACE_SIZE)
+        return false;
+
+    if (set->size == set->capacity) {
+        const size_t new_capacity = set->capacity == 0 ? 8 : 2 * set->capacity;
+        Watchpoint *const new_watchpoints =
+            realloc(set->watchpoints, new_capacity * sizeof(*new_watchpoints));
+
+        if (new_watchpoints == nullptr)
+            BAIL("Could not reallocate watchpoints");
+
+        set->watchpoints = new_watchpoints;
+        set->capacity = new_capacity;
+    }
+
+    set->watchpoints[set->size] = watchpoint;
+    ++set->size;
+
+    update_pages(set, watchpoint.addr, watchpoint.size);
+    return true;
+}
+
+bool WatchpointSet_remove(WatchpointSet *const set, const Watchpoint watchpoint)
+{
+    for (size_t i = 0; i < set->size; ++i) {
+        const Watchpoint *const wp = &set->watchpoints[i];
+
+        if (wp->addr == watchpoint.addr && wp->size == watchpoint.size &&
+            wp->kind == watchpoint.kind) {
+            set->watchpoints[i] = set->watchpoints[set->size - 1];
+            --set->size;
+
+            update_pages(set, watchpoint.addr, watchpoint.size);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WatchpointSet_check(WatchpointSet *const set, const u32 addr, const u32 size,
+                         const WatchKind kind)
+{
+    if (set->hit || size == 0)
+        return;
+
+    const u64 end = (u64)addr + size;
+    bool watched = false;
+
+    for (u64 page = addr / MEMORY_PAGE_SIZE; !watched && page * MEMORY_PAGE_SIZE < end; ++page)
+        watched = page_is_watched(set, (u32)page);
+
+    if (!watched)
+        return;
+
+    for (size_t i = 0; i < set->size; ++i) {
+        const Watchpoint *const wp = &set->watchpoints[i];
+
+        if ((wp->kind & kind) != 0 && wp->addr < end && addr < (u64)wp->addr + wp->size) {
+            set->hit = true;
+            set->hit_watchpoint = *wp;
+            set->hit_addr = addr > wp->addr ? addr : wp->addr;
+            return;
+        }
+    }
+}
+
+void WatchpointSet_destroy(WatchpointSet *const set)
+{
+    free(set->pages);
+    free(set->watchpoints);
+
+    set->pages = nullptr;
+    set->watchpoints = nullptr;
+    set->size = 0;
+    set->capacity = 0;
+}
+
+[[nodiscard]] static u8 WatchedMemory_read(const Memory *const mem, const u32 addr)
+{
+    const WatchedMemory *const watched = CONTAINER_OF(mem, WatchedMemory, mem);
+
+    WatchpointSet_check(watched->set, addr, 1, WatchKind_Read);
+    return Memory_read(watched->inner, addr);
+}
+
+[[nodiscard]] static u32 WatchedMemory_read_instr(const Memory *const mem, const u32 addr)
+{
+    const WatchedMemory *const watched = CONTAINER_OF(mem, WatchedMemory, mem);
+
+    return Memory_read_instr(watched->inner, addr);
+}
+
+static void WatchedMemory_write(Memory *const mem, const u32 addr, const u8 value)
+{
+    const WatchedMemory *const watched = CONTAINER_OF(mem, WatchedMemory, mem);
+
+    WatchpointSet_check(watched->set, addr, 1, WatchKind_Write);
+    Memory_write(watched->inner, addr, value);
+}
+
+[[nodiscard]] static MemoryResult WatchedMemory_read_span(const Memory *const mem, const u32 addr,
+                                                          const u32 size, const u8 **const out)
+{
+    const WatchedMemory *const watched = CONTAINER_OF(mem, WatchedMemory, mem);
+    const MemoryResult result = Memory_read_span(watched->inner, addr, size, out);
+
+    if (result == MemoryResult_Ok)
+        WatchpointSet_check(watched->set, addr, size, WatchKind_Read);
+
+    return result;
+}
+
+[[nodiscard]] static MemoryResult WatchedMemory_write_span(Memory *const mem, const u32 addr,
+                                                           const u32 size, u8 **const out)
+{
+    const WatchedMemory *const watched = CONTAINER_OF(mem, WatchedMemory, mem);
+    const MemoryResult result = Memory_write_span(watched->inner, addr, size, out);
+
+    if (result == MemoryResult_Ok)
+        WatchpointSet_check(watched->set, addr, size, WatchKind_Write);
+
+    return result;
+}
+
+[[nodiscard]] static MemoryResult WatchedMemory_sbrk(Memory *const mem, const i32 increment,
+                                                     u32 *const out)
+{
+    const WatchedMemory *const watched = CONTAINER_OF(mem, WatchedMemory, mem);
+
+    return Memory_sbrk(watched->inner, increment, out);
+}
+
+WatchedMemory WatchedMemory_new(Memory *const inner, WatchpointSet *const set)
+{
+    return (WatchedMemory){
+        .mem.read = WatchedMemory_read,
+        .mem.read_instr = WatchedMemory_read_instr,
+        .mem.write = WatchedMemory_write,
+        .mem.read_span = WatchedMemory_read_span,
+        .mem.write_span = WatchedMemory_write_span,
+        .mem.sbrk = WatchedMemory_sbrk,
+        .inner = inner,
+        .set = set,
+    };
+}
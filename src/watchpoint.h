@@ -0,0 +1,81 @@
+#ifndef RV32_EMU_WATCHPOINT_H
+#define RV32_EMU_WATCHPOINT_H
+
+#include "memory.h"
+#include "stdinc.h"
+#include <stddef.h>
+
+/**
+ * \brief Kinds of accesses a watchpoint triggers on.
+ */
+typedef enum WatchKind : u8 {
+    WatchKind_Write = 1 << 0,
+    WatchKind_Read = 1 << 1,
+    WatchKind_Access = WatchKind_Write | WatchKind_Read,
+} WatchKind;
+
+typedef struct Watchpoint {
+    u32 addr;
+    u32 size;
+    WatchKind kind;
+} Watchpoint;
+
+/**
+ * \brief A set of data watchpoints, together with the first one hit since it was last cleared.
+ *
+ * Pages overlapping a watched range are flagged in a bitmap, so accesses to any other page take a
+ * single bit test.
+ */
+typedef struct WatchpointSet {
+    u64 *pages;
+    Watchpoint *watchpoints;
+    size_t size;
+    size_t capacity;
+    bool hit;
+    Watchpoint hit_watchpoint;
+    u32 hit_addr;
+} WatchpointSet;
+
+[[nodiscard]] WatchpointSet WatchpointSet_new(void);
+
+/**
+ * \brief Adds a watchpoint.
+ *
+ * \return true on success, false if the watched range is empty or runs past the end of the
+ * address space.
+ */
+[[nodiscard]] bool WatchpointSet_insert(WatchpointSet *set, Watchpoint watchpoint);
+
+/**
+ * \brief Removes a watchpoint with the same range and kind.
+ *
+ * \return true if the watchpoint was set, false otherwise.
+ */
+bool WatchpointSet_remove(WatchpointSet *set, Watchpoint watchpoint);
+
+/**
+ * \brief Checks an access against every watchpoint, recording the first hit.
+ *
+ * \param set The WatchpointSet to check against.
+ * \param addr Start address of the access.
+ * \param size Size of the access.
+ * \param kind Either WatchKind_Read or WatchKind_Write.
+ */
+void WatchpointSet_check(WatchpointSet *set, u32 addr, u32 size, WatchKind kind);
+
+void WatchpointSet_destroy(WatchpointSet *set);
+
+/**
+ * \brief Memory that checks every data access against a WatchpointSet before forwarding it.
+ *
+ * Instruction fetches are not checked.
+ */
+typedef struct WatchedMemory {
+    Memory mem;
+    Memory *inner;
+    WatchpointSet *set;
+} WatchedMemory;
+
+[[nodiscard]] WatchedMemory WatchedMemory_new(Memory *inner, WatchpointSet *set);
+
+#endif
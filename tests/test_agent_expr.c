@@ -0,0 +1,148 @@
+#include "agent_expr.h"
+#include "cpu.h"
+#include "memory.h"
+#include <stdlib.h>
+#include <unity.h>
+
+static SegmentedMemory mem = {};
+static Cpu cpu = {};
+
+void setUp(void)
+{
+    mem = SegmentedMemory_new();
+    cpu = Cpu_new(nullptr);
+
+    const Segment data = {
+        .addr = 0x2000,
+        .size = 0x1000,
+        .perms = SegPerms_Read | SegPerms_Write,
+    };
+
+    SegmentedMemory_add_segment(&mem, data);
+}
+
+void tearDown(void)
+{
+    SegmentedMemory_destroy(&mem);
+}
+
+static AgentExprResult eval(const u8 *const code, const size_t size, i64 *const value)
+{
+    const AgentExpr expr = {
+        .code = (u8 *)code,
+        .size = size,
+    };
+
+    return AgentExpr_eval(&expr, &cpu, &mem.mem, value);
+}
+
+void test_agent_expr_register_comparison(void)
+{
+    // $x5 == 9999
+    static const u8 code[] = {0x26, 0x00, 0x05, 0x23, 0x27, 0x0F, 0x13, 0x27};
+    i64 value = -1;
+
+    cpu.regs[5] = 9998;
+    TEST_ASSERT_EQUAL(AgentExprResult_Ok, eval(code, sizeof(code), &value));
+    TEST_ASSERT_EQUAL_INT64(0, value);
+
+    cpu.regs[5] = 9999;
+    TEST_ASSERT_EQUAL(AgentExprResult_Ok, eval(code, sizeof(code), &value));
+    TEST_ASSERT_EQUAL_INT64(1, value);
+}
+
+void test_agent_expr_memory_and_sign_extension(void)
+{
+    // *(int *)0x2004 < 0
+    static const u8 code[] = {0x23, 0x20, 0x04, 0x19, 0x16, 0x20, 0x22, 0x00, 0x14, 0x27};
+    i64 value = -1;
+
+    Memory_write(&mem.mem, 0x2007, 0x80);
+    TEST_ASSERT_EQUAL(AgentExprResult_Ok, eval(code, sizeof(code), &value));
+    TEST_ASSERT_EQUAL_INT64(1, value);
+
+    Memory_write(&mem.mem, 0x2007, 0x7F);
+    TEST_ASSERT_EQUAL(AgentExprResult_Ok, eval(code, sizeof(code), &value));
+    TEST_ASSERT_EQUAL_INT64(0, value);
+}
+
+void test_agent_expr_branches(void)
+{
+    // $x1 ? 7 : 3
+    static const u8 code[] = {0x26, 0x00, 0x01, 0x20, 0x00, 0x09, 0x22, 0x03,
+                              0x27, 0x22, 0x07, 0x27};
+    i64 value = -1;
+
+    TEST_ASSERT_EQUAL(AgentExprResult_Ok, eval(code, sizeof(code), &value));
+    TEST_ASSERT_EQUAL_INT64(3, value);
+
+    cpu.regs[1] = 1;
+    TEST_ASSERT_EQUAL(AgentExprResult_Ok, eval(code, sizeof(code), &value));
+    TEST_ASSERT_EQUAL_INT64(7, value);
+}
+
+void test_agent_expr_errors(void)
+{
+    static const u8 divide_by_zero[] = {0x22, 0x01, 0x22, 0x00, 0x05, 0x27};
+    static const u8 underflow[] = {0x22, 0x01, 0x02, 0x27};
+    static const u8 fault[] = {0x24, 0xFF, 0xFF, 0xFF, 0xFC, 0x1A, 0x27};
+    static const u8 bad_register[] = {0x26, 0x00, 0x41, 0x27};
+    static const u8 forever[] = {0x21, 0x00, 0x00};
+    static const u8 no_end[] = {0x22, 0x01};
+    i64 value = 0;
+
+    TEST_ASSERT_EQUAL(AgentExprResult_DivideByZero,
+                      eval(divide_by_zero, sizeof(divide_by_zero), &value));
+    TEST_ASSERT_EQUAL(AgentExprResult_StackUnderflow, eval(underflow, sizeof(underflow), &value));
+    TEST_ASSERT_EQUAL(AgentExprResult_MemoryFault, eval(fault, sizeof(fault), &value));
+    TEST_ASSERT_EQUAL(AgentExprResult_BadOperand,
+                      eval(bad_register, sizeof(bad_register), &value));
+    TEST_ASSERT_EQUAL(AgentExprResult_TooLong, eval(forever, sizeof(forever), &value));
+    TEST_ASSERT_EQUAL(AgentExprResult_BadOperand, eval(no_end, sizeof(no_end), &value));
+}
+
+static void destroy_conditions(AgentExpr *const exprs, const size_t exprs_size)
+{
+    for (size_t i = 0; i < exprs_size; ++i)
+        AgentExpr_destroy(&exprs[i]);
+
+    free(exprs);
+}
+
+void test_agent_expr_parse_conditions(void)
+{
+    AgentExpr *exprs = nullptr;
+    size_t exprs_size = 0;
+
+    TEST_ASSERT_TRUE(AgentExpr_parse_conditions("4;X3,aabbccX2,ddee", &exprs, &exprs_size));
+    TEST_ASSERT_EQUAL_size_t(2, exprs_size);
+    TEST_ASSERT_EQUAL_size_t(3, exprs[0].size);
+    TEST_ASSERT_EQUAL_HEX8(0xCC, exprs[0].code[2]);
+    TEST_ASSERT_EQUAL_size_t(2, exprs[1].size);
+    TEST_ASSERT_EQUAL_HEX8(0xDD, exprs[1].code[0]);
+    destroy_conditions(exprs, exprs_size);
+
+    TEST_ASSERT_TRUE(
+        AgentExpr_parse_conditions("4;X1,27;cmds:0,X1,27;X2,2227", &exprs, &exprs_size));
+    TEST_ASSERT_EQUAL_size_t(2, exprs_size);
+    TEST_ASSERT_EQUAL_size_t(1, exprs[0].size);
+    TEST_ASSERT_EQUAL_size_t(2, exprs[1].size);
+    destroy_conditions(exprs, exprs_size);
+
+    TEST_ASSERT_TRUE(AgentExpr_parse_conditions("4", &exprs, &exprs_size));
+    TEST_ASSERT_EQUAL_size_t(0, exprs_size);
+}
+
+void test_agent_expr_parse_bad_conditions(void)
+{
+    static const char *const bad[] = {"4;X", "4;X0,", "4;X2,27", "4;X1,zz", "4;X1,27Y", "4;X1;27"};
+
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        AgentExpr *exprs = nullptr;
+        size_t exprs_size = 0;
+
+        TEST_ASSERT_FALSE_MESSAGE(AgentExpr_parse_conditions(bad[i], &exprs, &exprs_size), bad[i]);
+        TEST_ASSERT_NULL(exprs);
+        TEST_ASSERT_EQUAL_size_t(0, exprs_size);
+    }
+}
@@ -0,0 +1,66 @@
+#include "breakpoint.h"
+#include <unity.h>
+
+static BreakpointSet set = {};
+
+void setUp(void)
+{
+    set = BreakpointSet_new();
+}
+
+void tearDown(void)
+{
+    BreakpointSet_destroy(&set);
+}
+
+void test_breakpoint_insert_and_remove(void)
+{
+    BreakpointSet_insert(&set, 0x1000);
+    BreakpointSet_insert(&set, 0x1008);
+    BreakpointSet_insert(&set, 0x1000);
+
+    TEST_ASSERT_EQUAL(2, set.size);
+    TEST_ASSERT_TRUE(BreakpointSet_contains(&set, 0x1000));
+    TEST_ASSERT_TRUE(BreakpointSet_contains(&set, 0x1008));
+    TEST_ASSERT_FALSE(BreakpointSet_contains(&set, 0x1004));
+    TEST_ASSERT_FALSE(BreakpointSet_contains(&set, 0x2000));
+
+    TEST_ASSERT_TRUE(BreakpointSet_remove(&set, 0x1000));
+    TEST_ASSERT_FALSE(BreakpointSet_remove(&set, 0x1000));
+    TEST_ASSERT_FALSE(BreakpointSet_contains(&set, 0x1000));
+    TEST_ASSERT_TRUE(BreakpointSet_contains(&set, 0x1008));
+}
+
+void test_breakpoint_page_is_cleared_with_its_last_breakpoint(void)
+{
+    BreakpointSet_insert(&set, 0x1000);
+    BreakpointSet_insert(&set, 0x1FFC);
+    BreakpointSet_insert(&set, 0x2000);
+
+    TEST_ASSERT_TRUE(BreakpointSet_remove(&set, 0x1000));
+    TEST_ASSERT_NOT_EQUAL(0, set.pages[0] & (1ULL << 1));
+
+    TEST_ASSERT_TRUE(BreakpointSet_remove(&set, 0x1FFC));
+    TEST_ASSERT_EQUAL(0, set.pages[0] & (1ULL << 1));
+    TEST_ASSERT_TRUE(BreakpointSet_contains(&set, 0x2000));
+}
+
+void test_breakpoint_many_on_one_page(void)
+{
+    for (u32 addr = 0x1FFC; addr >= 0x1000; addr -= 4)
+        BreakpointSet_insert(&set, addr);
+
+    TEST_ASSERT_EQUAL(1024, set.size);
+
+    for (size_t i = 1; i < set.size; ++i)
+        TEST_ASSERT_TRUE(set.breakpoints[i - 1].addr < set.breakpoints[i].addr);
+
+    TEST_ASSERT_TRUE(BreakpointSet_contains(&set, 0x1000));
+    TEST_ASSERT_TRUE(BreakpointSet_contains(&set, 0x1800));
+    TEST_ASSERT_FALSE(BreakpointSet_contains(&set, 0x1802));
+
+    TEST_ASSERT_TRUE(BreakpointSet_remove(&set, 0x1800));
+    TEST_ASSERT_FALSE(BreakpointSet_contains(&set, 0x1800));
+    TEST_ASSERT_TRUE(BreakpointSet_contains(&set, 0x1804));
+    TEST_ASSERT_NOT_EQUAL(0, set.pages[0] & (1ULL << 1));
+}
@@ -0,0 +1,133 @@
+#include "checkpoint.h"
+#include "cpu.h"
+#include "memory.h"
+#include <unity.h>
+
+static SegmentedMemory mem = {};
+static Cpu cpu = {};
+
+void setUp(void)
+{
+    mem = SegmentedMemory_new();
+    cpu = Cpu_new(nullptr);
+
+    const Segment seg = {
+        .addr = 0x1000,
+        .size = 0x3000,
+        .perms = SegPerms_Read | SegPerms_Write,
+    };
+
+    SegmentedMemory_add_segment(&mem, seg);
+}
+
+void tearDown(void)
+{
+    SegmentedMemory_destroy(&mem);
+}
+
+void test_dirty_tracking(void)
+{
+    TEST_ASSERT_FALSE(SegmentedMemory_page_is_dirty(&mem, 0x2));
+
+    Memory_write(&mem.mem, 0x2004, 0xAB);
+
+    TEST_ASSERT_TRUE(SegmentedMemory_page_is_dirty(&mem, 0x2));
+    TEST_ASSERT_FALSE(SegmentedMemory_page_is_dirty(&mem, 0x1));
+
+    SegmentedMemory_clear_dirty(&mem);
+
+    TEST_ASSERT_FALSE(SegmentedMemory_page_is_dirty(&mem, 0x2));
+    TEST_ASSERT_TRUE(SegmentedMemory_page_is_touched(&mem, 0x2));
+    TEST_ASSERT_TRUE(SegmentedMemory_page_is_touched(&mem, 0x3));
+    TEST_ASSERT_FALSE(SegmentedMemory_page_is_touched(&mem, 0x8));
+}
+
+void test_incremental_checkpoints_only_copy_dirty_pages(void)
+{
+    CheckpointLog log = CheckpointLog_new();
+
+    TEST_ASSERT_EQUAL(0, CheckpointLog_take(&log, &cpu, &mem));
+    TEST_ASSERT_EQUAL(3, log.checkpoints[0].pages_size);
+
+    Memory_write(&mem.mem, 0x1010, 0x11);
+    Memory_write(&mem.mem, 0x1020, 0x22);
+
+    TEST_ASSERT_EQUAL(1, CheckpointLog_take(&log, &cpu, &mem));
+    TEST_ASSERT_EQUAL(1, log.checkpoints[1].pages_size);
+    TEST_ASSERT_EQUAL(0x1, log.checkpoints[1].pages[0]);
+
+    TEST_ASSERT_EQUAL(2, CheckpointLog_take(&log, &cpu, &mem));
+    TEST_ASSERT_EQUAL(0, log.checkpoints[2].pages_size);
+
+    CheckpointLog_destroy(&log);
+}
+
+void test_restore_replays_base_and_deltas(void)
+{
+    CheckpointLog log = CheckpointLog_new();
+
+    Memory_write(&mem.mem, 0x1000, 0x01);
+    cpu.pc = 0x100;
+    CheckpointLog_take(&log, &cpu, &mem);
+
+    Memory_write(&mem.mem, 0x1000, 0x02);
+    Memory_write(&mem.mem, 0x3000, 0x03);
+    cpu.pc = 0x200;
+    CheckpointLog_take(&log, &cpu, &mem);
+
+    Memory_write(&mem.mem, 0x1000, 0x04);
+    Memory_write(&mem.mem, 0x8000'0000, 0x05);
+    cpu.pc = 0x300;
+
+    CheckpointLog_restore(&log, 1, &cpu, &mem);
+
+    TEST_ASSERT_EQUAL_HEX32(0x200, cpu.pc);
+    TEST_ASSERT_EQUAL_HEX8(0x02, Memory_read(&mem.mem, 0x1000));
+    TEST_ASSERT_EQUAL_HEX8(0x03, Memory_read(&mem.mem, 0x3000));
+    TEST_ASSERT_EQUAL_HEX8(0x00, Memory_read(&mem.mem, 0x8000'0000));
+
+    CheckpointLog_restore(&log, 0, &cpu, &mem);
+
+    TEST_ASSERT_EQUAL_HEX32(0x100, cpu.pc);
+    TEST_ASSERT_EQUAL(1, log.checkpoints_size);
+    TEST_ASSERT_EQUAL_HEX8(0x01, Memory_read(&mem.mem, 0x1000));
+    TEST_ASSERT_EQUAL_HEX8(0x00, Memory_read(&mem.mem, 0x3000));
+
+    CheckpointLog_destroy(&log);
+}
+
+void test_drop_oldest_merges_into_base(void)
+{
+    CheckpointLog log = CheckpointLog_new();
+
+    Memory_write(&mem.mem, 0x1000, 0x01);
+    Memory_write(&mem.mem, 0x2000, 0x02);
+    cpu.pc = 0x100;
+    CheckpointLog_take(&log, &cpu, &mem);
+
+    Memory_write(&mem.mem, 0x2000, 0x12);
+    Memory_write(&mem.mem, 0x8000'0000, 0x13);
+    cpu.pc = 0x200;
+    CheckpointLog_take(&log, &cpu, &mem);
+
+    Memory_write(&mem.mem, 0x1000, 0x21);
+    cpu.pc = 0x300;
+    CheckpointLog_take(&log, &cpu, &mem);
+
+    CheckpointLog_drop_oldest(&log);
+
+    TEST_ASSERT_EQUAL(2, log.checkpoints_size);
+    TEST_ASSERT_EQUAL_HEX32(0x200, log.checkpoints[0].cpu.pc);
+    TEST_ASSERT_EQUAL(4, log.checkpoints[0].pages_size);
+
+    Memory_write(&mem.mem, 0x3000, 0x33);
+    CheckpointLog_restore(&log, 0, &cpu, &mem);
+
+    TEST_ASSERT_EQUAL_HEX32(0x200, cpu.pc);
+    TEST_ASSERT_EQUAL_HEX8(0x01, Memory_read(&mem.mem, 0x1000));
+    TEST_ASSERT_EQUAL_HEX8(0x12, Memory_read(&mem.mem, 0x2000));
+    TEST_ASSERT_EQUAL_HEX8(0x00, Memory_read(&mem.mem, 0x3000));
+    TEST_ASSERT_EQUAL_HEX8(0x13, Memory_read(&mem.mem, 0x8000'0000));
+
+    CheckpointLog_destroy(&log);
+}
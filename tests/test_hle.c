@@ -0,0 +1,115 @@
+#include "hle.h"
+#include <unity.h>
+
+static Hle hle = {};
+
+// Block addresses are hashed by (addr / 16) modulo the table capacity, so addresses 0x1000 apart
+// all start probing from the same slot of the initial 256-entry table
+static constexpr u32 CHAIN_BASE = 0x10'0000;
+static constexpr u32 CHAIN_STRIDE = 0x1000;
+static constexpr u32 CHAIN_LENGTH = 8;
+
+void setUp(void)
+{
+    hle = (Hle){};
+}
+
+void tearDown(void)
+{
+    Hle_destroy(&hle);
+}
+
+static void assert_live(const u32 addr, const u8 size_class)
+{
+    const HleAllocator *const alloc = &hle.allocator;
+    const size_t slot = HleAllocator_find_block(alloc, addr);
+
+    TEST_ASSERT_NOT_EQUAL(alloc->blocks_capacity, slot);
+    TEST_ASSERT_EQUAL_HEX32(addr, alloc->block_addrs[slot]);
+    TEST_ASSERT_EQUAL(size_class, alloc->block_classes[slot]);
+}
+
+static void assert_dead(const u32 addr)
+{
+    const HleAllocator *const alloc = &hle.allocator;
+    TEST_ASSERT_EQUAL(alloc->blocks_capacity, HleAllocator_find_block(alloc, addr));
+}
+
+static void remove_live(const u32 addr)
+{
+    HleAllocator *const alloc = &hle.allocator;
+    const size_t slot = HleAllocator_find_block(alloc, addr);
+
+    TEST_ASSERT_NOT_EQUAL(alloc->blocks_capacity, slot);
+    HleAllocator_remove_block(alloc, slot);
+}
+
+void test_block_table_colliding_chain(void)
+{
+    HleAllocator *const alloc = &hle.allocator;
+
+    for (u32 i = 0; i < CHAIN_LENGTH; ++i)
+        HleAllocator_insert_block(alloc, CHAIN_BASE + (i * CHAIN_STRIDE), (u8)(4 + i));
+
+    TEST_ASSERT_EQUAL(256, alloc->blocks_capacity);
+    TEST_ASSERT_EQUAL(CHAIN_LENGTH, alloc->blocks_size);
+
+    // The middle of the chain, then its head, then its tail
+    remove_live(CHAIN_BASE + (3 * CHAIN_STRIDE));
+    remove_live(CHAIN_BASE);
+    remove_live(CHAIN_BASE + ((CHAIN_LENGTH - 1) * CHAIN_STRIDE));
+
+    TEST_ASSERT_EQUAL(CHAIN_LENGTH - 3, alloc->blocks_size);
+    assert_dead(CHAIN_BASE);
+    assert_dead(CHAIN_BASE + (3 * CHAIN_STRIDE));
+    assert_dead(CHAIN_BASE + ((CHAIN_LENGTH - 1) * CHAIN_STRIDE));
+
+    for (u32 i = 1; i < CHAIN_LENGTH - 1; ++i) {
+        if (i != 3)
+            assert_live(CHAIN_BASE + (i * CHAIN_STRIDE), (u8)(4 + i));
+    }
+
+    // A removed block can come back without duplicating the others
+    HleAllocator_insert_block(alloc, CHAIN_BASE + (3 * CHAIN_STRIDE), 7);
+    assert_live(CHAIN_BASE + (3 * CHAIN_STRIDE), 7);
+    TEST_ASSERT_EQUAL(CHAIN_LENGTH - 2, alloc->blocks_size);
+}
+
+void test_block_table_grows_after_removals(void)
+{
+    HleAllocator *const alloc = &hle.allocator;
+
+    for (u32 i = 0; i < CHAIN_LENGTH; ++i)
+        HleAllocator_insert_block(alloc, CHAIN_BASE + (i * CHAIN_STRIDE), 5);
+
+    remove_live(CHAIN_BASE + (2 * CHAIN_STRIDE));
+    remove_live(CHAIN_BASE + (5 * CHAIN_STRIDE));
+
+    // Enough blocks to go past half of the initial capacity, and then some
+    for (u32 i = 0; i < 300; ++i)
+        HleAllocator_insert_block(alloc, 0x200'0000 + (i * 16), 4);
+
+    TEST_ASSERT_EQUAL(1024, alloc->blocks_capacity);
+    TEST_ASSERT_EQUAL(CHAIN_LENGTH - 2 + 300, alloc->blocks_size);
+
+    for (u32 i = 0; i < CHAIN_LENGTH; ++i) {
+        if (i == 2 || i == 5)
+            assert_dead(CHAIN_BASE + (i * CHAIN_STRIDE));
+        else
+            assert_live(CHAIN_BASE + (i * CHAIN_STRIDE), 5);
+    }
+
+    for (u32 i = 0; i < 300; ++i)
+        assert_live(0x200'0000 + (i * 16), 4);
+
+    // Every other block out of the grown table, then check the rest is still reachable
+    for (u32 i = 0; i < 300; i += 2)
+        remove_live(0x200'0000 + (i * 16));
+
+    for (u32 i = 0; i < 300; ++i) {
+        if (i % 2 == 0)
+            assert_dead(0x200'0000 + (i * 16));
+        else
+            assert_live(0x200'0000 + (i * 16), 4);
+    }
+}
@@ -0,0 +1,96 @@
+#include "memory.h"
+#include <unity.h>
+
+static SegmentedMemory mem = {};
+
+void setUp(void)
+{
+    mem = SegmentedMemory_new();
+
+    const Segment text = {
+        .addr = 0x1000,
+        .size = 0x1000,
+        .perms = SegPerms_Read | SegPerms_Execute,
+    };
+
+    const Segment data = {
+        .addr = 0x2000,
+        .size = 0x1000,
+        .perms = SegPerms_Read | SegPerms_Write,
+    };
+
+    SegmentedMemory_add_segment(&mem, text);
+    SegmentedMemory_add_segment(&mem, data);
+}
+
+void tearDown(void)
+{
+    SegmentedMemory_destroy(&mem);
+}
+
+void test_read_span(void)
+{
+    const u8 *span = nullptr;
+
+    Memory_write(&mem.mem, 0x2004, 0x42);
+
+    TEST_ASSERT_EQUAL(MemoryResult_Ok, Memory_read_span(&mem.mem, 0x1FF0, 0x20, &span));
+    TEST_ASSERT_EQUAL_HEX8(0x42, span[0x14]);
+
+    TEST_ASSERT_EQUAL(MemoryResult_OutOfBounds,
+                      Memory_read_span(&mem.mem, 0xFFFF'FFF0, 0x20, &span));
+}
+
+void test_write_span(void)
+{
+    u8 *span = nullptr;
+
+    TEST_ASSERT_EQUAL(MemoryResult_WriteFault, Memory_write_span(&mem.mem, 0x1FF0, 0x20, &span));
+    TEST_ASSERT_FALSE(SegmentedMemory_page_is_dirty(&mem, 0x2));
+
+    TEST_ASSERT_EQUAL(MemoryResult_Ok, Memory_write_span(&mem.mem, 0x2FF0, 0x20, &span));
+    TEST_ASSERT_TRUE(SegmentedMemory_page_is_dirty(&mem, 0x2));
+    TEST_ASSERT_TRUE(SegmentedMemory_page_is_dirty(&mem, 0x3));
+
+    span[0x10] = 0x24;
+    TEST_ASSERT_EQUAL_HEX8(0x24, Memory_read(&mem.mem, 0x3000));
+}
+
+void test_sbrk(void)
+{
+    u32 top = 0;
+
+    TEST_ASSERT_TRUE(SegmentedMemory_init_heap(&mem, 0, 0x2000));
+    TEST_ASSERT_EQUAL(MemoryResult_Ok, Memory_sbrk(&mem.mem, 0x10, &top));
+    TEST_ASSERT_EQUAL_HEX32(0x3000, top);
+
+    Memory_write(&mem.mem, 0x3008, 0x42);
+
+    TEST_ASSERT_EQUAL(MemoryResult_Ok, Memory_sbrk(&mem.mem, -0x8, &top));
+    TEST_ASSERT_EQUAL(MemoryResult_Ok, Memory_sbrk(&mem.mem, 0x8, &top));
+    TEST_ASSERT_EQUAL_HEX32(0x3008, top);
+    TEST_ASSERT_EQUAL_HEX8(0x00, Memory_read(&mem.mem, 0x3008));
+
+    TEST_ASSERT_EQUAL(MemoryResult_OutOfBounds, Memory_sbrk(&mem.mem, 0x2000, &top));
+    TEST_ASSERT_EQUAL(MemoryResult_OutOfBounds, Memory_sbrk(&mem.mem, -0x20, &top));
+}
+
+void test_init_heap_overlap(void)
+{
+    TEST_ASSERT_FALSE(SegmentedMemory_init_heap(&mem, 0x2800, 0x1000));
+}
+
+void test_init_heap_stops_before_device_memory(void)
+{
+    const Segment pixels = {
+        .addr = 0x10'0000,
+        .size = 0x1000,
+        .perms = SegPerms_Read | SegPerms_Write | SegPerms_Device,
+    };
+
+    SegmentedMemory_add_segment(&mem, pixels);
+
+    TEST_ASSERT_TRUE(SegmentedMemory_init_heap(&mem, 0, 0x1000'0000));
+    TEST_ASSERT_EQUAL_HEX32(0x3000, mem.heap.start);
+    TEST_ASSERT_EQUAL_HEX32(0x10'0000, mem.heap.limit);
+}
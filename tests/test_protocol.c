@@ -0,0 +1,86 @@
+#include "protocol.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unity.h>
+
+// The client end of the connection is written to, the server end is read by the BufSock
+static int socks[2] = {-1, -1};
+
+void setUp(void)
+{
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, socks));
+    TEST_ASSERT_EQUAL(0, fcntl(socks[1], F_SETFL, O_NONBLOCK));
+}
+
+void tearDown(void)
+{
+    close(socks[0]);
+    close(socks[1]);
+}
+
+static void send_raw(const char *const data)
+{
+    TEST_ASSERT_EQUAL((ssize_t)strlen(data), write(socks[0], data, strlen(data)));
+}
+
+void test_receive_packet_after_acks(void)
+{
+    BufSock client = BufSock_new(socks[1], 64);
+    Packet packet = {};
+
+    send_raw("++$m1000,4#5c$g#67");
+
+    TEST_ASSERT_EQUAL(GdbResult_Ok, BufSock_receive_packet(&client, &packet));
+    TEST_ASSERT_EQUAL_STRING("m1000,4", packet.data.data);
+    TEST_ASSERT_EQUAL(7, packet.data.size);
+    TEST_ASSERT_EQUAL_HEX8(0x5C, packet.checksum);
+
+    TEST_ASSERT_EQUAL(GdbResult_Ok, BufSock_receive_packet(&client, &packet));
+    TEST_ASSERT_EQUAL_STRING("g", packet.data.data);
+
+    TEST_ASSERT_EQUAL(GdbResult_WouldBlock, BufSock_receive_packet(&client, &packet));
+    BufSock_destroy(&client);
+}
+
+void test_receive_packet_keeps_scan_across_refill(void)
+{
+    // The first read fills the buffer without reaching '#', and the acks before the packet are
+    // then dropped to make room for the rest of it
+    BufSock client = BufSock_new(socks[1], 8);
+    Packet packet = {};
+
+    send_raw("+++$abcd#12");
+
+    TEST_ASSERT_EQUAL(GdbResult_Ok, BufSock_receive_packet(&client, &packet));
+    TEST_ASSERT_EQUAL_STRING("abcd", packet.data.data);
+    TEST_ASSERT_EQUAL_HEX8(0x12, packet.checksum);
+    BufSock_destroy(&client);
+}
+
+void test_receive_packet_with_split_checksum(void)
+{
+    BufSock client = BufSock_new(socks[1], 64);
+    Packet packet = {};
+
+    send_raw("$qC#b");
+    TEST_ASSERT_EQUAL(GdbResult_WouldBlock, BufSock_receive_packet(&client, &packet));
+
+    send_raw("4");
+    TEST_ASSERT_EQUAL(GdbResult_Ok, BufSock_receive_packet(&client, &packet));
+    TEST_ASSERT_EQUAL_STRING("qC", packet.data.data);
+    TEST_ASSERT_EQUAL_HEX8(0xB4, packet.checksum);
+    BufSock_destroy(&client);
+}
+
+void test_receive_packet_too_long(void)
+{
+    BufSock client = BufSock_new(socks[1], 8);
+    Packet packet = {};
+
+    send_raw("$abcdefghij#00");
+
+    TEST_ASSERT_EQUAL(GdbResult_PacketTooLong, BufSock_receive_packet(&client, &packet));
+    BufSock_destroy(&client);
+}
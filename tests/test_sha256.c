@@ -0,0 +1,46 @@
+#include "sha256.h"
+#include <string.h>
+#include <unity.h>
+
+static void assert_digest(const char *const data, const size_t size, const u8 expected[SHA256_SIZE])
+{
+    u8 digest[SHA256_SIZE] = {};
+    sha256_digest(data, size, digest);
+
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, digest, SHA256_SIZE);
+}
+
+void test_sha256_empty(void)
+{
+    static const u8 expected[SHA256_SIZE] = {
+        0xE3, 0xB0, 0xC4, 0x42, 0x98, 0xFC, 0x1C, 0x14, 0x9A, 0xFB, 0xF4,
+        0xC8, 0x99, 0x6F, 0xB9, 0x24, 0x27, 0xAE, 0x41, 0xE4, 0x64, 0x9B,
+        0x93, 0x4C, 0xA4, 0x95, 0x99, 0x1B, 0x78, 0x52, 0xB8, 0x55,
+    };
+
+    assert_digest("", 0, expected);
+}
+
+void test_sha256_abc(void)
+{
+    static const u8 expected[SHA256_SIZE] = {
+        0xBA, 0x78, 0x16, 0xBF, 0x8F, 0x01, 0xCF, 0xEA, 0x41, 0x41, 0x40,
+        0xDE, 0x5D, 0xAE, 0x22, 0x23, 0xB0, 0x03, 0x61, 0xA3, 0x96, 0x17,
+        0x7A, 0x9C, 0xB4, 0x10, 0xFF, 0x61, 0xF2, 0x00, 0x15, 0xAD,
+    };
+
+    assert_digest("abc", 3, expected);
+}
+
+void test_sha256_two_blocks(void)
+{
+    // 56 bytes, so that the padding spills into a second block
+    static const char data[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    static const u8 expected[SHA256_SIZE] = {
+        0x24, 0x8D, 0x6A, 0x61, 0xD2, 0x06, 0x38, 0xB8, 0xE5, 0xC0, 0x26,
+        0x93, 0x0C, 0x3E, 0x60, 0x39, 0xA3, 0x3C, 0xE4, 0x59, 0x64, 0xFF,
+        0x21, 0x67, 0xF6, 0xEC, 0xED, 0xD4, 0x19, 0xDB, 0x06, 0xC1,
+    };
+
+    assert_digest(data, strlen(data), expected);
+}
@@ -0,0 +1,66 @@
+#include "cpu.h"
+#include "memory.h"
+#include "snapshot.h"
+#include <unity.h>
+
+static SegmentedMemory mem = {};
+static Cpu cpu = {};
+
+void setUp(void)
+{
+    mem = SegmentedMemory_new();
+    cpu = Cpu_new(nullptr);
+
+    const Segment seg = {
+        .addr = 0x1000,
+        .size = 0x2000,
+        .perms = SegPerms_Read | SegPerms_Write,
+    };
+
+    SegmentedMemory_add_segment(&mem, seg);
+}
+
+void tearDown(void)
+{
+    SegmentedMemory_destroy(&mem);
+}
+
+void test_fork_is_copy_on_write(void)
+{
+    Memory_write(&mem.mem, 0x1004, 0x12);
+    Memory_write(&mem.mem, 0x9000'0000, 0x34);
+    cpu.pc = 0x1000;
+
+    Cpu child_cpu = {};
+    SegmentedMemory child_mem = {};
+
+    TEST_ASSERT_EQUAL(SnapshotResult_Ok, Snapshot_fork(&cpu, &mem, &child_cpu, &child_mem));
+
+    TEST_ASSERT_EQUAL_HEX32(0x1000, child_cpu.pc);
+    TEST_ASSERT_EQUAL(1, child_mem.segments_size);
+    TEST_ASSERT_EQUAL_HEX8(0x12, Memory_read(&child_mem.mem, 0x1004));
+    TEST_ASSERT_EQUAL_HEX8(0x34, Memory_read(&child_mem.mem, 0x9000'0000));
+
+    Memory_write(&child_mem.mem, 0x1004, 0x56);
+    Memory_write(&mem.mem, 0x9000'0000, 0x78);
+
+    TEST_ASSERT_EQUAL_HEX8(0x12, Memory_read(&mem.mem, 0x1004));
+    TEST_ASSERT_EQUAL_HEX8(0x56, Memory_read(&child_mem.mem, 0x1004));
+    TEST_ASSERT_EQUAL_HEX8(0x34, Memory_read(&child_mem.mem, 0x9000'0000));
+
+    SegmentedMemory_destroy(&child_mem);
+}
+
+void test_snapshot_skips_zero_pages(void)
+{
+    Memory_write(&mem.mem, 0x2000, 0x01);
+
+    Snapshot snapshot = {};
+    TEST_ASSERT_EQUAL(SnapshotResult_Ok, Snapshot_capture(&cpu, &mem, &snapshot));
+
+    TEST_ASSERT_EQUAL(1, snapshot.runs_size);
+    TEST_ASSERT_EQUAL(0x2, snapshot.runs[0].first_page);
+    TEST_ASSERT_EQUAL(1, snapshot.runs[0].pages_size);
+
+    Snapshot_destroy(&snapshot);
+}
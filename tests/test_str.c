@@ -110,3 +110,17 @@ void test_string_clear(void)
 
     String_destroy(&s);
 }
+
+void test_string_push_hex_bytes(void)
+{
+    static constexpr u8 BYTES[] = {0x00, 0x7f, 0xa5, 0xff};
+
+    String s = String_from("m");
+    String_push_hex_bytes(&s, BYTES, sizeof(BYTES));
+    String_push_hex(&s, 0x0c);
+
+    TEST_ASSERT_EQUAL_STRING("m007fa5ff0c", s.data);
+    TEST_ASSERT_EQUAL(11, s.size);
+
+    String_destroy(&s);
+}
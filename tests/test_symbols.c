@@ -0,0 +1,63 @@
+#include "symbols.h"
+#include <unity.h>
+
+static SymbolTable table = {};
+
+void setUp(void)
+{
+    table = SymbolTable_new();
+
+    SymbolTable_push(&table, 0x2000, 0x10, "bar");
+    SymbolTable_push(&table, 0x1000, 0, "_start");
+    SymbolTable_push(&table, 0x1800, 0x20, "foo");
+    SymbolTable_push(&table, 0x1000, 0, "shadowed");
+
+    SymbolTable_finish(&table);
+}
+
+void tearDown(void)
+{
+    SymbolTable_destroy(&table);
+}
+
+void test_symbols_are_sorted_and_deduplicated(void)
+{
+    TEST_ASSERT_EQUAL(3, table.symbols_size);
+    TEST_ASSERT_EQUAL_HEX32(0x1000, table.addrs[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x1800, table.addrs[1]);
+    TEST_ASSERT_EQUAL_HEX32(0x2000, table.addrs[2]);
+    TEST_ASSERT_EQUAL_STRING("_start", SymbolTable_name(&table, 0));
+}
+
+void test_symbol_lookup(void)
+{
+    TEST_ASSERT_EQUAL(-1, SymbolTable_lookup(&table, 0x0FFF));
+    TEST_ASSERT_EQUAL(0, SymbolTable_lookup(&table, 0x1000));
+    TEST_ASSERT_EQUAL(0, SymbolTable_lookup(&table, 0x17FC));
+    TEST_ASSERT_EQUAL(1, SymbolTable_lookup(&table, 0x181C));
+    TEST_ASSERT_EQUAL(-1, SymbolTable_lookup(&table, 0x1820));
+    TEST_ASSERT_EQUAL(2, SymbolTable_lookup(&table, 0x200C));
+    TEST_ASSERT_EQUAL(-1, SymbolTable_lookup(&table, 0x2010));
+}
+
+void test_symbol_find_and_format(void)
+{
+    u32 addr = 0;
+
+    TEST_ASSERT_TRUE(SymbolTable_find(&table, "foo", &addr));
+    TEST_ASSERT_EQUAL_HEX32(0x1800, addr);
+    TEST_ASSERT_TRUE(SymbolTable_find(&table, "shadowed", &addr));
+    TEST_ASSERT_EQUAL_HEX32(0x1000, addr);
+    TEST_ASSERT_FALSE(SymbolTable_find(&table, "missing", &addr));
+
+    char buf[32] = {};
+
+    SymbolTable_format(&table, 0x1804, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("foo+0x4", buf);
+
+    SymbolTable_format(&table, 0x2000, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("bar", buf);
+
+    SymbolTable_format(&table, 0x10, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("", buf);
+}
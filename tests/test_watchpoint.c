@@ -0,0 +1,64 @@
+#include "watchpoint.h"
+#include <unity.h>
+
+static WatchpointSet set = {};
+
+void setUp(void)
+{
+    set = WatchpointSet_new();
+}
+
+void tearDown(void)
+{
+    WatchpointSet_destroy(&set);
+}
+
+void test_watchpoint_kinds(void)
+{
+    TEST_ASSERT_TRUE(WatchpointSet_insert(
+        &set, (Watchpoint){.addr = 0x1004, .size = 4, .kind = WatchKind_Write}));
+
+    WatchpointSet_check(&set, 0x1004, 4, WatchKind_Read);
+    TEST_ASSERT_FALSE(set.hit);
+
+    WatchpointSet_check(&set, 0x1000, 4, WatchKind_Write);
+    TEST_ASSERT_FALSE(set.hit);
+
+    WatchpointSet_check(&set, 0x1000, 8, WatchKind_Write);
+    TEST_ASSERT_TRUE(set.hit);
+    TEST_ASSERT_EQUAL_HEX32(0x1004, set.hit_addr);
+    TEST_ASSERT_EQUAL(WatchKind_Write, set.hit_watchpoint.kind);
+}
+
+void test_watchpoint_spanning_pages(void)
+{
+    TEST_ASSERT_TRUE(WatchpointSet_insert(
+        &set, (Watchpoint){.addr = 0x1FFE, .size = 4, .kind = WatchKind_Access}));
+
+    WatchpointSet_check(&set, 0x2001, 1, WatchKind_Read);
+    TEST_ASSERT_TRUE(set.hit);
+    TEST_ASSERT_EQUAL_HEX32(0x2001, set.hit_addr);
+    set.hit = false;
+
+    TEST_ASSERT_TRUE(WatchpointSet_remove(
+        &set, (Watchpoint){.addr = 0x1FFE, .size = 4, .kind = WatchKind_Access}));
+    TEST_ASSERT_EQUAL(0, set.pages[0]);
+
+    WatchpointSet_check(&set, 0x2001, 1, WatchKind_Read);
+    TEST_ASSERT_FALSE(set.hit);
+}
+
+void test_watchpoint_bad_ranges(void)
+{
+    TEST_ASSERT_FALSE(WatchpointSet_insert(
+        &set, (Watchpoint){.addr = 0x1000, .size = 0, .kind = WatchKind_Write}));
+    TEST_ASSERT_FALSE(WatchpointSet_insert(
+        &set, (Watchpoint){.addr = 0xFFFF'FFFC, .size = 8, .kind = WatchKind_Write}));
+    TEST_ASSERT_EQUAL(0, set.size);
+
+    TEST_ASSERT_TRUE(WatchpointSet_insert(
+        &set, (Watchpoint){.addr = 0xFFFF'FFFC, .size = 4, .kind = WatchKind_Write}));
+
+    WatchpointSet_check(&set, 0xFFFF'FFFF, 1, WatchKind_Write);
+    TEST_ASSERT_TRUE(set.hit);
+}